@@ -17,6 +17,9 @@
 package tsaarni.nativeeglexample;
 
 import android.app.Activity;
+import android.app.ActivityManager;
+import android.content.ComponentCallbacks2;
+import android.content.Context;
 import android.os.Bundle;
 import android.widget.Toast;
 import android.view.Surface;
@@ -32,11 +35,18 @@ public class NativeEglExample extends Activity implements SurfaceHolder.Callback
 
     private static String TAG = "EglSample";
 
+    // bytes the renderer may keep pinned while nothing asks for memory back
+    private long memoryBudget;
+
     @Override
     public void onCreate(Bundle savedInstanceState) {
         super.onCreate(savedInstanceState);
 
         Log.i(TAG, "onCreate()");
+        nativeSetCacheDir(getCacheDir().getAbsolutePath());
+        // a quarter of what the heap of this app may grow to
+        ActivityManager activityManager = (ActivityManager)getSystemService(Context.ACTIVITY_SERVICE);
+        memoryBudget = activityManager.getMemoryClass() * 1024L * 1024L / 4;
         
         setContentView(R.layout.main);
         SurfaceView surfaceView = (SurfaceView)findViewById(R.id.surfaceview);
@@ -54,6 +64,7 @@ public class NativeEglExample extends Activity implements SurfaceHolder.Callback
     protected void onStart() {
         super.onStart();
         Log.i(TAG, "onStart()");
+        nativeSetMemoryBudget(memoryBudget);
         nativeOnStart();
     }
 
@@ -78,8 +89,21 @@ public class NativeEglExample extends Activity implements SurfaceHolder.Callback
         nativeOnStop();
     }
 
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        Log.i(TAG, "onTrimMemory(" + level + ")");
+        // buffers kept for frame sizes not in use go, until the next onStart
+        if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW) {
+            nativeSetMemoryBudget(0);
+        }
+    }
+
     public void surfaceChanged(SurfaceHolder holder, int format, int w, int h) {
         nativeSetSurface(holder.getSurface());
+        // one frame pixel per pixel of the quad, which covers the middle
+        // half of the surface
+        nativeSetFrameSize(Math.max(w / 2, 1), Math.max(h / 2, 1));
     }
 
     public void surfaceCreated(SurfaceHolder holder) {
@@ -95,6 +119,21 @@ public class NativeEglExample extends Activity implements SurfaceHolder.Callback
     public static native void nativeOnPause();
     public static native void nativeOnStop();
     public static native void nativeSetSurface(Surface surface);
+    // Frame counters and per-stage times, one stage per line
+    public static native String nativeGetFrameStats();
+    // Render only into the shared buffers, without showing frames in the
+    // surface; applies from the next nativeOnStart
+    public static native void nativeSetOffscreen(boolean offscreen);
+    // Directory for shader programs linked in earlier runs, null to always
+    // compile them; applies from the next nativeOnStart
+    public static native void nativeSetCacheDir(String path);
+    // Size of the frames shared with consumers; sizes used before reuse
+    // the buffers consumers already imported
+    public static native void nativeSetFrameSize(int width, int height);
+    // Most memory the renderer keeps pinned for frames and exported
+    // buffers; buffers in use stay even beyond it. Applies immediately and
+    // to later nativeOnStarts
+    public static native void nativeSetMemoryBudget(long bytes);
 
     static {
         System.loadLibrary("nativeegl");
@@ -0,0 +1,152 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Checks that a consumer which never releases its frame only costs itself
+// frames: a Swapchain set up like Renderer::initialize() does feeds a
+// FrameBroadcaster with two subscribers, one of which keeps the first
+// frame it gets forever, while the other must receive every frame.
+//
+//     broadcast_check
+//
+// Prints what failed and exits non-zero if anything did.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "consumer_session.h"
+#include "frame_broadcaster.h"
+#include "swapchain.h"
+
+#define CHECK_BUFFERS 3
+#define CHECK_FRAMES 30
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Reads what arrived; returns the FRAME_READYs, released unless keep
+static int drain(ConsumerSession *consumer, bool keep)
+{
+    struct consumer_event_t event;
+    int frames = 0;
+
+    while (consumer->nextEvent(&event, false) > 0) {
+        for (int i = 0; i < event.num_fds; i++) {
+            close(event.fds[i]);
+        }
+        if (event.type != DMABUF_MSG_FRAME_READY) {
+            continue;
+        }
+        if (event.fence_fd >= 0) {
+            close(event.fence_fd);
+        }
+        frames++;
+        if (!keep) {
+            consumer->release(event.buffer_id, event.frame_id);
+        }
+    }
+    return frames;
+}
+
+static void check_stuck_consumer(enum swapchain_mode_t mode)
+{
+    char path[64];
+    FrameBroadcaster broadcaster;
+    Swapchain swapchain;
+    ConsumerSession fast;
+    ConsumerSession stuck;
+    struct dmabuf_buffer_registration_t buffers[CHECK_BUFFERS];
+    int fast_frames = 0;
+    int stuck_frames = 0;
+    uint64_t frame_id = 0;
+
+    snprintf(path, sizeof(path), "/tmp/broadcast_check_%d", (int)getpid());
+    CHECK(broadcaster.listen(path));
+    CHECK(fast.subscribe(path) && stuck.subscribe(path));
+    broadcaster.poll();
+    CHECK(broadcaster.consumerCount() == 2);
+
+    memset(buffers, 0, sizeof(buffers));
+    for (int i = 0; i < CHECK_BUFFERS; i++) {
+        buffers[i].buffer_id = i;
+        buffers[i].width = 4;
+        buffers[i].height = 4;
+        buffers[i].metadata.num_planes = 1;
+        buffers[i].fds[0] = memfd_create("broadcast_check", MFD_CLOEXEC);
+        buffers[i].num_fds = 1;
+    }
+    CHECK(broadcaster.setBuffers(buffers, CHECK_BUFFERS));
+    for (int i = 0; i < CHECK_BUFFERS; i++) {
+        close(buffers[i].fds[0]);
+    }
+
+    // as the renderer does: consumers hold frames, the swapchain only
+    // keeps one buffer back for the producer
+    CHECK(swapchain.init(CHECK_BUFFERS, mode, CHECK_BUFFERS - 1));
+    for (int frame = 0; frame < CHECK_FRAMES; frame++) {
+        int id = swapchain.dequeue();
+        CHECK(id >= 0);
+        if (id < 0) {
+            break;
+        }
+        swapchain.queue(id);
+        while ((id = swapchain.acquireNext()) >= 0) {
+            if (broadcaster.broadcastFrame(id, frame_id++, -1, DMABUF_FENCE_NONE) == 0) {
+                swapchain.release(id);
+            }
+        }
+        broadcaster.poll();
+        fast_frames += drain(&fast, false);
+        stuck_frames += drain(&stuck, true);
+
+        uint32_t ids[DMABUF_MAX_BUFFERS];
+        int count = broadcaster.receiveReleases(ids, DMABUF_MAX_BUFFERS);
+        for (int i = 0; i < count; i++) {
+            swapchain.release(ids[i]);
+        }
+    }
+
+    printf("%s: fast consumer %d frames, stuck consumer %d, stalls %llu\n",
+           mode == SWAPCHAIN_MODE_FIFO ? "fifo" : "mailbox", fast_frames, stuck_frames,
+           (unsigned long long)swapchain.stats().stalls);
+    CHECK(fast_frames == CHECK_FRAMES);
+    CHECK(stuck_frames == 1);
+    CHECK(swapchain.stats().stalls == 0);
+
+    broadcaster.close();
+    unlink(path);
+}
+
+int main()
+{
+    check_stuck_consumer(SWAPCHAIN_MODE_FIFO);
+    check_stuck_consumer(SWAPCHAIN_MODE_MAILBOX);
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("broadcast ok\n");
+    return 0;
+}
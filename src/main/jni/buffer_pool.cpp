@@ -0,0 +1,152 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+
+#include "logger.h"
+#include "buffer_pool.h"
+#include "dmabuf_format.h"
+
+#define LOG_TAG "EglSample"
+
+static bool key_matches(const struct buffer_pool_key_t &wanted, const struct buffer_pool_key_t &key)
+{
+    return wanted.width == key.width && wanted.height == key.height && wanted.fourcc == key.fourcc &&
+           (wanted.modifier == DMABUF_MOD_INVALID || wanted.modifier == key.modifier);
+}
+
+BufferPool::BufferPool()
+    : _budget(BUFFER_POOL_DEFAULT_BUDGET), _bytes(0), _clock(0)
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void BufferPool::reset()
+{
+    memset(_entries, 0, sizeof(_entries));
+    _bytes = 0;
+}
+
+int BufferPool::reuse(const struct buffer_pool_key_t &key)
+{
+    // The most recently used one, the least likely to be paged out
+    int best = -1;
+    for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+        const struct entry_t &entry = _entries[id];
+        if (entry.state == BUFFER_POOL_IDLE && !entry.held && key_matches(key, entry.key) &&
+            (best < 0 || entry.last_used > _entries[best].last_used)) {
+            best = id;
+        }
+    }
+    if (best >= 0) {
+        _entries[best].state = BUFFER_POOL_ACTIVE;
+        _entries[best].last_used = ++_clock;
+        _stats.reused++;
+    }
+    return best;
+}
+
+int BufferPool::reserve()
+{
+    for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+        if (_entries[id].state == BUFFER_POOL_EMPTY) {
+            _entries[id].state = BUFFER_POOL_RESERVED;
+            return id;
+        }
+    }
+    LOG_ERROR("buffer pool has no free ids");
+    return -1;
+}
+
+void BufferPool::add(int id, const struct buffer_pool_key_t &key, size_t bytes)
+{
+    struct entry_t &entry = _entries[id];
+
+    entry.state = BUFFER_POOL_ACTIVE;
+    entry.key = key;
+    entry.bytes = bytes;
+    entry.held = false;
+    entry.last_used = ++_clock;
+    _bytes += bytes;
+    _stats.allocated++;
+}
+
+void BufferPool::remove(int id)
+{
+    struct entry_t &entry = _entries[id];
+
+    if (entry.state == BUFFER_POOL_ACTIVE || entry.state == BUFFER_POOL_IDLE) {
+        _bytes -= entry.bytes;
+    }
+    memset(&entry, 0, sizeof(entry));
+}
+
+void BufferPool::retire(int id, bool held)
+{
+    struct entry_t &entry = _entries[id];
+
+    if (entry.state != BUFFER_POOL_ACTIVE) {
+        return;
+    }
+    entry.state = BUFFER_POOL_IDLE;
+    entry.held = held;
+    entry.last_used = ++_clock;
+}
+
+void BufferPool::release(int id)
+{
+    _entries[id].held = false;
+}
+
+int BufferPool::trim(size_t extra, int *ids, int max_ids)
+{
+    size_t remaining = _bytes;
+    bool chosen[DMABUF_MAX_BUFFERS];
+    int count = 0;
+
+    memset(chosen, 0, sizeof(chosen));
+    while (remaining + extra > _budget && count < max_ids) {
+        int oldest = -1;
+        for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+            const struct entry_t &entry = _entries[id];
+            if (entry.state == BUFFER_POOL_IDLE && !entry.held && !chosen[id] &&
+                (oldest < 0 || entry.last_used < _entries[oldest].last_used)) {
+                oldest = id;
+            }
+        }
+        if (oldest < 0) {
+            // whatever is left is in use
+            break;
+        }
+        chosen[oldest] = true;
+        remaining -= _entries[oldest].bytes;
+        ids[count++] = oldest;
+        _stats.evicted++;
+    }
+    return count;
+}
+
+size_t BufferPool::idleBytes() const
+{
+    size_t bytes = 0;
+    for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+        if (_entries[id].state == BUFFER_POOL_IDLE) {
+            bytes += _entries[id].bytes;
+        }
+    }
+    return bytes;
+}
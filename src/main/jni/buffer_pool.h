@@ -0,0 +1,116 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dmabuf_protocol.h"
+
+// Memory kept beyond this is given up, idle buffers first
+#define BUFFER_POOL_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// What a consumer imported a buffer as. A buffer can stand in for another
+// one only if all of it matches.
+struct buffer_pool_key_t
+{
+    uint32_t width;
+    uint32_t height;
+    int fourcc;
+    // DMABUF_MOD_INVALID in a lookup matches any modifier
+    uint64_t modifier;
+};
+
+enum buffer_pool_state_t {
+    BUFFER_POOL_EMPTY = 0,  // id unused
+    BUFFER_POOL_RESERVED,   // id handed out, buffer being created
+    BUFFER_POOL_ACTIVE,     // part of the swapchain
+    BUFFER_POOL_IDLE        // kept exported for when its size comes back
+};
+
+struct buffer_pool_stats_t
+{
+    uint64_t reused;    // buffers taken from the pool instead of allocated
+    uint64_t allocated; // buffers created
+    uint64_t evicted;   // idle buffers given up for the budget
+};
+
+// Bookkeeping for exported buffers of every frame size in use, so that a
+// size seen before, e.g. after rotating the device back, finds buffers the
+// consumers have already imported. Ids are the buffer ids on the wire and
+// stay with a buffer until it is evicted.
+//
+// Like Swapchain it only tracks state; the buffers are owned by the caller
+// and referred to by id. Not thread safe, use from the render thread only.
+class BufferPool {
+
+public:
+    BufferPool();
+
+    void setBudget(size_t bytes) { _budget = bytes; }
+    size_t budget() const { return _budget; }
+    // Forgets every buffer, the caller has destroyed them.
+    void reset();
+
+    // Id of an idle buffer matching key that no consumer holds, now
+    // active; -1 if there is none.
+    int reuse(const struct buffer_pool_key_t &key);
+    // A free id for a buffer about to be created, or -1.
+    int reserve();
+    // The buffer created for a reserved id, now active.
+    void add(int id, const struct buffer_pool_key_t &key, size_t bytes);
+    // The buffer is gone, or was never created for a reserved id.
+    void remove(int id);
+
+    // The buffer leaves the swapchain. With held set consumers still read
+    // from it and it cannot be reused before release().
+    void retire(int id, bool held);
+    // Consumers are done with a retired buffer.
+    void release(int id);
+
+    // Chooses idle buffers to give up, least recently used first, until
+    // extra more bytes fit in the budget, e.g. buffers about to be created
+    // and memory the caller holds outside the pool. Stores their ids for
+    // the caller to destroy and remove(), and returns their count.
+    int trim(size_t extra, int *ids, int max_ids);
+
+    enum buffer_pool_state_t state(int id) const { return _entries[id].state; }
+    const struct buffer_pool_key_t &key(int id) const { return _entries[id].key; }
+    size_t bytes() const { return _bytes; }
+    size_t bytes(int id) const { return _entries[id].bytes; }
+    size_t idleBytes() const;
+    const struct buffer_pool_stats_t &stats() const { return _stats; }
+
+private:
+    struct entry_t
+    {
+        enum buffer_pool_state_t state;
+        struct buffer_pool_key_t key;
+        size_t bytes;
+        bool held;
+        uint64_t last_used;
+    };
+
+    struct entry_t _entries[DMABUF_MAX_BUFFERS];
+    size_t _budget;
+    size_t _bytes;
+    uint64_t _clock;
+    struct buffer_pool_stats_t _stats;
+};
+
+#endif // BUFFER_POOL_H
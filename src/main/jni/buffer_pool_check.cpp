@@ -0,0 +1,189 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Checks BufferPool: which idle buffers reuse() hands out, held buffers
+// staying put, modifier matching and the order trim() gives buffers up in.
+//
+//     buffer_pool_check
+//
+// Prints what failed and exits non-zero if anything did.
+
+#include <stdio.h>
+
+#include "buffer_pool.h"
+#include "dmabuf_format.h"
+
+#define CHECK_FRAME_BYTES 1000
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static struct buffer_pool_key_t make_key(uint32_t width, uint32_t height, uint64_t modifier)
+{
+    struct buffer_pool_key_t key;
+
+    key.width = width;
+    key.height = height;
+    key.fourcc = DMABUF_FORMAT_ABGR8888;
+    key.modifier = modifier;
+    return key;
+}
+
+// A new active buffer of key, as create_ring() adds them
+static int add_buffer(BufferPool *pool, const struct buffer_pool_key_t &key)
+{
+    int id = pool->reserve();
+    if (id >= 0) {
+        pool->add(id, key, CHECK_FRAME_BYTES);
+    }
+    return id;
+}
+
+static void check_reuse()
+{
+    BufferPool pool;
+    struct buffer_pool_key_t small = make_key(64, 64, DMABUF_MOD_LINEAR);
+    struct buffer_pool_key_t large = make_key(128, 64, DMABUF_MOD_LINEAR);
+
+    CHECK(pool.reuse(small) < 0);
+    int a = add_buffer(&pool, small);
+    int b = add_buffer(&pool, small);
+    CHECK(a >= 0 && b >= 0 && a != b);
+    CHECK(pool.bytes() == 2 * CHECK_FRAME_BYTES);
+
+    // active buffers are not for reuse
+    CHECK(pool.reuse(small) < 0);
+
+    // the most recently retired one comes back first, a held one not at all
+    pool.retire(a, false);
+    pool.retire(b, true);
+    CHECK(pool.state(a) == BUFFER_POOL_IDLE && pool.state(b) == BUFFER_POOL_IDLE);
+    CHECK(pool.reuse(large) < 0);
+    CHECK(pool.reuse(small) == a);
+    CHECK(pool.reuse(small) < 0);
+    pool.release(b);
+    CHECK(pool.reuse(small) == b);
+    CHECK(pool.stats().reused == 2);
+
+    pool.retire(a, false);
+    pool.retire(b, false);
+    CHECK(pool.reuse(small) == b);
+    CHECK(pool.idleBytes() == CHECK_FRAME_BYTES);
+
+    pool.remove(a);
+    CHECK(pool.state(a) == BUFFER_POOL_EMPTY);
+    CHECK(pool.bytes() == CHECK_FRAME_BYTES);
+    // a reserved id that never got a buffer costs nothing
+    int c = pool.reserve();
+    pool.remove(c);
+    CHECK(pool.bytes() == CHECK_FRAME_BYTES);
+}
+
+static void check_modifiers()
+{
+    BufferPool pool;
+    const uint64_t tiled = 0x0100000000000001ULL;
+    int linear_id = add_buffer(&pool, make_key(64, 64, DMABUF_MOD_LINEAR));
+    int tiled_id = add_buffer(&pool, make_key(64, 64, tiled));
+
+    pool.retire(linear_id, false);
+    pool.retire(tiled_id, false);
+
+    // an exact modifier only matches itself
+    CHECK(pool.reuse(make_key(64, 64, DMABUF_MOD_LINEAR)) == linear_id);
+    CHECK(pool.reuse(make_key(64, 64, DMABUF_MOD_LINEAR)) < 0);
+    pool.retire(linear_id, false);
+
+    // DMABUF_MOD_INVALID takes any modifier, the most recently used first
+    CHECK(pool.reuse(make_key(64, 64, DMABUF_MOD_INVALID)) == linear_id);
+    CHECK(pool.reuse(make_key(64, 64, DMABUF_MOD_INVALID)) == tiled_id);
+    CHECK(pool.key(tiled_id).modifier == tiled);
+
+    // but not another size
+    pool.retire(linear_id, false);
+    CHECK(pool.reuse(make_key(64, 32, DMABUF_MOD_INVALID)) < 0);
+}
+
+static void check_trim()
+{
+    BufferPool pool;
+    struct buffer_pool_key_t old_size = make_key(32, 32, DMABUF_MOD_LINEAR);
+    struct buffer_pool_key_t new_size = make_key(64, 64, DMABUF_MOD_LINEAR);
+    int ids[DMABUF_MAX_BUFFERS];
+    int idle[4];
+
+    for (int i = 0; i < 4; i++) {
+        idle[i] = add_buffer(&pool, old_size);
+    }
+    int active = add_buffer(&pool, new_size);
+    // retired oldest first: idle[0] is the least recently used
+    for (int i = 0; i < 4; i++) {
+        pool.retire(idle[i], i == 1);
+    }
+
+    // within the budget nothing goes
+    pool.setBudget(5 * CHECK_FRAME_BYTES);
+    CHECK(pool.trim(0, ids, DMABUF_MAX_BUFFERS) == 0);
+
+    // room for one more: the least recently used idle one goes
+    CHECK(pool.trim(CHECK_FRAME_BYTES, ids, DMABUF_MAX_BUFFERS) == 1);
+    CHECK(ids[0] == idle[0]);
+
+    // the held one is skipped, the active one never chosen
+    pool.setBudget(0);
+    int count = pool.trim(0, ids, DMABUF_MAX_BUFFERS);
+    CHECK(count == 3);
+    if (count == 3) {
+        CHECK(ids[0] == idle[0] && ids[1] == idle[2] && ids[2] == idle[3]);
+    }
+    for (int i = 0; i < count; i++) {
+        CHECK(ids[i] != idle[1] && ids[i] != active);
+    }
+
+    // trim() only chooses, the caller removes
+    CHECK(pool.bytes() == 5 * CHECK_FRAME_BYTES);
+    for (int i = 0; i < count; i++) {
+        pool.remove(ids[i]);
+    }
+    CHECK(pool.bytes() == 2 * CHECK_FRAME_BYTES);
+    CHECK(pool.stats().evicted == 4);
+
+    // max_ids bounds how many are chosen
+    pool.release(idle[1]);
+    CHECK(pool.trim(0, ids, 0) == 0);
+    CHECK(pool.trim(0, ids, 1) == 1 && ids[0] == idle[1]);
+}
+
+int main()
+{
+    check_reuse();
+    check_modifiers();
+    check_trim();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("buffer pool ok\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+
+#include "command_queue.h"
+
+CommandQueue::CommandQueue()
+    : _head(0), _tail(0), _pushed(0), _full(0)
+{
+    // A slot is free for the producer whose position equals its sequence
+    // and readable once the sequence is one past it.
+    for (uint32_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+        memset(&_slots[i].command, 0, sizeof(_slots[i].command));
+    }
+}
+
+CommandQueue::~CommandQueue()
+{
+}
+
+bool CommandQueue::push(const struct render_command_t &command)
+{
+    uint32_t position = _head.load(std::memory_order_relaxed);
+    struct slot_t *slot;
+
+    for (;;) {
+        slot = &_slots[position & (COMMAND_QUEUE_SIZE - 1)];
+        uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - position);
+        if (diff == 0) {
+            // claim the slot; on failure position holds the new head
+            if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the consumer has not read this slot a lap ago
+            _full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->command = command;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    _pushed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool CommandQueue::pop(struct render_command_t *command)
+{
+    struct slot_t *slot = &_slots[_tail & (COMMAND_QUEUE_SIZE - 1)];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+    if ((int32_t)(sequence - (_tail + 1)) < 0) {
+        return false;
+    }
+    *command = slot->command;
+    // free for the producer one lap ahead
+    slot->sequence.store(_tail + COMMAND_QUEUE_SIZE, std::memory_order_release);
+    _tail++;
+    return true;
+}
+
+struct command_queue_stats_t CommandQueue::stats() const
+{
+    struct command_queue_stats_t stats;
+
+    stats.pushed = _pushed.load(std::memory_order_relaxed);
+    stats.full = _full.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,91 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "dmabuf_protocol.h"
+
+// Must be a power of two
+#define COMMAND_QUEUE_SIZE 64
+
+// Window and size are state, not events: the newest value wins, so the
+// caller keeps them itself and the command only says they changed.
+enum render_command_type_t {
+    RENDER_COMMAND_NONE = 0,
+    RENDER_COMMAND_WINDOW_SET,
+    RENDER_COMMAND_RESIZE,
+    RENDER_COMMAND_DAMAGE,         // rect of texture_data changed
+    RENDER_COMMAND_TEXTURE_UPDATE, // generate a frame now
+    RENDER_COMMAND_FRAME_SIZE,
+    RENDER_COMMAND_MEMORY_BUDGET,
+    RENDER_COMMAND_STOP
+};
+
+struct render_command_t
+{
+    enum render_command_type_t type;
+    struct dmabuf_rect_t rect;
+};
+
+struct command_queue_stats_t
+{
+    uint64_t pushed;   // commands queued
+    uint64_t full;     // pushes refused because the queue was full
+};
+
+// Bounded multi-producer single-consumer queue of render commands.
+//
+// Any thread may push(); only the render thread may pop(). Neither side
+// ever takes a lock or blocks: each slot carries a sequence number that
+// tells producers whether it is free and the consumer whether it has been
+// written, so a producer that is preempted midway only delays the commands
+// queued after its own.
+class CommandQueue {
+
+public:
+    CommandQueue();
+    virtual ~CommandQueue();
+
+    // False when the queue is full; the command is not queued.
+    bool push(const struct render_command_t &command);
+    // False when the queue is empty.
+    bool pop(struct render_command_t *command);
+
+    // Approximate when read outside the render thread.
+    struct command_queue_stats_t stats() const;
+
+private:
+    struct slot_t
+    {
+        std::atomic<uint32_t> sequence;
+        struct render_command_t command;
+    };
+
+    struct slot_t _slots[COMMAND_QUEUE_SIZE];
+    // next slot to write, shared by producers
+    std::atomic<uint32_t> _head;
+    // next slot to read, render thread only
+    uint32_t _tail;
+
+    std::atomic<uint64_t> _pushed;
+    std::atomic<uint64_t> _full;
+};
+
+#endif // COMMAND_QUEUE_H
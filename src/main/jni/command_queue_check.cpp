@@ -0,0 +1,181 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Checks CommandQueue: order and the full queue on one thread, wrapping
+// around the ring for many laps, and several threads pushing at once while
+// the main thread pops.
+//
+//     command_queue_check
+//
+// Prints what failed and exits non-zero if anything did.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "command_queue.h"
+
+#define CHECK_PUSHERS 4
+#define CHECK_PUSHES_EACH 50000
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static struct render_command_t make_command(int32_t pusher, int32_t sequence)
+{
+    struct render_command_t command;
+
+    command.type = RENDER_COMMAND_DAMAGE;
+    command.rect.x = pusher;
+    command.rect.y = sequence;
+    command.rect.width = 1;
+    command.rect.height = 1;
+    return command;
+}
+
+static void check_full_and_order()
+{
+    CommandQueue queue;
+    struct render_command_t command;
+
+    CHECK(!queue.pop(&command));
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        CHECK(queue.push(make_command(0, i)));
+    }
+    CHECK(!queue.push(make_command(0, COMMAND_QUEUE_SIZE)));
+    CHECK(queue.stats().full == 1);
+    CHECK(queue.stats().pushed == COMMAND_QUEUE_SIZE);
+
+    // one slot freed takes exactly one more
+    CHECK(queue.pop(&command) && command.rect.y == 0);
+    CHECK(queue.push(make_command(0, COMMAND_QUEUE_SIZE)));
+    CHECK(!queue.push(make_command(0, COMMAND_QUEUE_SIZE + 1)));
+
+    for (int i = 1; i <= COMMAND_QUEUE_SIZE; i++) {
+        CHECK(queue.pop(&command) && command.rect.y == i);
+    }
+    CHECK(!queue.pop(&command));
+}
+
+static void check_wraparound()
+{
+    CommandQueue queue;
+    struct render_command_t command;
+    int32_t pushed = 0;
+    int32_t popped = 0;
+
+    // batches of a size that does not divide the ring, so head and tail
+    // cross the end of it at every offset
+    for (int lap = 0; lap < 1000; lap++) {
+        int batch = 1 + lap % (COMMAND_QUEUE_SIZE - 1);
+        for (int i = 0; i < batch; i++) {
+            CHECK(queue.push(make_command(0, pushed++)));
+        }
+        for (int i = 0; i < batch; i++) {
+            CHECK(queue.pop(&command) && command.rect.y == popped);
+            popped++;
+        }
+    }
+    CHECK(!queue.pop(&command));
+    CHECK(queue.stats().full == 0);
+}
+
+struct pusher_t
+{
+    pthread_t thread;
+    CommandQueue *queue;
+    int32_t index;
+    uint64_t refused;
+};
+
+static void *push_all(void *arg)
+{
+    struct pusher_t *pusher = (struct pusher_t *)arg;
+
+    for (int32_t i = 0; i < CHECK_PUSHES_EACH; i++) {
+        // a full queue refuses; the caller decides whether to retry
+        while (!pusher->queue->push(make_command(pusher->index, i))) {
+            pusher->refused++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void check_concurrent_pushers()
+{
+    CommandQueue queue;
+    struct pusher_t pushers[CHECK_PUSHERS];
+    int32_t next[CHECK_PUSHERS];
+    uint64_t refused = 0;
+    int total = 0;
+
+    for (int i = 0; i < CHECK_PUSHERS; i++) {
+        pushers[i].queue = &queue;
+        pushers[i].index = i;
+        pushers[i].refused = 0;
+        next[i] = 0;
+        pthread_create(&pushers[i].thread, NULL, push_all, &pushers[i]);
+    }
+
+    // each pusher's commands come out in the order it pushed them
+    while (total < CHECK_PUSHERS * CHECK_PUSHES_EACH) {
+        struct render_command_t command;
+        if (!queue.pop(&command)) {
+            sched_yield();
+            continue;
+        }
+        int32_t pusher = command.rect.x;
+        CHECK(pusher >= 0 && pusher < CHECK_PUSHERS);
+        if (pusher < 0 || pusher >= CHECK_PUSHERS) {
+            break;
+        }
+        CHECK(command.rect.y == next[pusher]);
+        next[pusher] = command.rect.y + 1;
+        total++;
+    }
+
+    for (int i = 0; i < CHECK_PUSHERS; i++) {
+        pthread_join(pushers[i].thread, NULL);
+        refused += pushers[i].refused;
+    }
+    struct render_command_t command;
+    CHECK(!queue.pop(&command));
+    CHECK(queue.stats().pushed == (uint64_t)CHECK_PUSHERS * CHECK_PUSHES_EACH);
+    CHECK(queue.stats().full == refused);
+    printf("concurrent pushes %d, refused while full %llu\n", total, (unsigned long long)refused);
+}
+
+int main()
+{
+    check_full_and_order();
+    check_wraparound();
+    check_concurrent_pushers();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("command queue ok\n");
+    return 0;
+}
@@ -0,0 +1,269 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logger.h"
+#include "consumer_session.h"
+#include "trace.h"
+
+#define LOG_TAG "EglSample"
+
+ConsumerSession::ConsumerSession()
+    : _sock(-1), _rx_len(0), _fd_count(0)
+{
+}
+
+ConsumerSession::~ConsumerSession()
+{
+    close();
+}
+
+bool ConsumerSession::subscribe(const char *path)
+{
+    struct sockaddr_un addr;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        LOG_ERROR("create socket failed %s", strerror(errno));
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("subscribe to %s failed %s", path, strerror(errno));
+        ::close(sock);
+        return false;
+    }
+    return adopt(sock);
+}
+
+bool ConsumerSession::adopt(int sock)
+{
+    close();
+    _sock = sock;
+    return true;
+}
+
+void ConsumerSession::close()
+{
+    if (_sock >= 0) {
+        ::close(_sock);
+        _sock = -1;
+    }
+    for (int i = 0; i < _fd_count; i++) {
+        ::close(_fds[i]);
+    }
+    _fd_count = 0;
+    _rx_len = 0;
+}
+
+int ConsumerSession::nextEvent(struct consumer_event_t *event, bool wait)
+{
+    if (_sock < 0) {
+        return -1;
+    }
+
+    for (;;) {
+        if (_rx_len >= sizeof(struct dmabuf_message_header_t)) {
+            struct dmabuf_message_header_t header;
+            memcpy(&header, _rx, sizeof(header));
+            if (header.magic == DMABUF_PROTOCOL_MAGIC && header.version != DMABUF_PROTOCOL_VERSION) {
+                LOG_ERROR("producer speaks protocol version %u, not %u", header.version,
+                          DMABUF_PROTOCOL_VERSION);
+                close();
+                return -1;
+            }
+            if (header.magic != DMABUF_PROTOCOL_MAGIC ||
+                header.size < sizeof(header) || header.size > DMABUF_MAX_MESSAGE_SIZE) {
+                LOG_ERROR("consumer received malformed message");
+                close();
+                return -1;
+            }
+
+            if (_rx_len >= header.size) {
+                bool valid = true;
+
+                memset(event, 0, sizeof(*event));
+                event->type = (enum dmabuf_message_type_t)header.type;
+                event->fence_fd = -1;
+
+                if (header.type == DMABUF_MSG_REGISTER_BUFFER &&
+                    header.size >= sizeof(struct dmabuf_register_buffer_msg_t)) {
+                    struct dmabuf_register_buffer_msg_t msg;
+                    memcpy(&msg, _rx, sizeof(msg));
+                    event->buffer_id = msg.buffer_id;
+                    event->width = msg.width;
+                    event->height = msg.height;
+                    event->metadata = msg.metadata;
+                    event->num_fds = msg.num_fds;
+                    valid = msg.num_fds <= DMABUF_MAX_PLANES && take_fds(event->fds, msg.num_fds);
+                } else if (header.type == DMABUF_MSG_FRAME_READY &&
+                           header.size >= DMABUF_FRAME_READY_MIN_SIZE) {
+                    struct dmabuf_frame_ready_msg_t msg;
+                    memset(&msg, 0, sizeof(msg));
+                    memcpy(&msg, _rx, header.size < sizeof(msg) ? header.size : sizeof(msg));
+                    event->buffer_id = msg.buffer_id;
+                    event->frame_id = msg.frame_id;
+                    event->timing = msg.timing;
+                    event->receive_ns = dmabuf_timestamp_ns();
+                    TRACE_ASYNC_BEGIN("frame", msg.frame_id);
+                    event->fence_type = (enum dmabuf_fence_type_t)msg.fence_type;
+                    // whatever does not fit is treated as whole-buffer damage
+                    size_t rects = (header.size - DMABUF_FRAME_READY_MIN_SIZE) / sizeof(struct dmabuf_rect_t);
+                    if (msg.num_damage <= rects && msg.num_damage <= DMABUF_MAX_DAMAGE_RECTS) {
+                        event->num_damage = msg.num_damage;
+                        memcpy(event->damage, msg.damage, sizeof(struct dmabuf_rect_t) * msg.num_damage);
+                    }
+                    if (msg.fence_type != DMABUF_FENCE_NONE) {
+                        valid = take_fds(&event->fence_fd, 1);
+                    }
+                } else if (header.type == DMABUF_MSG_UNREGISTER_BUFFER &&
+                           header.size >= sizeof(struct dmabuf_unregister_buffer_msg_t)) {
+                    struct dmabuf_unregister_buffer_msg_t msg;
+                    memcpy(&msg, _rx, sizeof(msg));
+                    event->buffer_id = msg.buffer_id;
+                }
+
+                _rx_len -= header.size;
+                memmove(_rx, _rx + header.size, _rx_len);
+
+                if (!valid) {
+                    LOG_ERROR("consumer message without its fds");
+                    close();
+                    return -1;
+                }
+                return 1;
+            }
+        }
+
+        int fds[FD_TRANSFER_MAX_FDS];
+        int num_fds = 0;
+        ssize_t received = recv_fds(_sock, _rx + _rx_len, sizeof(_rx) - _rx_len,
+                                    fds, FD_TRANSFER_MAX_FDS, &num_fds, wait ? 0 : MSG_DONTWAIT);
+        if (received < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (received <= 0) {
+            if (received < 0) {
+                LOG_ERROR("consumer receive failed %s", strerror(errno));
+            }
+            close();
+            return -1;
+        }
+
+        _rx_len += received;
+        for (int i = 0; i < num_fds; i++) {
+            if (_fd_count < (int)(sizeof(_fds) / sizeof(_fds[0]))) {
+                _fds[_fd_count++] = fds[i];
+            } else {
+                ::close(fds[i]);
+            }
+        }
+    }
+}
+
+bool ConsumerSession::release(uint32_t buffer_id, uint64_t frame_id)
+{
+    TRACE_FRAME_SCOPE("release", frame_id);
+    struct dmabuf_buffer_release_msg_t msg;
+
+    if (_sock < 0) {
+        return false;
+    }
+    TRACE_ASYNC_END("frame", frame_id);
+
+    memset(&msg, 0, sizeof(msg));
+    dmabuf_init_header(&msg.header, DMABUF_MSG_BUFFER_RELEASE, sizeof(msg));
+    msg.buffer_id = buffer_id;
+    msg.frame_id = frame_id;
+
+    if (!send_fds(_sock, &msg, sizeof(msg), NULL, 0)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ConsumerSession::take_fds(int *fds, int count)
+{
+    if (count > _fd_count) {
+        return false;
+    }
+    memcpy(fds, _fds, sizeof(int) * count);
+    _fd_count -= count;
+    memmove(_fds, _fds + count, sizeof(int) * _fd_count);
+    return true;
+}
+
+bool ConsumerSession::acknowledge(uint32_t buffer_id, uint64_t frame_id,
+                                  const struct dmabuf_consumer_timing_t &timing)
+{
+    struct dmabuf_frame_ack_msg_t msg;
+
+    if (_sock < 0) {
+        return false;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    dmabuf_init_header(&msg.header, DMABUF_MSG_FRAME_ACK, sizeof(msg));
+    msg.buffer_id = buffer_id;
+    msg.frame_id = frame_id;
+    msg.timing = timing;
+
+    if (!send_fds(_sock, &msg, sizeof(msg), NULL, 0)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ConsumerSession::advertiseFormats(const struct dmabuf_format_set_t *formats)
+{
+    struct dmabuf_supported_formats_msg_t msg;
+    int sent = 0;
+
+    if (_sock < 0) {
+        return false;
+    }
+    // an empty list still needs its last message
+    do {
+        int count = formats->count - sent;
+        if (count > DMABUF_FORMATS_PER_MESSAGE) {
+            count = DMABUF_FORMATS_PER_MESSAGE;
+        }
+        size_t size = DMABUF_SUPPORTED_FORMATS_MIN_SIZE + count * sizeof(struct dmabuf_format_modifier_t);
+        memset(&msg, 0, sizeof(msg));
+        dmabuf_init_header(&msg.header, DMABUF_MSG_SUPPORTED_FORMATS, size);
+        msg.count = count;
+        msg.last = sent + count == formats->count;
+        memcpy(msg.formats, formats->formats + sent, count * sizeof(struct dmabuf_format_modifier_t));
+        if (!send_fds(_sock, &msg, size, NULL, 0)) {
+            close();
+            return false;
+        }
+        sent += count;
+    } while (sent < formats->count);
+    return true;
+}
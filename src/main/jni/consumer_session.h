@@ -0,0 +1,97 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef CONSUMER_SESSION_H
+#define CONSUMER_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dmabuf_format.h"
+#include "dmabuf_protocol.h"
+#include "fd_transfer.h"
+
+// One decoded producer message. Any fds in it are owned by the receiver.
+struct consumer_event_t
+{
+    enum dmabuf_message_type_t type;
+    uint32_t buffer_id;
+
+    // DMABUF_MSG_REGISTER_BUFFER
+    uint32_t width;
+    uint32_t height;
+    struct texture_storage_metadata_t metadata;
+    int fds[DMABUF_MAX_PLANES];
+    int num_fds;
+
+    // DMABUF_MSG_FRAME_READY
+    uint64_t frame_id;
+    int fence_fd;
+    enum dmabuf_fence_type_t fence_type;
+    // the producer's times, and when the message was read here
+    struct dmabuf_frame_timing_t timing;
+    uint64_t receive_ns;
+    // changed since the previous frame received, 0 rects for everything
+    int num_damage;
+    struct dmabuf_rect_t damage[DMABUF_MAX_DAMAGE_RECTS];
+};
+
+// Consumer end of the producer protocol. Reassembles messages from the
+// stream and pairs them with the fds that arrived as SCM_RIGHTS.
+class ConsumerSession {
+
+public:
+    ConsumerSession();
+    virtual ~ConsumerSession();
+
+    // Connects to a producer accepting subscriptions on path.
+    bool subscribe(const char *path);
+    // Takes over an already connected socket.
+    bool adopt(int sock);
+    void close();
+    bool isConnected() const { return _sock >= 0; }
+    int fd() const { return _sock; }
+
+    // Returns 1 and fills event when a message is available, 0 if none is
+    // (only when wait is false) and -1 when the producer went away.
+    int nextEvent(struct consumer_event_t *event, bool wait);
+
+    // Hands buffer_id back to the producer.
+    bool release(uint32_t buffer_id, uint64_t frame_id);
+    // Reports when a frame was received, imported and shown, see
+    // dmabuf_frame_ack_msg_t. Best sent just before release(); timestamps
+    // come from dmabuf_timestamp_ns().
+    bool acknowledge(uint32_t buffer_id, uint64_t frame_id, const struct dmabuf_consumer_timing_t &timing);
+
+    // Tells the producer what can be imported, e.g. from
+    // DmabufImporter::queryFormats(); it then exports nothing else where
+    // it has the choice. Best sent right after subscribing.
+    bool advertiseFormats(const struct dmabuf_format_set_t *formats);
+
+private:
+    bool take_fds(int *fds, int count);
+
+    int _sock;
+
+    char _rx[DMABUF_MAX_MESSAGE_SIZE * 8];
+    size_t _rx_len;
+
+    // fds received but not yet matched with their message, in order
+    int _fds[FD_TRANSFER_MAX_FDS * 2];
+    int _fd_count;
+};
+
+#endif // CONSUMER_SESSION_H
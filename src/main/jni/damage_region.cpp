@@ -0,0 +1,143 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+
+#include "damage_region.h"
+
+static inline int32_t min32(int32_t a, int32_t b) { return a < b ? a : b; }
+static inline int32_t max32(int32_t a, int32_t b) { return a > b ? a : b; }
+
+static struct dmabuf_rect_t rect_union(const struct dmabuf_rect_t *a, const struct dmabuf_rect_t *b)
+{
+    struct dmabuf_rect_t r;
+    r.x = min32(a->x, b->x);
+    r.y = min32(a->y, b->y);
+    r.width = max32(a->x + a->width, b->x + b->width) - r.x;
+    r.height = max32(a->y + a->height, b->y + b->height) - r.y;
+    return r;
+}
+
+static int64_t rect_area(const struct dmabuf_rect_t *r)
+{
+    return (int64_t)r->width * r->height;
+}
+
+static bool rect_contains(const struct dmabuf_rect_t *outer, const struct dmabuf_rect_t *inner)
+{
+    return inner->x >= outer->x && inner->y >= outer->y &&
+           inner->x + inner->width <= outer->x + outer->width &&
+           inner->y + inner->height <= outer->y + outer->height;
+}
+
+void damage_region_clear(struct damage_region_t *region)
+{
+    memset(region, 0, sizeof(*region));
+}
+
+void damage_region_set_full(struct damage_region_t *region)
+{
+    region->full = true;
+    region->count = 0;
+}
+
+bool damage_region_is_empty(const struct damage_region_t *region)
+{
+    return !region->full && region->count == 0;
+}
+
+void damage_region_add(struct damage_region_t *region, const struct dmabuf_rect_t *rect)
+{
+    if (region->full || rect->width <= 0 || rect->height <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < region->count; i++) {
+        if (rect_contains(&region->rects[i], rect)) {
+            return;
+        }
+    }
+
+    if (region->count < DMABUF_MAX_DAMAGE_RECTS) {
+        region->rects[region->count++] = *rect;
+        return;
+    }
+
+    // Out of rects, grow the one that needs the least extra area
+    int best = 0;
+    int64_t best_growth = -1;
+    for (int i = 0; i < region->count; i++) {
+        struct dmabuf_rect_t merged = rect_union(&region->rects[i], rect);
+        int64_t growth = rect_area(&merged) - rect_area(&region->rects[i]);
+        if (best_growth < 0 || growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    region->rects[best] = rect_union(&region->rects[best], rect);
+}
+
+void damage_region_union(struct damage_region_t *region, const struct damage_region_t *other)
+{
+    if (other->full) {
+        damage_region_set_full(region);
+        return;
+    }
+    for (int i = 0; i < other->count; i++) {
+        damage_region_add(region, &other->rects[i]);
+    }
+}
+
+int damage_region_rects(const struct damage_region_t *region, uint32_t width, uint32_t height,
+                        struct dmabuf_rect_t *rects)
+{
+    if (region->full) {
+        rects[0].x = 0;
+        rects[0].y = 0;
+        rects[0].width = width;
+        rects[0].height = height;
+        return 1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < region->count; i++) {
+        const struct dmabuf_rect_t *r = &region->rects[i];
+        int32_t x0 = max32(r->x, 0);
+        int32_t y0 = max32(r->y, 0);
+        int32_t x1 = min32(r->x + r->width, (int32_t)width);
+        int32_t y1 = min32(r->y + r->height, (int32_t)height);
+        if (x1 > x0 && y1 > y0) {
+            rects[count].x = x0;
+            rects[count].y = y0;
+            rects[count].width = x1 - x0;
+            rects[count].height = y1 - y0;
+            count++;
+        }
+    }
+    return count;
+}
+
+uint64_t damage_region_area(const struct damage_region_t *region, uint32_t width, uint32_t height)
+{
+    struct dmabuf_rect_t rects[DMABUF_MAX_DAMAGE_RECTS];
+    int count = damage_region_rects(region, width, height, rects);
+    uint64_t area = 0;
+
+    for (int i = 0; i < count; i++) {
+        area += rect_area(&rects[i]);
+    }
+    return area;
+}
@@ -0,0 +1,51 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DAMAGE_REGION_H
+#define DAMAGE_REGION_H
+
+#include <stdint.h>
+
+#include "dmabuf_protocol.h"
+
+// Changed area of a buffer as a short list of rectangles. When more than
+// DMABUF_MAX_DAMAGE_RECTS are added, rects are merged into the one that
+// grows the least, so the region may cover more than what changed but
+// never less.
+struct damage_region_t
+{
+    bool full; // everything changed, rects are ignored
+    int count;
+    struct dmabuf_rect_t rects[DMABUF_MAX_DAMAGE_RECTS];
+};
+
+void damage_region_clear(struct damage_region_t *region);
+void damage_region_set_full(struct damage_region_t *region);
+bool damage_region_is_empty(const struct damage_region_t *region);
+
+// Rects with no area are ignored.
+void damage_region_add(struct damage_region_t *region, const struct dmabuf_rect_t *rect);
+void damage_region_union(struct damage_region_t *region, const struct damage_region_t *other);
+
+// Writes the region clipped to a width x height buffer; a full region
+// becomes one rect covering the buffer. Returns the number of rects.
+int damage_region_rects(const struct damage_region_t *region, uint32_t width, uint32_t height,
+                        struct dmabuf_rect_t *rects);
+
+// Pixels covered, counting overlaps twice.
+uint64_t damage_region_area(const struct damage_region_t *region, uint32_t width, uint32_t height);
+
+#endif // DAMAGE_REGION_H
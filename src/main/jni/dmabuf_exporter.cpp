@@ -0,0 +1,99 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include <string.h>
+
+#include "logger.h"
+#include "dmabuf_exporter.h"
+
+#define LOG_TAG "EglSample"
+
+bool dmabuf_exporter_supported(EGLDisplay display)
+{
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    return extensions && strstr(extensions, "EGL_MESA_image_dma_buf_export");
+}
+
+bool dmabuf_export_image(EGLDisplay display, EGLImageKHR image,
+                         struct dmabuf_buffer_registration_t *buffer)
+{
+    EGLint err;
+
+    // EGL (extension: EGL_MESA_image_dma_buf_export): Get file descriptors (buffer->fds) for the EGL image and get
+    // the storage data of every plane (buffer->metadata)
+    PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC eglExportDMABUFImageQueryMESA =
+            (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)eglGetProcAddress("eglExportDMABUFImageQueryMESA");
+    PFNEGLEXPORTDMABUFIMAGEMESAPROC eglExportDMABUFImageMESA =
+            (PFNEGLEXPORTDMABUFIMAGEMESAPROC)eglGetProcAddress("eglExportDMABUFImageMESA");
+    if (!eglExportDMABUFImageQueryMESA || !eglExportDMABUFImageMESA) {
+        LOG_ERROR("EGL_MESA_image_dma_buf_export unsupported, cannot export image");
+        return false;
+    }
+
+    struct texture_storage_metadata_t *metadata = &buffer->metadata;
+    int num_planes;
+    eglExportDMABUFImageQueryMESA(display,
+                                  image,
+                                  &metadata->fourcc,
+                                  &num_planes,
+                                  &metadata->modifiers);
+    err = eglGetError();
+    if (err !=EGL_SUCCESS) {
+        LOG_ERROR("error happened tex parameteri %08X \n",err);
+        return false;
+    }
+    if (num_planes < 1 || num_planes > DMABUF_MAX_PLANES) {
+        LOG_ERROR("cannot share image with %d planes", num_planes);
+        return false;
+    }
+
+    int fds[DMABUF_MAX_PLANES];
+    EGLint strides[DMABUF_MAX_PLANES];
+    EGLint offsets[DMABUF_MAX_PLANES];
+    eglExportDMABUFImageMESA(display,
+                             image,
+                             fds,
+                             strides,
+                             offsets);
+    err = eglGetError();
+    if (err !=EGL_SUCCESS) {
+        LOG_ERROR("error happened tex parameteri %08X \n",err);
+        return false;
+    }
+
+    // A plane without its own fd lives in the dma-buf of the first plane
+    metadata->num_planes = num_planes;
+    buffer->num_fds = 0;
+    for (int i = 0; i < num_planes; i++) {
+        struct texture_plane_metadata_t *plane = &metadata->planes[i];
+        if (fds[i] >= 0) {
+            buffer->fds[buffer->num_fds] = fds[i];
+            plane->fd_index = buffer->num_fds++;
+        } else {
+            plane->fd_index = 0;
+        }
+        plane->stride = strides[i];
+        plane->offset = offsets[i];
+        plane->modifier = metadata->modifiers;
+    }
+    if (buffer->num_fds == 0) {
+        LOG_ERROR("image exported without any fd");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,34 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DMABUF_EXPORTER_H
+#define DMABUF_EXPORTER_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "producer_session.h"
+
+// True if display can export EGLImages with EGL_MESA_image_dma_buf_export.
+bool dmabuf_exporter_supported(EGLDisplay display);
+
+// Exports the storage of image as dma-buf fds (buffer->fds, owned by the
+// caller) and fills in the plane layout of buffer->metadata. buffer_id,
+// width and height are left for the caller.
+bool dmabuf_export_image(EGLDisplay display, EGLImageKHR image,
+                         struct dmabuf_buffer_registration_t *buffer);
+
+#endif // DMABUF_EXPORTER_H
@@ -0,0 +1,134 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+
+#include "dmabuf_format.h"
+
+int dmabuf_format_num_planes(int fourcc)
+{
+    switch (fourcc) {
+        case DMABUF_FORMAT_ABGR8888:
+        case DMABUF_FORMAT_XBGR8888:
+        case DMABUF_FORMAT_ARGB8888:
+            return 1;
+        case DMABUF_FORMAT_NV12:
+            return 2;
+        case DMABUF_FORMAT_YUV420:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+uint32_t dmabuf_format_plane_width_bytes(int fourcc, int plane, uint32_t width)
+{
+    switch (fourcc) {
+        case DMABUF_FORMAT_ABGR8888:
+        case DMABUF_FORMAT_XBGR8888:
+        case DMABUF_FORMAT_ARGB8888:
+            return width * 4;
+        case DMABUF_FORMAT_NV12:
+            // chroma plane: width/2 CbCr pairs
+            return plane == 0 ? width : ((width + 1) / 2) * 2;
+        case DMABUF_FORMAT_YUV420:
+            return plane == 0 ? width : (width + 1) / 2;
+        default:
+            return 0;
+    }
+}
+
+uint32_t dmabuf_format_plane_height(int fourcc, int plane, uint32_t height)
+{
+    if (plane > 0 && (fourcc == DMABUF_FORMAT_NV12 || fourcc == DMABUF_FORMAT_YUV420)) {
+        return (height + 1) / 2;
+    }
+    return height;
+}
+
+size_t dmabuf_format_frame_size(int fourcc, uint32_t width, uint32_t height)
+{
+    size_t size = 0;
+    int num_planes = dmabuf_format_num_planes(fourcc);
+
+    for (int i = 0; i < num_planes; i++) {
+        size += (size_t)dmabuf_format_plane_width_bytes(fourcc, i, width) *
+                dmabuf_format_plane_height(fourcc, i, height);
+    }
+    return size;
+}
+
+size_t dmabuf_format_layout(int fourcc, uint32_t width, uint32_t height,
+                            uint32_t stride_align,
+                            struct texture_storage_metadata_t *metadata)
+{
+    int num_planes = dmabuf_format_num_planes(fourcc);
+    size_t offset = 0;
+
+    if (num_planes == 0) {
+        return 0;
+    }
+    if (stride_align == 0) {
+        stride_align = 1;
+    }
+
+    memset(metadata, 0, sizeof(*metadata));
+    metadata->fourcc = fourcc;
+    metadata->modifiers = DMABUF_MOD_LINEAR;
+    metadata->num_planes = num_planes;
+
+    for (int i = 0; i < num_planes; i++) {
+        uint32_t row = dmabuf_format_plane_width_bytes(fourcc, i, width);
+        uint32_t stride = (row + stride_align - 1) / stride_align * stride_align;
+
+        metadata->planes[i].fd_index = 0;
+        metadata->planes[i].stride = stride;
+        metadata->planes[i].offset = offset;
+        metadata->planes[i].modifier = DMABUF_MOD_LINEAR;
+        offset += (size_t)stride * dmabuf_format_plane_height(fourcc, i, height);
+    }
+    return offset;
+}
+
+void dmabuf_format_set_clear(struct dmabuf_format_set_t *set)
+{
+    set->count = 0;
+}
+
+bool dmabuf_format_set_add(struct dmabuf_format_set_t *set, int fourcc, uint64_t modifier)
+{
+    if (dmabuf_format_set_contains(set, fourcc, modifier)) {
+        return true;
+    }
+    if (set->count >= DMABUF_MAX_FORMAT_MODIFIERS) {
+        return false;
+    }
+    set->formats[set->count].fourcc = fourcc;
+    set->formats[set->count].reserved = 0;
+    set->formats[set->count].modifier = modifier;
+    set->count++;
+    return true;
+}
+
+bool dmabuf_format_set_contains(const struct dmabuf_format_set_t *set, int fourcc, uint64_t modifier)
+{
+    for (int i = 0; i < set->count; i++) {
+        if (set->formats[i].fourcc == fourcc && set->formats[i].modifier == modifier) {
+            return true;
+        }
+    }
+    return false;
+}
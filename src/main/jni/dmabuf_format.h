@@ -0,0 +1,69 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DMABUF_FORMAT_H
+#define DMABUF_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dmabuf_protocol.h"
+
+// DRM fourcc codes and modifiers used on the wire. Same values as
+// drm_fourcc.h, which is not part of every NDK sysroot.
+#define DMABUF_FOURCC(a, b, c, d) \
+    ((int)((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24)))
+
+#define DMABUF_FORMAT_ABGR8888 DMABUF_FOURCC('A', 'B', '2', '4') // GL_RGBA byte order
+#define DMABUF_FORMAT_XBGR8888 DMABUF_FOURCC('X', 'B', '2', '4')
+#define DMABUF_FORMAT_ARGB8888 DMABUF_FOURCC('A', 'R', '2', '4') // BGRA byte order
+#define DMABUF_FORMAT_NV12     DMABUF_FOURCC('N', 'V', '1', '2') // Y plane + interleaved CbCr 2x2
+#define DMABUF_FORMAT_YUV420   DMABUF_FOURCC('Y', 'U', '1', '2') // Y, Cb, Cr planes 2x2
+
+#define DMABUF_MOD_LINEAR  0ULL
+#define DMABUF_MOD_INVALID 0x00ffffffffffffffULL
+
+#define DMABUF_MAX_FORMAT_MODIFIERS 64
+
+// Formats with the modifiers one side supports for them
+struct dmabuf_format_set_t
+{
+    int count;
+    struct dmabuf_format_modifier_t formats[DMABUF_MAX_FORMAT_MODIFIERS];
+};
+
+int dmabuf_format_num_planes(int fourcc);
+
+// Bytes of one frame, all planes, at the tightest packing.
+size_t dmabuf_format_frame_size(int fourcc, uint32_t width, uint32_t height);
+
+// Fills metadata for a linear buffer of the given format where every plane
+// lives in one allocation, rows aligned to stride_align bytes. Returns the
+// allocation size, or 0 for an unknown format.
+size_t dmabuf_format_layout(int fourcc, uint32_t width, uint32_t height,
+                            uint32_t stride_align,
+                            struct texture_storage_metadata_t *metadata);
+
+// Bytes per row of plane for the given image width.
+uint32_t dmabuf_format_plane_width_bytes(int fourcc, int plane, uint32_t width);
+uint32_t dmabuf_format_plane_height(int fourcc, int plane, uint32_t height);
+
+void dmabuf_format_set_clear(struct dmabuf_format_set_t *set);
+// False when the set is full. Duplicates are kept once.
+bool dmabuf_format_set_add(struct dmabuf_format_set_t *set, int fourcc, uint64_t modifier);
+bool dmabuf_format_set_contains(const struct dmabuf_format_set_t *set, int fourcc, uint64_t modifier);
+
+#endif // DMABUF_FORMAT_H
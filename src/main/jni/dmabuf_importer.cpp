@@ -0,0 +1,319 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "dmabuf_format.h"
+#include "dmabuf_importer.h"
+
+#define LOG_TAG "EglSample"
+
+// EGL_EXT_image_dma_buf_import attribute names, indexed by plane
+static const EGLint plane_fd_attr[DMABUF_MAX_PLANES] = {
+    EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT,
+    EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE3_FD_EXT
+};
+static const EGLint plane_offset_attr[DMABUF_MAX_PLANES] = {
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+    EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT
+};
+static const EGLint plane_pitch_attr[DMABUF_MAX_PLANES] = {
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+    EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT
+};
+static const EGLint plane_modifier_lo_attr[DMABUF_MAX_PLANES] = {
+    EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+    EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT
+};
+static const EGLint plane_modifier_hi_attr[DMABUF_MAX_PLANES] = {
+    EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+    EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT
+};
+
+DmabufImporter::DmabufImporter()
+    : _display(EGL_NO_DISPLAY), _has_modifiers(false),
+      _eglCreateImageKHR(0), _eglDestroyImageKHR(0), _glEGLImageTargetTexture2DOES(0),
+      _use_counter(0)
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+DmabufImporter::~DmabufImporter()
+{
+    clear();
+}
+
+bool DmabufImporter::init(EGLDisplay display)
+{
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_EXT_image_dma_buf_import")) {
+        LOG_ERROR("EGL_EXT_image_dma_buf_import not supported");
+        return false;
+    }
+
+    _display = display;
+    _has_modifiers = strstr(extensions, "EGL_EXT_image_dma_buf_import_modifiers") != NULL;
+    _eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    _eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    _glEGLImageTargetTexture2DOES =
+            (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+    return _eglCreateImageKHR && _eglDestroyImageKHR && _glEGLImageTargetTexture2DOES;
+}
+
+bool DmabufImporter::queryFormats(struct dmabuf_format_set_t *formats)
+{
+    EGLint fourccs[DMABUF_MAX_FORMAT_MODIFIERS];
+    EGLuint64KHR modifiers[DMABUF_MAX_FORMAT_MODIFIERS];
+    EGLBoolean external_only[DMABUF_MAX_FORMAT_MODIFIERS];
+    EGLint num_formats = 0;
+
+    dmabuf_format_set_clear(formats);
+    if (!_has_modifiers) {
+        return false;
+    }
+    PFNEGLQUERYDMABUFFORMATSEXTPROC eglQueryDmaBufFormatsEXT =
+            (PFNEGLQUERYDMABUFFORMATSEXTPROC)eglGetProcAddress("eglQueryDmaBufFormatsEXT");
+    PFNEGLQUERYDMABUFMODIFIERSEXTPROC eglQueryDmaBufModifiersEXT =
+            (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+    if (!eglQueryDmaBufFormatsEXT || !eglQueryDmaBufModifiersEXT ||
+        !eglQueryDmaBufFormatsEXT(_display, DMABUF_MAX_FORMAT_MODIFIERS, fourccs, &num_formats)) {
+        return false;
+    }
+
+    // Only formats the producer side knows are worth the room
+    for (int i = 0; i < num_formats; i++) {
+        int num_planes = dmabuf_format_num_planes(fourccs[i]);
+        EGLint num_modifiers = 0;
+        if (num_planes == 0 ||
+            !eglQueryDmaBufModifiersEXT(_display, fourccs[i], DMABUF_MAX_FORMAT_MODIFIERS,
+                                        modifiers, external_only, &num_modifiers)) {
+            continue;
+        }
+        for (int j = 0; j < num_modifiers; j++) {
+            if (num_planes == 1 && external_only[j]) {
+                continue;
+            }
+            dmabuf_format_set_add(formats, fourccs[i], modifiers[j]);
+        }
+        // a driver listing no modifiers still imports linear buffers
+        if (num_modifiers == 0) {
+            dmabuf_format_set_add(formats, fourccs[i], DMABUF_MOD_LINEAR);
+        }
+    }
+    return formats->count > 0;
+}
+
+GLuint DmabufImporter::import(uint32_t buffer_id, const int *fds, int num_fds,
+                              uint32_t width, uint32_t height,
+                              const struct texture_storage_metadata_t &metadata)
+{
+    struct stat st;
+
+    if (num_fds < 1 || fstat(fds[0], &st) < 0) {
+        LOG_ERROR("importer: cannot stat buffer %u", buffer_id);
+        return 0;
+    }
+
+    // Same dma-buf seen before, possibly under another id
+    struct cache_entry_t *entry = find_by_inode(st.st_dev, st.st_ino);
+    if (entry) {
+        struct cache_entry_t *stale = find_by_id(buffer_id);
+        if (stale && stale != entry) {
+            destroy_entry(stale);
+        }
+        entry->buffer_id = buffer_id;
+        entry->last_used = ++_use_counter;
+        _stats.hits++;
+        return entry->texture;
+    }
+
+    // The id now refers to a different dma-buf
+    entry = find_by_id(buffer_id);
+    if (entry) {
+        destroy_entry(entry);
+    }
+
+    _stats.misses++;
+    EGLImageKHR image = create_image(fds, num_fds, width, height, metadata);
+    if (image == EGL_NO_IMAGE_KHR) {
+        return 0;
+    }
+
+    int num_planes = dmabuf_format_num_planes(metadata.fourcc);
+    GLenum target = num_planes > 1 ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    _glEGLImageTargetTexture2DOES(target, (GLeglImageOES)image);
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOG_ERROR("importer: glEGLImageTargetTexture2DOES error %08X", err);
+        glDeleteTextures(1, &texture);
+        _eglDestroyImageKHR(_display, image);
+        return 0;
+    }
+
+    entry = free_slot();
+    entry->valid = true;
+    entry->buffer_id = buffer_id;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->image = image;
+    entry->texture = texture;
+    entry->target = target;
+    entry->last_used = ++_use_counter;
+    _stats.imports++;
+    return texture;
+}
+
+GLuint DmabufImporter::lookup(uint32_t buffer_id)
+{
+    struct cache_entry_t *entry = find_by_id(buffer_id);
+    if (!entry) {
+        _stats.misses++;
+        return 0;
+    }
+    entry->last_used = ++_use_counter;
+    _stats.hits++;
+    return entry->texture;
+}
+
+GLenum DmabufImporter::target(uint32_t buffer_id) const
+{
+    for (int i = 0; i < IMPORTER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid && _entries[i].buffer_id == buffer_id) {
+            return _entries[i].target;
+        }
+    }
+    return GL_TEXTURE_2D;
+}
+
+void DmabufImporter::evict(uint32_t buffer_id)
+{
+    struct cache_entry_t *entry = find_by_id(buffer_id);
+    if (entry) {
+        destroy_entry(entry);
+    }
+}
+
+void DmabufImporter::clear()
+{
+    for (int i = 0; i < IMPORTER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid) {
+            destroy_entry(&_entries[i]);
+        }
+    }
+}
+
+struct DmabufImporter::cache_entry_t *DmabufImporter::find_by_id(uint32_t buffer_id)
+{
+    for (int i = 0; i < IMPORTER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid && _entries[i].buffer_id == buffer_id) {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+struct DmabufImporter::cache_entry_t *DmabufImporter::find_by_inode(dev_t dev, ino_t ino)
+{
+    for (int i = 0; i < IMPORTER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid && _entries[i].dev == dev && _entries[i].ino == ino) {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+struct DmabufImporter::cache_entry_t *DmabufImporter::free_slot()
+{
+    struct cache_entry_t *oldest = &_entries[0];
+
+    for (int i = 0; i < IMPORTER_MAX_BUFFERS; i++) {
+        if (!_entries[i].valid) {
+            return &_entries[i];
+        }
+        if (_entries[i].last_used < oldest->last_used) {
+            oldest = &_entries[i];
+        }
+    }
+
+    // Cache full, drop the least recently used import
+    destroy_entry(oldest);
+    return oldest;
+}
+
+void DmabufImporter::destroy_entry(struct cache_entry_t *entry)
+{
+    glDeleteTextures(1, &entry->texture);
+    _eglDestroyImageKHR(_display, entry->image);
+    memset(entry, 0, sizeof(*entry));
+    _stats.evictions++;
+}
+
+EGLImageKHR DmabufImporter::create_image(const int *fds, int num_fds, uint32_t width, uint32_t height,
+                                         const struct texture_storage_metadata_t &metadata)
+{
+    EGLint attribs[6 + DMABUF_MAX_PLANES * 10 + 1];
+    int n = 0;
+
+    if (metadata.num_planes < 1 || metadata.num_planes > DMABUF_MAX_PLANES) {
+        LOG_ERROR("importer: invalid plane count %d", metadata.num_planes);
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = width;
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = height;
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = metadata.fourcc;
+
+    for (int i = 0; i < metadata.num_planes; i++) {
+        const struct texture_plane_metadata_t *plane = &metadata.planes[i];
+        if (plane->fd_index < 0 || plane->fd_index >= num_fds) {
+            LOG_ERROR("importer: plane %d refers to missing fd %d", i, plane->fd_index);
+            return EGL_NO_IMAGE_KHR;
+        }
+        attribs[n++] = plane_fd_attr[i];
+        attribs[n++] = fds[plane->fd_index];
+        attribs[n++] = plane_offset_attr[i];
+        attribs[n++] = plane->offset;
+        attribs[n++] = plane_pitch_attr[i];
+        attribs[n++] = plane->stride;
+        if (_has_modifiers && plane->modifier != DMABUF_MOD_INVALID) {
+            attribs[n++] = plane_modifier_lo_attr[i];
+            attribs[n++] = (EGLint)(plane->modifier & 0xffffffff);
+            attribs[n++] = plane_modifier_hi_attr[i];
+            attribs[n++] = (EGLint)(plane->modifier >> 32);
+        }
+    }
+    attribs[n++] = EGL_NONE;
+
+    EGLImageKHR image = _eglCreateImageKHR(_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+                                           (EGLClientBuffer)NULL, attribs);
+    if (image == EGL_NO_IMAGE_KHR) {
+        LOG_ERROR("importer: eglCreateImageKHR() returned error %x", eglGetError());
+    }
+    return image;
+}
@@ -0,0 +1,114 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DMABUF_IMPORTER_H
+#define DMABUF_IMPORTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "dmabuf_format.h"
+#include "dmabuf_protocol.h"
+
+// Producers keep every buffer id on the wire registered, across frame
+// sizes, until they unregister it
+#define IMPORTER_MAX_BUFFERS DMABUF_MAX_BUFFERS
+
+struct importer_stats_t
+{
+    uint64_t hits;      // lookups served from the cache
+    uint64_t misses;    // lookups of buffers not imported
+    uint64_t imports;   // EGLImages created
+    uint64_t evictions; // EGLImages destroyed
+};
+
+// Turns received dma-buf fds back into GL textures.
+//
+// Imports use EGL_EXT_image_dma_buf_import (with explicit modifiers when
+// EGL_EXT_image_dma_buf_import_modifiers is present). Every import is
+// cached by buffer id and by the dma-buf inode, so a ring registered once
+// is imported once and each frame only costs a lookup. A buffer that is
+// registered again, e.g. after the producer reconnects, is recognised by
+// its inode and not imported a second time.
+//
+// Must be used on the thread that has the consumer GL context current.
+class DmabufImporter {
+
+public:
+    DmabufImporter();
+    virtual ~DmabufImporter();
+
+    bool init(EGLDisplay display);
+
+    // Imports the buffer, or reuses a cached import of the same dma-buf.
+    // fds are borrowed; EGL keeps its own references. Returns the texture
+    // name, 0 on failure. The texture target is GL_TEXTURE_EXTERNAL_OES
+    // for YUV formats and GL_TEXTURE_2D otherwise, see target().
+    GLuint import(uint32_t buffer_id, const int *fds, int num_fds,
+                  uint32_t width, uint32_t height,
+                  const struct texture_storage_metadata_t &metadata);
+
+    // Texture of a buffer imported earlier, 0 if unknown. Counted as a
+    // cache hit or miss.
+    GLuint lookup(uint32_t buffer_id);
+    GLenum target(uint32_t buffer_id) const;
+
+    // Formats and modifiers import() can turn into a texture, from
+    // EGL_EXT_image_dma_buf_import_modifiers. RGB modifiers only usable as
+    // external images are left out. False without the extension.
+    bool queryFormats(struct dmabuf_format_set_t *formats);
+
+    void evict(uint32_t buffer_id);
+    void clear();
+
+    const struct importer_stats_t &stats() const { return _stats; }
+
+private:
+    struct cache_entry_t
+    {
+        bool valid;
+        uint32_t buffer_id;
+        dev_t dev;
+        ino_t ino;
+        EGLImageKHR image;
+        GLuint texture;
+        GLenum target;
+        uint64_t last_used;
+    };
+
+    struct cache_entry_t *find_by_id(uint32_t buffer_id);
+    struct cache_entry_t *find_by_inode(dev_t dev, ino_t ino);
+    struct cache_entry_t *free_slot();
+    void destroy_entry(struct cache_entry_t *entry);
+    EGLImageKHR create_image(const int *fds, int num_fds, uint32_t width, uint32_t height,
+                             const struct texture_storage_metadata_t &metadata);
+
+    EGLDisplay _display;
+    bool _has_modifiers;
+    PFNEGLCREATEIMAGEKHRPROC _eglCreateImageKHR;
+    PFNEGLDESTROYIMAGEKHRPROC _eglDestroyImageKHR;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC _glEGLImageTargetTexture2DOES;
+
+    struct cache_entry_t _entries[IMPORTER_MAX_BUFFERS];
+    uint64_t _use_counter;
+    struct importer_stats_t _stats;
+};
+
+#endif // DMABUF_IMPORTER_H
@@ -0,0 +1,280 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/dma-buf.h>
+#include <linux/magic.h>
+
+#include "logger.h"
+#include "dmabuf_format.h"
+#include "dmabuf_mapper.h"
+
+#define LOG_TAG "EglSample"
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC 0x444d4142
+#endif
+
+DmabufMapper::DmabufMapper()
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+DmabufMapper::~DmabufMapper()
+{
+    clear();
+}
+
+bool DmabufMapper::map(uint32_t buffer_id, const int *fds, int num_fds,
+                       uint32_t width, uint32_t height,
+                       const struct texture_storage_metadata_t &metadata)
+{
+    struct stat st;
+
+    if (num_fds < 1 || num_fds > DMABUF_MAX_PLANES ||
+        metadata.num_planes < 1 || metadata.num_planes > DMABUF_MAX_PLANES) {
+        LOG_ERROR("mapper: buffer %u has %d fds and %d planes", buffer_id, num_fds, metadata.num_planes);
+        return false;
+    }
+    if (fstat(fds[0], &st) < 0) {
+        LOG_ERROR("mapper: cannot stat buffer %u %s", buffer_id, strerror(errno));
+        return false;
+    }
+
+    struct cache_entry_t *entry = find(buffer_id);
+    if (entry) {
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino) {
+            _stats.hits++;
+            return true;
+        }
+        release_entry(entry);
+    }
+
+    for (int i = 0; i < MAPPER_MAX_BUFFERS && !entry; i++) {
+        if (!_entries[i].valid) {
+            entry = &_entries[i];
+        }
+    }
+    if (!entry) {
+        LOG_ERROR("mapper: too many buffers mapped");
+        return false;
+    }
+
+    entry->valid = true;
+    entry->buffer_id = buffer_id;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->access = 0;
+
+    for (int i = 0; i < num_fds; i++) {
+        struct mapped_fd_t *mapped = &entry->fds[i];
+        struct statfs sfs;
+
+        mapped->fd = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+        mapped->addr = MAP_FAILED;
+        entry->num_fds = i + 1;
+        if (mapped->fd < 0) {
+            LOG_ERROR("mapper: dup failed %s", strerror(errno));
+            release_entry(entry);
+            return false;
+        }
+
+        // dma-bufs report their size through lseek, not fstat
+        off_t size = lseek(mapped->fd, 0, SEEK_END);
+        if (size <= 0 && fstat(mapped->fd, &st) == 0) {
+            size = st.st_size;
+        }
+        if (size <= 0) {
+            LOG_ERROR("mapper: cannot size fd of buffer %u", buffer_id);
+            release_entry(entry);
+            return false;
+        }
+        mapped->size = size;
+
+        mapped->writable = true;
+        mapped->addr = mmap(NULL, mapped->size, PROT_READ | PROT_WRITE, MAP_SHARED, mapped->fd, 0);
+        if (mapped->addr == MAP_FAILED && errno == EACCES) {
+            mapped->writable = false;
+            mapped->addr = mmap(NULL, mapped->size, PROT_READ, MAP_SHARED, mapped->fd, 0);
+        }
+        if (mapped->addr == MAP_FAILED) {
+            LOG_ERROR("mapper: mmap failed %s", strerror(errno));
+            release_entry(entry);
+            return false;
+        }
+        _stats.maps++;
+
+        mapped->dmabuf = fstatfs(mapped->fd, &sfs) == 0 && sfs.f_type == DMA_BUF_MAGIC;
+    }
+
+    struct dmabuf_mapping_t *mapping = &entry->mapping;
+    mapping->fourcc = metadata.fourcc;
+    mapping->width = width;
+    mapping->height = height;
+    mapping->num_planes = metadata.num_planes;
+
+    for (int i = 0; i < metadata.num_planes; i++) {
+        const struct texture_plane_metadata_t *plane = &metadata.planes[i];
+        if (plane->fd_index < 0 || plane->fd_index >= num_fds) {
+            LOG_ERROR("mapper: plane %d refers to missing fd %d", i, plane->fd_index);
+            release_entry(entry);
+            return false;
+        }
+
+        const struct mapped_fd_t *mapped = &entry->fds[plane->fd_index];
+        uint32_t rows = dmabuf_format_plane_height(metadata.fourcc, i, height);
+        if (plane->offset < 0 || plane->stride <= 0 ||
+            (uint64_t)plane->offset + (uint64_t)plane->stride * rows > mapped->size) {
+            LOG_ERROR("mapper: plane %d of buffer %u exceeds its fd", i, buffer_id);
+            release_entry(entry);
+            return false;
+        }
+        mapping->planes[i] = (uint8_t *)mapped->addr + plane->offset;
+        mapping->strides[i] = plane->stride;
+    }
+    return true;
+}
+
+void DmabufMapper::unmap(uint32_t buffer_id)
+{
+    struct cache_entry_t *entry = find(buffer_id);
+    if (entry) {
+        release_entry(entry);
+    }
+}
+
+void DmabufMapper::clear()
+{
+    for (int i = 0; i < MAPPER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid) {
+            release_entry(&_entries[i]);
+        }
+    }
+}
+
+const struct dmabuf_mapping_t *DmabufMapper::begin(uint32_t buffer_id, enum dmabuf_access_t access)
+{
+    struct cache_entry_t *entry = find(buffer_id);
+
+    if (!entry) {
+        LOG_ERROR("mapper: buffer %u is not mapped", buffer_id);
+        return NULL;
+    }
+    if (entry->access) {
+        LOG_ERROR("mapper: buffer %u access already begun", buffer_id);
+        return NULL;
+    }
+    if (access & DMABUF_ACCESS_WRITE) {
+        for (int i = 0; i < entry->num_fds; i++) {
+            if (!entry->fds[i].writable) {
+                LOG_ERROR("mapper: buffer %u is read-only", buffer_id);
+                return NULL;
+            }
+        }
+    }
+
+    if (!sync(entry, DMA_BUF_SYNC_START | access)) {
+        return NULL;
+    }
+    entry->access = access;
+    return &entry->mapping;
+}
+
+bool DmabufMapper::end(uint32_t buffer_id)
+{
+    struct cache_entry_t *entry = find(buffer_id);
+
+    if (!entry || !entry->access) {
+        LOG_ERROR("mapper: end without begin on buffer %u", buffer_id);
+        return false;
+    }
+
+    bool ok = sync(entry, DMA_BUF_SYNC_END | entry->access);
+    entry->access = 0;
+    return ok;
+}
+
+struct DmabufMapper::cache_entry_t *DmabufMapper::find(uint32_t buffer_id)
+{
+    for (int i = 0; i < MAPPER_MAX_BUFFERS; i++) {
+        if (_entries[i].valid && _entries[i].buffer_id == buffer_id) {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+bool DmabufMapper::sync(struct cache_entry_t *entry, uint64_t flags)
+{
+    struct dma_buf_sync sync_args;
+
+    sync_args.flags = flags;
+    for (int i = 0; i < entry->num_fds; i++) {
+        if (!entry->fds[i].dmabuf) {
+            continue;
+        }
+        int ret;
+        do {
+            ret = ioctl(entry->fds[i].fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+        } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+        if (ret < 0) {
+            LOG_ERROR("mapper: DMA_BUF_IOCTL_SYNC failed %s", strerror(errno));
+            return false;
+        }
+        _stats.syncs++;
+    }
+    return true;
+}
+
+void DmabufMapper::release_entry(struct cache_entry_t *entry)
+{
+    if (entry->access) {
+        sync(entry, DMA_BUF_SYNC_END | entry->access);
+    }
+    for (int i = 0; i < entry->num_fds; i++) {
+        struct mapped_fd_t *mapped = &entry->fds[i];
+        if (mapped->addr != MAP_FAILED && mapped->addr) {
+            munmap(mapped->addr, mapped->size);
+            _stats.unmaps++;
+        }
+        if (mapped->fd >= 0) {
+            close(mapped->fd);
+        }
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+void DmabufMapper::supportedFormats(struct dmabuf_format_set_t *formats)
+{
+    static const int fourccs[] = {
+        DMABUF_FORMAT_ABGR8888, DMABUF_FORMAT_XBGR8888, DMABUF_FORMAT_ARGB8888,
+        DMABUF_FORMAT_NV12, DMABUF_FORMAT_YUV420
+    };
+
+    dmabuf_format_set_clear(formats);
+    for (size_t i = 0; i < sizeof(fourccs) / sizeof(fourccs[0]); i++) {
+        dmabuf_format_set_add(formats, fourccs[i], DMABUF_MOD_LINEAR);
+    }
+}
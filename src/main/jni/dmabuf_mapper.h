@@ -0,0 +1,119 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DMABUF_MAPPER_H
+#define DMABUF_MAPPER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dmabuf_format.h"
+#include "dmabuf_protocol.h"
+
+// Producers keep every buffer id on the wire registered, across frame
+// sizes, until they unregister it
+#define MAPPER_MAX_BUFFERS DMABUF_MAX_BUFFERS
+
+enum dmabuf_access_t {
+    DMABUF_ACCESS_READ = 1,
+    DMABUF_ACCESS_WRITE = 2,
+    DMABUF_ACCESS_READ_WRITE = 3
+};
+
+// CPU view of one buffer, valid between begin() and end().
+struct dmabuf_mapping_t
+{
+    int fourcc;
+    uint32_t width;
+    uint32_t height;
+    int num_planes;
+    uint8_t *planes[DMABUF_MAX_PLANES]; // first byte of each plane
+    uint32_t strides[DMABUF_MAX_PLANES];
+};
+
+struct mapper_stats_t
+{
+    uint64_t hits;     // map() of a buffer already mapped
+    uint64_t maps;     // mmap() calls
+    uint64_t unmaps;   // munmap() calls
+    uint64_t syncs;    // DMA_BUF_IOCTL_SYNC calls made
+};
+
+// CPU access to shared buffers for consumers that have no EGL.
+//
+// Each fd of a registered buffer is mmapped once and the mapping is kept
+// until the buffer is unregistered, so per frame only the cache syncs are
+// paid. Accesses are bracketed by DMA_BUF_IOCTL_SYNC start/end as the
+// kernel requires for coherency with devices. Plain memfd or udmabuf fds
+// work too; the sync ioctl is skipped for fds that are not dma-bufs.
+class DmabufMapper {
+
+public:
+    DmabufMapper();
+    virtual ~DmabufMapper();
+
+    // Maps the buffer's fds, or keeps the existing mapping when the same
+    // dma-buf is registered again. fds are borrowed; the mappings stay
+    // valid after the caller closes them. Read-only fds are mapped
+    // read-only and refuse begin() with DMABUF_ACCESS_WRITE.
+    bool map(uint32_t buffer_id, const int *fds, int num_fds,
+             uint32_t width, uint32_t height,
+             const struct texture_storage_metadata_t &metadata);
+    void unmap(uint32_t buffer_id);
+    void clear();
+
+    // Starts CPU access and returns the plane pointers, NULL on failure.
+    // Every successful begin() must be paired with end().
+    const struct dmabuf_mapping_t *begin(uint32_t buffer_id, enum dmabuf_access_t access);
+    bool end(uint32_t buffer_id);
+
+    const struct mapper_stats_t &stats() const { return _stats; }
+
+    // Formats the mapper can read, all linear only
+    static void supportedFormats(struct dmabuf_format_set_t *formats);
+
+private:
+    struct mapped_fd_t
+    {
+        int fd;     // private dup, needed for the sync ioctl
+        void *addr;
+        size_t size;
+        bool writable;
+        bool dmabuf; // supports DMA_BUF_IOCTL_SYNC
+    };
+
+    struct cache_entry_t
+    {
+        bool valid;
+        uint32_t buffer_id;
+        dev_t dev;  // identity of the first fd
+        ino_t ino;
+        struct mapped_fd_t fds[DMABUF_MAX_PLANES];
+        int num_fds;
+        struct dmabuf_mapping_t mapping;
+        int access; // of the begin() in progress, 0 when idle
+    };
+
+    struct cache_entry_t *find(uint32_t buffer_id);
+    bool sync(struct cache_entry_t *entry, uint64_t flags);
+    void release_entry(struct cache_entry_t *entry);
+
+    struct cache_entry_t _entries[MAPPER_MAX_BUFFERS];
+    struct mapper_stats_t _stats;
+};
+
+#endif // DMABUF_MAPPER_H
@@ -0,0 +1,228 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef DMABUF_PROTOCOL_H
+#define DMABUF_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Wire protocol spoken between the producer (Renderer) and a consumer over
+// a long-lived SOCK_STREAM Unix domain socket.
+//
+// Every message starts with a dmabuf_message_header_t. Buffers are
+// registered once, with their dma-buf fds attached as SCM_RIGHTS ancillary
+// data. Several registrations may be sent in one sendmsg; their fds then
+// arrive together in message order, num_fds per registration. After that
+// each new frame costs a single small FRAME_READY message that only
+// references the buffer by id. The consumer hands the buffer back with
+// BUFFER_RELEASE once it no longer reads from it; until then the producer
+// does not write into that buffer again.
+//
+// Buffer ids stay valid until UNREGISTER_BUFFER. A producer changing frame
+// size registers buffers of the new size under ids of their own and may
+// later send FRAME_READY for buffers of an earlier size again without
+// registering them again, so consumers keep every import until the buffer
+// is unregistered.
+//
+// Times on the wire are CLOCK_MONOTONIC nanoseconds, which producer and
+// consumers share on the same machine; 0 stands for not known.
+//
+// Every header carries the protocol version. A peer speaking another
+// version is disconnected on its first message rather than misread.
+
+#define DMABUF_PROTOCOL_MAGIC   0x4244 // "DB"
+#define DMABUF_PROTOCOL_VERSION 2
+
+enum dmabuf_message_type_t {
+    DMABUF_MSG_REGISTER_BUFFER = 1,
+    DMABUF_MSG_UNREGISTER_BUFFER,
+    DMABUF_MSG_FRAME_READY,
+
+    // consumer -> producer
+    DMABUF_MSG_BUFFER_RELEASE,
+    DMABUF_MSG_SUPPORTED_FORMATS,
+    DMABUF_MSG_FRAME_ACK
+};
+
+struct dmabuf_message_header_t
+{
+    uint16_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint16_t size; // size of the whole message, header included
+};
+
+#define DMABUF_MAX_PLANES 4
+
+// buffer ids are below this value
+#define DMABUF_MAX_BUFFERS 32
+
+// Layout of one plane. Planes may live in their own dma-buf or share one;
+// fd_index selects which of the fds registered with the buffer holds it.
+struct texture_plane_metadata_t
+{
+    int32_t fd_index;
+    int32_t stride;
+    int32_t offset;
+    uint64_t modifier;
+};
+
+// Custom image storage data description to transfer over socket
+struct texture_storage_metadata_t
+{
+    int fourcc;
+    uint64_t modifiers;
+    int32_t num_planes;
+    struct texture_plane_metadata_t planes[DMABUF_MAX_PLANES];
+};
+
+// Synchronization primitive attached to a FRAME_READY message. The fence fd
+// travels as SCM_RIGHTS with the message and becomes readable (POLLIN) once
+// the producer finished writing the frame.
+enum dmabuf_fence_type_t {
+    DMABUF_FENCE_NONE = 0,
+    DMABUF_FENCE_NATIVE,  // sync_file from EGL_ANDROID_native_fence_sync
+    DMABUF_FENCE_EVENTFD  // eventfd signalled by the producer (CPU fallback)
+};
+
+struct dmabuf_register_buffer_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t buffer_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_fds;
+    struct texture_storage_metadata_t metadata;
+};
+
+struct dmabuf_unregister_buffer_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t buffer_id;
+};
+
+// Rectangle in buffer pixels, origin at the top left corner
+struct dmabuf_rect_t
+{
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+#define DMABUF_MAX_DAMAGE_RECTS 8
+
+// When the producer got a frame ready
+struct dmabuf_frame_timing_t
+{
+    uint64_t content_ns;  // content complete, GPU work submitted
+    uint64_t gpu_done_ns; // GPU finished writing; 0 if it had not when sent
+    uint64_t send_ns;     // FRAME_READY sent
+};
+
+// damage lists the parts of the buffer that differ from the previous frame
+// this consumer received; num_damage 0 means the whole buffer. Only
+// num_damage rects are sent, so header.size varies between
+// DMABUF_FRAME_READY_MIN_SIZE and sizeof(struct dmabuf_frame_ready_msg_t).
+struct dmabuf_frame_ready_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t buffer_id;
+    uint32_t fence_type; // dmabuf_fence_type_t
+    uint64_t frame_id;
+    struct dmabuf_frame_timing_t timing;
+    uint32_t num_damage;
+    struct dmabuf_rect_t damage[DMABUF_MAX_DAMAGE_RECTS];
+};
+
+#define DMABUF_FRAME_READY_MIN_SIZE offsetof(struct dmabuf_frame_ready_msg_t, damage)
+
+struct dmabuf_buffer_release_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t buffer_id;
+    uint64_t frame_id;
+};
+
+// When a consumer got to a frame
+struct dmabuf_consumer_timing_t
+{
+    uint64_t receive_ns; // FRAME_READY read from the socket
+    uint64_t ready_ns;   // fence signalled, the buffer fully written
+    uint64_t import_ns;  // buffer ready to read, e.g. bound to a texture
+    uint64_t display_ns; // frame shown; 0 if it was skipped
+};
+
+// Optional, sent once per frame the consumer is done with, before or with
+// its BUFFER_RELEASE. The producer turns these into latency histograms.
+struct dmabuf_frame_ack_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t buffer_id;
+    uint32_t reserved;
+    uint64_t frame_id;
+    struct dmabuf_consumer_timing_t timing;
+};
+
+// A fourcc together with a modifier its buffers may be imported with
+struct dmabuf_format_modifier_t
+{
+    int32_t fourcc;
+    uint32_t reserved;
+    uint64_t modifier;
+};
+
+#define DMABUF_FORMATS_PER_MESSAGE 14
+
+// What the consumer can import, sent after subscribing. A list longer than
+// DMABUF_FORMATS_PER_MESSAGE spans several messages; the one with last set
+// completes it and replaces any list sent before. The producer exports
+// layouts every consumer lists, linear only when they share nothing
+// better. A consumer that sends no list takes whatever is exported. Only
+// count entries are sent, like the damage of FRAME_READY.
+struct dmabuf_supported_formats_msg_t
+{
+    struct dmabuf_message_header_t header;
+    uint32_t count;
+    uint32_t last;
+    struct dmabuf_format_modifier_t formats[DMABUF_FORMATS_PER_MESSAGE];
+};
+
+#define DMABUF_SUPPORTED_FORMATS_MIN_SIZE offsetof(struct dmabuf_supported_formats_msg_t, formats)
+
+// Largest message either side may send
+#define DMABUF_MAX_MESSAGE_SIZE 256
+
+static inline void dmabuf_init_header(struct dmabuf_message_header_t *header,
+                                      enum dmabuf_message_type_t type, size_t size)
+{
+    header->magic = DMABUF_PROTOCOL_MAGIC;
+    header->version = DMABUF_PROTOCOL_VERSION;
+    header->type = (uint16_t)type;
+    header->size = (uint16_t)size;
+}
+
+// Now, in the clock of the timestamps on the wire
+static inline uint64_t dmabuf_timestamp_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif // DMABUF_PROTOCOL_H
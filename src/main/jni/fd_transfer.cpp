@@ -0,0 +1,187 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "logger.h"
+#include "fd_transfer.h"
+
+#define LOG_TAG "EglSample"
+
+#define FD_TRANSFER_MAX_IOV 16
+
+// Control buffer large enough for FD_TRANSFER_MAX_FDS, suitably aligned
+union fd_control_t {
+    char buf[CMSG_SPACE(sizeof(int) * FD_TRANSFER_MAX_FDS)];
+    struct cmsghdr align;
+};
+
+static void fill_rights(struct msghdr *msg, union fd_control_t *control,
+                        const int *fds, int num_fds)
+{
+    if (num_fds <= 0) {
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
+        return;
+    }
+
+    memset(control, 0, sizeof(*control));
+    msg->msg_control = control->buf;
+    msg->msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+}
+
+ssize_t send_fds_once(int sock, const struct iovec *iov, int iovcnt,
+                      const int *fds, int num_fds, int flags)
+{
+    struct msghdr msg;
+    union fd_control_t control;
+
+    if (num_fds > FD_TRANSFER_MAX_FDS) {
+        LOG_ERROR("send_fds: too many fds (%d)", num_fds);
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    fill_rights(&msg, &control, fds, num_fds);
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent;
+}
+
+bool send_fds_iov(int sock, const struct iovec *iov, int iovcnt,
+                  const int *fds, int num_fds)
+{
+    struct iovec pending[FD_TRANSFER_MAX_IOV];
+
+    if (num_fds > FD_TRANSFER_MAX_FDS || iovcnt > FD_TRANSFER_MAX_IOV) {
+        LOG_ERROR("send_fds: too many fds (%d) or buffers (%d)", num_fds, iovcnt);
+        errno = EINVAL;
+        return false;
+    }
+    memcpy(pending, iov, sizeof(struct iovec) * iovcnt);
+
+    struct iovec *cur = pending;
+    int remaining = iovcnt;
+    bool attach_fds = num_fds > 0;
+
+    while (remaining > 0) {
+        ssize_t sent = send_fds_once(sock, cur, remaining, fds, attach_fds ? num_fds : 0, 0);
+        if (sent < 0) {
+            LOG_ERROR("sendmsg failed %s", strerror(errno));
+            return false;
+        }
+        attach_fds = false;
+
+        // skip over what went out, the rest follows without the fds
+        while (remaining > 0 && (size_t)sent >= cur->iov_len) {
+            sent -= cur->iov_len;
+            cur++;
+            remaining--;
+        }
+        if (remaining > 0) {
+            cur->iov_base = (char *)cur->iov_base + sent;
+            cur->iov_len -= sent;
+        }
+    }
+
+    return true;
+}
+
+bool send_fds(int sock, const void *data, size_t data_len,
+              const int *fds, int num_fds)
+{
+    struct iovec io;
+    io.iov_base = (void *)data;
+    io.iov_len = data_len;
+    return send_fds_iov(sock, &io, 1, fds, num_fds);
+}
+
+ssize_t recv_fds(int sock, void *data, size_t data_len,
+                 int *fds, int max_fds, int *num_fds, int flags)
+{
+    struct msghdr msg;
+    struct iovec io;
+    union fd_control_t control;
+
+    *num_fds = 0;
+    if (max_fds > FD_TRANSFER_MAX_FDS) {
+        max_fds = FD_TRANSFER_MAX_FDS;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    io.iov_base = data;
+    io.iov_len = data_len;
+    msg.msg_iov = &io;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * max_fds);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+        return -1;
+    }
+
+    int count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len < CMSG_LEN(0)) {
+            continue;
+        }
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char *payload = CMSG_DATA(cmsg);
+        for (int i = 0; i < n; i++) {
+            int fd;
+            memcpy(&fd, payload + i * sizeof(int), sizeof(int));
+            if (count < max_fds) {
+                fds[count++] = fd;
+            } else {
+                close(fd);
+                msg.msg_flags |= MSG_CTRUNC;
+            }
+        }
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC) {
+        LOG_ERROR("recv_fds: control data truncated, dropping %d fds", count);
+        for (int i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    *num_fds = count;
+    return received;
+}
@@ -0,0 +1,50 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef FD_TRANSFER_H
+#define FD_TRANSFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Most fds passed in a single message. The kernel limit (SCM_MAX_FD) is
+// 253; this is enough for a full ring of multi-plane buffers.
+#define FD_TRANSFER_MAX_FDS 32
+
+// Single sendmsg of iovcnt buffers plus num_fds fds (SCM_RIGHTS). Returns
+// the number of bytes sent, which may be short, or -1. Meant for
+// non-blocking sockets that handle EAGAIN and partial writes themselves.
+ssize_t send_fds_once(int sock, const struct iovec *iov, int iovcnt,
+                      const int *fds, int num_fds, int flags);
+
+// Sends iovcnt buffers and num_fds fds (SCM_RIGHTS) with one sendmsg. On a
+// stream socket a short write is completed without the fds, which travel
+// with the first byte. Returns false on error. Never raises SIGPIPE.
+bool send_fds_iov(int sock, const struct iovec *iov, int iovcnt,
+                  const int *fds, int num_fds);
+
+bool send_fds(int sock, const void *data, size_t data_len,
+              const int *fds, int num_fds);
+
+// Receives up to data_len bytes and up to max_fds fds. Received fds are
+// close-on-exec. If the control data was truncated (MSG_CTRUNC) every fd
+// that did arrive is closed and -1 is returned with errno set to EMSGSIZE.
+// Returns the number of bytes received, 0 on orderly shutdown, -1 on error.
+ssize_t recv_fds(int sock, void *data, size_t data_len,
+                 int *fds, int max_fds, int *num_fds, int flags);
+
+#endif // FD_TRANSFER_H
@@ -0,0 +1,447 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logger.h"
+#include "frame_broadcaster.h"
+
+#define LOG_TAG "EglSample"
+
+FrameBroadcaster::FrameBroadcaster(int max_in_flight)
+    : _listen_sock(-1), _max_in_flight(max_in_flight), _dropped_by_gone(0), _formats_changed(false),
+      _latency(NULL), _dialed(-1), _next_dial_ns(0), _dial_backoff_ms(BROADCAST_DIAL_MIN_MS), _dial_logged(false),
+      _buffer_count(0)
+{
+    _dial_path[0] = '\0';
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        _consumers[i] = NULL;
+    }
+    memset(_refs, 0, sizeof(_refs));
+}
+
+FrameBroadcaster::~FrameBroadcaster()
+{
+    close();
+    clearBuffers();
+}
+
+bool FrameBroadcaster::listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (_listen_sock >= 0) {
+        return true;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        LOG_ERROR("create socket failed %s", strerror(errno));
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        ::listen(sock, BROADCAST_MAX_CONSUMERS) < 0) {
+        LOG_ERROR("listen on %s failed %s", path, strerror(errno));
+        ::close(sock);
+        return false;
+    }
+
+    LOG_INFO("accepting consumers on %s", path);
+    _listen_sock = sock;
+    return true;
+}
+
+bool FrameBroadcaster::connect(const char *path)
+{
+    ProducerSession *session = new ProducerSession(_max_in_flight);
+
+    if (!session->connect(path)) {
+        delete session;
+        return false;
+    }
+    return add_consumer(session) >= 0;
+}
+
+void FrameBroadcaster::dial(const char *path)
+{
+    if (strlen(path) >= sizeof(_dial_path)) {
+        LOG_ERROR("cannot dial %s, path too long", path);
+        return;
+    }
+    strcpy(_dial_path, path);
+    _dial_backoff_ms = BROADCAST_DIAL_MIN_MS;
+    _dial_logged = false;
+    if (dial_pending()) {
+        try_dial();
+    }
+}
+
+void FrameBroadcaster::close()
+{
+    _dial_path[0] = '\0';
+    _dialed = -1;
+    if (_listen_sock >= 0) {
+        ::close(_listen_sock);
+        _listen_sock = -1;
+    }
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i]) {
+            _dropped_by_gone += _consumers[i]->framesDropped();
+            delete _consumers[i];
+            _consumers[i] = NULL;
+        }
+    }
+    memset(_refs, 0, sizeof(_refs));
+}
+
+bool FrameBroadcaster::setBuffers(const struct dmabuf_buffer_registration_t *buffers, int count)
+{
+    clearBuffers();
+    memset(_refs, 0, sizeof(_refs));
+    return addBuffers(buffers, count);
+}
+
+bool FrameBroadcaster::addBuffers(const struct dmabuf_buffer_registration_t *buffers, int count)
+{
+    int first = _buffer_count;
+
+    if (_buffer_count + count > DMABUF_MAX_BUFFERS) {
+        LOG_ERROR("broadcaster cannot share %d buffers", _buffer_count + count);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (buffers[i].buffer_id >= DMABUF_MAX_BUFFERS) {
+            LOG_ERROR("broadcaster buffer id %u out of range", buffers[i].buffer_id);
+            return false;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        _buffers[_buffer_count] = buffers[i];
+        for (int j = 0; j < buffers[i].num_fds; j++) {
+            _buffers[_buffer_count].fds[j] = fcntl(buffers[i].fds[j], F_DUPFD_CLOEXEC, 0);
+        }
+        _buffer_count++;
+    }
+
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i] && _consumers[i]->isConnected()) {
+            register_buffers(_consumers[i], _buffers + first, count);
+        }
+    }
+    return true;
+}
+
+void FrameBroadcaster::removeBuffer(uint32_t buffer_id)
+{
+    for (int i = 0; i < _buffer_count; i++) {
+        if (_buffers[i].buffer_id != buffer_id) {
+            continue;
+        }
+        for (int j = 0; j < _buffers[i].num_fds; j++) {
+            if (_buffers[i].fds[j] >= 0) {
+                ::close(_buffers[i].fds[j]);
+            }
+        }
+        _buffers[i] = _buffers[--_buffer_count];
+        for (int j = 0; j < BROADCAST_MAX_CONSUMERS; j++) {
+            if (_consumers[j] && _consumers[j]->isConnected()) {
+                _consumers[j]->unregisterBuffer(buffer_id);
+            }
+        }
+        return;
+    }
+}
+
+void FrameBroadcaster::clearBuffers()
+{
+    for (int i = 0; i < _buffer_count; i++) {
+        for (int j = 0; j < _buffers[i].num_fds; j++) {
+            if (_buffers[i].fds[j] >= 0) {
+                ::close(_buffers[i].fds[j]);
+            }
+        }
+    }
+    _buffer_count = 0;
+}
+
+void FrameBroadcaster::poll()
+{
+    if (_listen_sock >= 0) {
+        for (;;) {
+            int sock = accept4(_listen_sock, NULL, NULL, SOCK_CLOEXEC);
+            if (sock < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG_ERROR("accept failed %s", strerror(errno));
+                }
+                break;
+            }
+            ProducerSession *session = new ProducerSession(_max_in_flight);
+            if (session->adopt(sock)) {
+                add_consumer(session);
+            } else {
+                delete session;
+            }
+        }
+    }
+    if (dial_pending() && dmabuf_timestamp_ns() >= _next_dial_ns) {
+        try_dial();
+    }
+
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i]) {
+            _consumers[i]->flush();
+        }
+    }
+}
+
+int FrameBroadcaster::dialTimeoutMs() const
+{
+    if (!dial_pending()) {
+        return -1;
+    }
+    uint64_t now = dmabuf_timestamp_ns();
+    if (now >= _next_dial_ns) {
+        return 0;
+    }
+    // rounded up, so that the attempt is due once woken
+    return (int)((_next_dial_ns - now + 999999) / 1000000);
+}
+
+int FrameBroadcaster::pollFds(struct pollfd *fds, int max_fds) const
+{
+    int count = 0;
+
+    if (_listen_sock >= 0 && count < max_fds) {
+        fds[count].fd = _listen_sock;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        count++;
+    }
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS && count < max_fds; i++) {
+        if (_consumers[i] && _consumers[i]->isConnected()) {
+            fds[count].fd = _consumers[i]->fd();
+            fds[count].events = POLLIN | (_consumers[i]->hasPendingWrite() ? POLLOUT : 0);
+            fds[count].revents = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+int FrameBroadcaster::broadcastFrame(uint32_t buffer_id, uint64_t frame_id, int fence_fd,
+                                     enum dmabuf_fence_type_t fence_type,
+                                     const struct damage_region_t *damage,
+                                     const struct dmabuf_frame_timing_t *timing)
+{
+    int holders = 0;
+
+    if (buffer_id >= DMABUF_MAX_BUFFERS) {
+        return 0;
+    }
+
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i] && _consumers[i]->frameReady(buffer_id, frame_id, fence_fd, fence_type, damage, timing)) {
+            holders++;
+        }
+    }
+    _refs[buffer_id] += holders;
+    if (_latency && timing && holders > 0) {
+        _latency->frameSent(frame_id, *timing);
+    }
+    return holders;
+}
+
+int FrameBroadcaster::receiveReleases(uint32_t *ids, int max_ids)
+{
+    uint32_t released[DMABUF_MAX_BUFFERS];
+    int count = 0;
+
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (!_consumers[i]) {
+            continue;
+        }
+        int n = _consumers[i]->receiveReleases(released, DMABUF_MAX_BUFFERS);
+        if (n < 0) {
+            drop_consumer(i, ids, &count, max_ids);
+            continue;
+        }
+        if (_consumers[i]->takeFormatsChanged()) {
+            _formats_changed = true;
+        }
+        for (int j = 0; j < n; j++) {
+            unref(released[j], ids, &count, max_ids);
+        }
+    }
+    return count;
+}
+
+void FrameBroadcaster::setLatency(FrameLatency *latency)
+{
+    _latency = latency;
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i]) {
+            _consumers[i]->setLatency(latency);
+        }
+    }
+}
+
+int FrameBroadcaster::consumerCount() const
+{
+    int count = 0;
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i] && _consumers[i]->isConnected()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool FrameBroadcaster::supportsFormat(int fourcc, uint64_t modifier) const
+{
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i] && _consumers[i]->isConnected() &&
+            !_consumers[i]->supportsFormat(fourcc, modifier)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameBroadcaster::takeFormatsChanged()
+{
+    bool changed = _formats_changed;
+    _formats_changed = false;
+    return changed;
+}
+
+uint64_t FrameBroadcaster::framesDropped() const
+{
+    uint64_t dropped = _dropped_by_gone;
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i]) {
+            dropped += _consumers[i]->framesDropped();
+        }
+    }
+    return dropped;
+}
+
+int FrameBroadcaster::add_consumer(ProducerSession *session)
+{
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        if (_consumers[i]) {
+            continue;
+        }
+        if (_buffer_count > 0 && !register_buffers(session, _buffers, _buffer_count)) {
+            delete session;
+            return -1;
+        }
+        session->setLatency(_latency);
+        _consumers[i] = session;
+        LOG_INFO("consumer %d subscribed", i);
+        return i;
+    }
+
+    LOG_ERROR("too many consumers, rejecting subscription");
+    delete session;
+    return -1;
+}
+
+bool FrameBroadcaster::register_buffers(ProducerSession *session,
+                                        const struct dmabuf_buffer_registration_t *buffers, int count)
+{
+    // as many per sendmsg as a session takes
+    for (int i = 0; i < count; i += PRODUCER_SESSION_MAX_BATCH) {
+        int batch = count - i < PRODUCER_SESSION_MAX_BATCH ? count - i : PRODUCER_SESSION_MAX_BATCH;
+        if (!session->registerBuffers(buffers + i, batch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrameBroadcaster::drop_consumer(int index, uint32_t *ids, int *count, int max_ids)
+{
+    ProducerSession *session = _consumers[index];
+    uint32_t held = session->heldBuffers();
+
+    LOG_INFO("consumer %d went away", index);
+    if (session->hasFormats()) {
+        _formats_changed = true;
+    }
+    for (uint32_t id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+        if (held & (1u << id)) {
+            unref(id, ids, count, max_ids);
+        }
+    }
+    _dropped_by_gone += session->framesDropped();
+    delete session;
+    _consumers[index] = NULL;
+    if (index == _dialed) {
+        // a consumer that restarts is back soon
+        _dialed = -1;
+        _next_dial_ns = 0;
+        _dial_backoff_ms = BROADCAST_DIAL_MIN_MS;
+        _dial_logged = false;
+    }
+}
+
+void FrameBroadcaster::try_dial()
+{
+    ProducerSession *session = new ProducerSession(_max_in_flight);
+
+    if (session->connect(_dial_path)) {
+        _dial_backoff_ms = BROADCAST_DIAL_MIN_MS;
+        _dial_logged = false;
+        _dialed = add_consumer(session);
+        if (_dialed < 0) {
+            _next_dial_ns = dmabuf_timestamp_ns() + (uint64_t)BROADCAST_DIAL_MAX_MS * 1000000;
+        }
+        return;
+    }
+    if (!_dial_logged) {
+        LOG_INFO("consumer %s not available (%s), retrying", _dial_path, strerror(errno));
+        _dial_logged = true;
+    }
+    delete session;
+    _next_dial_ns = dmabuf_timestamp_ns() + (uint64_t)_dial_backoff_ms * 1000000;
+    _dial_backoff_ms *= 2;
+    if (_dial_backoff_ms > BROADCAST_DIAL_MAX_MS) {
+        _dial_backoff_ms = BROADCAST_DIAL_MAX_MS;
+    }
+}
+
+void FrameBroadcaster::unref(uint32_t buffer_id, uint32_t *ids, int *count, int max_ids)
+{
+    if (buffer_id >= DMABUF_MAX_BUFFERS || _refs[buffer_id] <= 0) {
+        return;
+    }
+    if (--_refs[buffer_id] == 0 && *count < max_ids) {
+        ids[(*count)++] = buffer_id;
+    }
+}
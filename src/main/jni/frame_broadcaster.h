@@ -0,0 +1,143 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef FRAME_BROADCASTER_H
+#define FRAME_BROADCASTER_H
+
+#include <stdint.h>
+#include <poll.h>
+
+#include "dmabuf_protocol.h"
+#include "producer_session.h"
+
+#define BROADCAST_MAX_CONSUMERS 8
+
+// Wait between attempts to dial a consumer, doubling after each failure
+#define BROADCAST_DIAL_MIN_MS 100
+#define BROADCAST_DIAL_MAX_MS 5000
+
+// Fans one producer's buffers out to several consumers.
+//
+// Consumers either subscribe by connecting to the socket given to listen(),
+// or are dialed with connect(). Each consumer gets the buffer registrations
+// once when it joins and a FRAME_READY per frame. Every consumer has its own
+// in-flight limit and non-blocking socket, so a slow consumer only misses
+// its own frames. A buffer is handed back to the producer once every
+// consumer that received it has released it.
+class FrameBroadcaster {
+
+public:
+    // max_in_flight is the number of frames each consumer may hold.
+    FrameBroadcaster(int max_in_flight = 1);
+    virtual ~FrameBroadcaster();
+
+    bool listen(const char *path);
+    bool connect(const char *path);
+    // Like connect(), but keeps trying from poll() whenever the consumer at
+    // path is not connected, e.g. before it has started or after it went
+    // away, backing off between attempts. Subscribers connected meanwhile
+    // make no difference.
+    void dial(const char *path);
+    void close();
+
+    // Keeps duplicates of the buffer fds so consumers joining later can be
+    // registered too, and registers them with everyone connected now.
+    bool setBuffers(const struct dmabuf_buffer_registration_t *buffers, int count);
+    void clearBuffers();
+    // Like setBuffers() but keeps the buffers shared before; only the new
+    // ones are registered. Consumers keep their imports of the others.
+    bool addBuffers(const struct dmabuf_buffer_registration_t *buffers, int count);
+    // Unregisters a buffer no consumer holds anymore.
+    void removeBuffer(uint32_t buffer_id);
+
+    // Accepts new subscribers, dials when it is time and flushes pending
+    // writes. Never blocks.
+    void poll();
+    // Milliseconds until poll() has a dial attempt to make, -1 for none.
+    int dialTimeoutMs() const;
+
+    // Sends the frame to every consumer that can take it. Returns the
+    // number of consumers now holding buffer_id; with 0 the buffer is
+    // immediately free again. damage is what changed since the previous
+    // frame, NULL for everything. timing goes out with the frame and, for
+    // a frame someone took, into the FrameLatency given to setLatency().
+    int broadcastFrame(uint32_t buffer_id, uint64_t frame_id, int fence_fd,
+                       enum dmabuf_fence_type_t fence_type,
+                       const struct damage_region_t *damage = NULL,
+                       const struct dmabuf_frame_timing_t *timing = NULL);
+
+    // Ids of buffers no consumer holds anymore, including those held by
+    // consumers that went away. ids should have room for DMABUF_MAX_BUFFERS
+    // entries; each buffer is reported at most once per call.
+    int receiveReleases(uint32_t *ids, int max_ids);
+    // Where frames sent and the consumers' FRAME_ACKs are recorded, NULL
+    // for nowhere. Must outlive the broadcaster.
+    void setLatency(FrameLatency *latency);
+
+    int consumerCount() const;
+    // By slot, index below BROADCAST_MAX_CONSUMERS: whether a consumer is
+    // connected there and the bitmask of buffer ids it holds.
+    bool isConnected(int index) const { return _consumers[index] && _consumers[index]->isConnected(); }
+    uint32_t heldBuffers(int index) const { return isConnected(index) ? _consumers[index]->heldBuffers() : 0; }
+
+    // Whether every consumer can import fourcc with modifier, see
+    // ProducerSession::supportsFormat().
+    bool supportsFormat(int fourcc, uint64_t modifier) const;
+    // True once after a consumer sent a new format list or one that had
+    // sent one went away, i.e. when what all of them share may differ.
+    bool takeFormatsChanged();
+    int listenFd() const { return _listen_sock; }
+
+    // Fds to wait on before calling poll() and receiveReleases() again:
+    // the listening socket, each consumer for releases and, while a write
+    // is pending, for room to finish it. fds should have room for
+    // BROADCAST_MAX_CONSUMERS + 1 entries. Returns their count.
+    int pollFds(struct pollfd *fds, int max_fds) const;
+    uint64_t framesDropped() const;
+
+private:
+    // Slot the session went into, -1 if it was rejected and deleted
+    int add_consumer(ProducerSession *session);
+    bool dial_pending() const { return _dial_path[0] && _dialed < 0; }
+    static bool register_buffers(ProducerSession *session,
+                                 const struct dmabuf_buffer_registration_t *buffers, int count);
+    void drop_consumer(int index, uint32_t *ids, int *count, int max_ids);
+    void unref(uint32_t buffer_id, uint32_t *ids, int *count, int max_ids);
+    void try_dial();
+
+    int _listen_sock;
+    int _max_in_flight;
+    ProducerSession *_consumers[BROADCAST_MAX_CONSUMERS];
+    uint64_t _dropped_by_gone; // drops counted by consumers already closed
+    bool _formats_changed;
+    FrameLatency *_latency;
+
+    // consumer to dial while it is not connected, "" for none, and its
+    // slot while it is
+    char _dial_path[108];
+    int _dialed;
+    uint64_t _next_dial_ns;
+    int _dial_backoff_ms;
+    bool _dial_logged;
+
+    struct dmabuf_buffer_registration_t _buffers[DMABUF_MAX_BUFFERS];
+    int _buffer_count;
+
+    // how many consumers hold each buffer
+    int _refs[DMABUF_MAX_BUFFERS];
+};
+
+#endif // FRAME_BROADCASTER_H
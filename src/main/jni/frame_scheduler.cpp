@@ -0,0 +1,228 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "logger.h"
+#include "frame_scheduler.h"
+
+#define LOG_TAG "EglSample"
+
+#define NS_PER_SECOND 1000000000ULL
+
+uint64_t scheduler_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static void ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / NS_PER_SECOND;
+    ts->tv_nsec = ns % NS_PER_SECOND;
+}
+
+FrameScheduler::FrameScheduler()
+    : _epoll_fd(-1), _wake_fd(-1), _timer_fd(-1), _frame_rate(0), _watched_count(0),
+      _wakeups(0), _frames_due(0), _frames_missed(0)
+{
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    reset();
+}
+
+bool FrameScheduler::init()
+{
+    struct epoll_event ev;
+
+    reset();
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (_epoll_fd < 0 || _wake_fd < 0 || _timer_fd < 0) {
+        LOG_ERROR("scheduler: cannot create fds %s", strerror(errno));
+        reset();
+        return false;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _wake_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev) < 0) {
+        LOG_ERROR("scheduler: cannot watch eventfd %s", strerror(errno));
+        reset();
+        return false;
+    }
+    ev.data.fd = _timer_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &ev) < 0) {
+        LOG_ERROR("scheduler: cannot watch timerfd %s", strerror(errno));
+        reset();
+        return false;
+    }
+    return true;
+}
+
+void FrameScheduler::reset()
+{
+    if (_epoll_fd >= 0) {
+        close(_epoll_fd);
+        _epoll_fd = -1;
+    }
+    if (_wake_fd >= 0) {
+        close(_wake_fd);
+        _wake_fd = -1;
+    }
+    if (_timer_fd >= 0) {
+        close(_timer_fd);
+        _timer_fd = -1;
+    }
+    _watched_count = 0;
+    _frame_rate = 0;
+}
+
+bool FrameScheduler::setFrameRate(double fps)
+{
+    struct itimerspec spec;
+
+    if (_timer_fd < 0 || fps < 0) {
+        return false;
+    }
+    memset(&spec, 0, sizeof(spec));
+    if (fps > 0) {
+        uint64_t period = (uint64_t)(NS_PER_SECOND / fps);
+        if (period == 0) {
+            period = 1;
+        }
+        // the first deadline one period from now, the rest follow it
+        ns_to_timespec(scheduler_now_ns() + period, &spec.it_value);
+        ns_to_timespec(period, &spec.it_interval);
+    }
+    if (timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        LOG_ERROR("scheduler: cannot arm timer %s", strerror(errno));
+        return false;
+    }
+    _frame_rate = fps;
+    return true;
+}
+
+void FrameScheduler::wake()
+{
+    uint64_t one = 1;
+
+    if (_wake_fd >= 0 && write(_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("scheduler: cannot wake %s", strerror(errno));
+    }
+}
+
+void FrameScheduler::watch(const struct pollfd *fds, int count)
+{
+    struct epoll_event ev;
+
+    if (_epoll_fd < 0) {
+        return;
+    }
+    if (count > SCHEDULER_MAX_WATCHED) {
+        count = SCHEDULER_MAX_WATCHED;
+    }
+
+    // Forget fds that went away; a closed fd may already be gone from the
+    // set, so errors are expected here.
+    for (int i = 0; i < _watched_count; i++) {
+        bool kept = false;
+        for (int j = 0; j < count && !kept; j++) {
+            kept = fds[j].fd == _watched[i].fd;
+        }
+        if (!kept) {
+            epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _watched[i].fd, NULL);
+        }
+    }
+
+    // A consumer that went away may have had its fd number reused by a new
+    // one, which the kernel dropped from the set on close. Modifying first
+    // and adding when the fd is unknown covers both cases.
+    for (int j = 0; j < count; j++) {
+        memset(&ev, 0, sizeof(ev));
+        // poll and epoll share the event bits
+        ev.events = fds[j].events;
+        ev.data.fd = fds[j].fd;
+        if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fds[j].fd, &ev) < 0 &&
+            (errno != ENOENT || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fds[j].fd, &ev) < 0)) {
+            LOG_ERROR("scheduler: cannot watch fd %d %s", fds[j].fd, strerror(errno));
+        }
+    }
+
+    memcpy(_watched, fds, count * sizeof(struct pollfd));
+    _watched_count = count;
+}
+
+bool FrameScheduler::wait(int timeout_ms, struct scheduler_events_t *events)
+{
+    struct epoll_event ready[SCHEDULER_MAX_WATCHED + 2];
+
+    memset(events, 0, sizeof(*events));
+    if (_epoll_fd < 0) {
+        return false;
+    }
+
+    int count = epoll_wait(_epoll_fd, ready, SCHEDULER_MAX_WATCHED + 2, timeout_ms);
+    if (count < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        LOG_ERROR("scheduler: epoll_wait failed %s", strerror(errno));
+        return false;
+    }
+    _wakeups.fetch_add(1, std::memory_order_relaxed);
+
+    for (int i = 0; i < count; i++) {
+        uint64_t value;
+        if (ready[i].data.fd == _wake_fd) {
+            if (read(_wake_fd, &value, sizeof(value)) == sizeof(value)) {
+                events->woken = true;
+            }
+        } else if (ready[i].data.fd == _timer_fd) {
+            // number of periods since the last read
+            if (read(_timer_fd, &value, sizeof(value)) == sizeof(value)) {
+                events->frames_due = value;
+                _frames_due.fetch_add(value, std::memory_order_relaxed);
+                _frames_missed.fetch_add(value - 1, std::memory_order_relaxed);
+            }
+        } else {
+            events->io_ready = true;
+        }
+    }
+    return true;
+}
+
+struct scheduler_stats_t FrameScheduler::stats() const
+{
+    struct scheduler_stats_t stats;
+
+    stats.wakeups = _wakeups.load(std::memory_order_relaxed);
+    stats.frames_due = _frames_due.load(std::memory_order_relaxed);
+    stats.frames_missed = _frames_missed.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,93 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <atomic>
+
+#define SCHEDULER_MAX_WATCHED 16
+
+// What woke the render thread up.
+struct scheduler_events_t
+{
+    bool woken;          // wake() was called
+    uint64_t frames_due; // frame periods that elapsed, 0 if none
+    bool io_ready;       // a watched fd is ready
+};
+
+struct scheduler_stats_t
+{
+    uint64_t wakeups;       // returns from wait()
+    uint64_t frames_due;    // frame periods that elapsed
+    uint64_t frames_missed; // periods that elapsed while the thread was busy
+};
+
+// Puts the render thread to sleep until there is something to do.
+//
+// One epoll set holds an eventfd other threads signal with wake(), a
+// CLOCK_MONOTONIC timerfd that paces frames at the target rate, and the
+// fds of whatever else the loop waits on, such as consumer sockets. The
+// timer runs on absolute nanosecond deadlines, so pacing does not drift
+// with the time spent rendering. Nothing spins: with no frame rate set and
+// no events the thread sleeps indefinitely.
+class FrameScheduler {
+
+public:
+    FrameScheduler();
+    virtual ~FrameScheduler();
+
+    bool init();
+    void reset();
+
+    // Frames per second; 0 stops pacing. May be called from any thread.
+    bool setFrameRate(double fps);
+    double frameRate() const { return _frame_rate; }
+
+    // Wakes wait() up. May be called from any thread.
+    void wake();
+
+    // Replaces the set of watched fds. Cheap enough to call every frame.
+    void watch(const struct pollfd *fds, int count);
+
+    // Sleeps until an event or until timeout_ms passes (-1 waits forever).
+    // Returns false if waiting failed.
+    bool wait(int timeout_ms, struct scheduler_events_t *events);
+
+    // Counters so far. May be read from any thread; each is read on its
+    // own, so they may be a frame apart.
+    struct scheduler_stats_t stats() const;
+
+private:
+    int _epoll_fd;
+    int _wake_fd;
+    int _timer_fd;
+    double _frame_rate;
+
+    struct pollfd _watched[SCHEDULER_MAX_WATCHED];
+    int _watched_count;
+
+    std::atomic<uint64_t> _wakeups;
+    std::atomic<uint64_t> _frames_due;
+    std::atomic<uint64_t> _frames_missed;
+};
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t scheduler_now_ns();
+
+#endif // FRAME_SCHEDULER_H
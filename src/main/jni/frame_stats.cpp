@@ -0,0 +1,238 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_scheduler.h"
+#include "frame_stats.h"
+
+static const char *stage_names[FRAME_STAGE_COUNT] = {
+    "generate", "upload", "draw", "swap", "export", "send", "gpu_upload", "gpu_draw", "interval"
+};
+
+static const char *latency_names[FRAME_LATENCY_COUNT] = {
+    "latency_send", "latency_gpu", "latency_delivery", "latency_import", "latency_display", "latency_total"
+};
+
+const char *frame_stage_name(enum frame_stage_t stage)
+{
+    return stage < FRAME_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+const char *frame_latency_name(enum frame_latency_t latency)
+{
+    return latency < FRAME_LATENCY_COUNT ? latency_names[latency] : "unknown";
+}
+
+// One line per histogram with samples, see FrameStats::format()
+static size_t format_histograms(const LatencyHistogram *histograms, int count,
+                                const char *(*name)(int), char *buffer, size_t size)
+{
+    size_t length = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    buffer[0] = '\0';
+    for (int i = 0; i < count && length < size; i++) {
+        struct histogram_summary_t s;
+        histograms[i].summary(&s);
+        if (s.count == 0) {
+            continue;
+        }
+        int written = snprintf(buffer + length, size - length,
+                               "%s %llu %.1f %.1f %.1f %.1f %.1f\n",
+                               name(i), (unsigned long long)s.count,
+                               s.mean_ns / 1e3, s.p50_ns / 1e3, s.p95_ns / 1e3, s.p99_ns / 1e3,
+                               s.max_ns / 1e3);
+        if (written < 0) {
+            break;
+        }
+        length += (size_t)written;
+    }
+    return length < size ? length : size - 1;
+}
+
+static const char *stage_name_of(int stage)
+{
+    return frame_stage_name((enum frame_stage_t)stage);
+}
+
+static const char *latency_name_of(int latency)
+{
+    return frame_latency_name((enum frame_latency_t)latency);
+}
+
+static inline int bucket_of(uint64_t ns)
+{
+    const uint64_t largest = (1ULL << (HISTOGRAM_BUCKETS / HISTOGRAM_SUB_BUCKETS + 2)) - 1;
+
+    if (ns < HISTOGRAM_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    if (ns > largest) {
+        ns = largest;
+    }
+    // the three bits below the top one pick the sub-bucket
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - 3;
+    return (msb - 2) * HISTOGRAM_SUB_BUCKETS + (int)((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Middle of the range a bucket covers
+static inline uint64_t bucket_value(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    _buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::summary(struct histogram_summary_t *summary) const
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+
+    memset(summary, 0, sizeof(*summary));
+    // count from the buckets themselves so the percentiles add up
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    summary->count = total;
+    summary->mean_ns = _sum.load(std::memory_order_relaxed) / total;
+    summary->max_ns = _max.load(std::memory_order_relaxed);
+
+    const uint64_t ranks[3] = { (total * 50 + 99) / 100, (total * 95 + 99) / 100, (total * 99 + 99) / 100 };
+    uint64_t *outputs[3] = { &summary->p50_ns, &summary->p95_ns, &summary->p99_ns };
+    uint64_t seen = 0;
+    int next = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS && next < 3; i++) {
+        seen += counts[i];
+        while (next < 3 && seen >= ranks[next]) {
+            uint64_t value = bucket_value(i);
+            *outputs[next++] = value < summary->max_ns ? value : summary->max_ns;
+        }
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        _buckets[i].store(0, std::memory_order_relaxed);
+    }
+    _sum.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+void FrameStats::reset()
+{
+    for (int i = 0; i < FRAME_STAGE_COUNT; i++) {
+        _stages[i].reset();
+    }
+}
+
+size_t FrameStats::format(char *buffer, size_t size) const
+{
+    return format_histograms(_stages, FRAME_STAGE_COUNT, stage_name_of, buffer, size);
+}
+
+FrameLatency::FrameLatency()
+{
+    reset();
+}
+
+void FrameLatency::frameSent(uint64_t frame_id, const struct dmabuf_frame_timing_t &timing)
+{
+    struct sent_frame_t &sent = _sent[frame_id % FRAME_LATENCY_HISTORY];
+
+    sent.frame_id = frame_id;
+    sent.timing = timing;
+    record(FRAME_LATENCY_SEND, timing.content_ns, timing.send_ns);
+    record(FRAME_LATENCY_GPU, timing.content_ns, timing.gpu_done_ns);
+}
+
+void FrameLatency::frameAcked(uint64_t frame_id, const struct dmabuf_consumer_timing_t &timing)
+{
+    const struct sent_frame_t &sent = _sent[frame_id % FRAME_LATENCY_HISTORY];
+
+    if (sent.frame_id != frame_id || sent.timing.send_ns == 0) {
+        _unmatched.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // The GPU was still busy when the frame went out; the consumer saw
+    // when it was done
+    if (sent.timing.gpu_done_ns == 0) {
+        record(FRAME_LATENCY_GPU, sent.timing.content_ns, timing.ready_ns);
+    }
+    record(FRAME_LATENCY_DELIVERY, sent.timing.send_ns, timing.receive_ns);
+    record(FRAME_LATENCY_IMPORT, timing.receive_ns, timing.import_ns);
+    record(FRAME_LATENCY_DISPLAY, timing.import_ns, timing.display_ns);
+    record(FRAME_LATENCY_TOTAL, sent.timing.content_ns, timing.display_ns);
+}
+
+void FrameLatency::reset()
+{
+    memset(_sent, 0, sizeof(_sent));
+    for (int i = 0; i < FRAME_LATENCY_COUNT; i++) {
+        _latencies[i].reset();
+    }
+    _unmatched.store(0, std::memory_order_relaxed);
+}
+
+size_t FrameLatency::format(char *buffer, size_t size) const
+{
+    return format_histograms(_latencies, FRAME_LATENCY_COUNT, latency_name_of, buffer, size);
+}
+
+void FrameLatency::record(enum frame_latency_t latency, uint64_t from_ns, uint64_t to_ns)
+{
+    if (from_ns != 0 && to_ns >= from_ns) {
+        _latencies[latency].record(to_ns - from_ns);
+    }
+}
+
+StageTimer::StageTimer(FrameStats *stats, enum frame_stage_t stage)
+    : _stats(stats), _stage(stage), _start(scheduler_now_ns())
+{
+}
+
+StageTimer::~StageTimer()
+{
+    _stats->record(_stage, scheduler_now_ns() - _start);
+}
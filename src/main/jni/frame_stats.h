@@ -0,0 +1,166 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "dmabuf_protocol.h"
+
+// Stages of a frame that are timed separately.
+enum frame_stage_t {
+    FRAME_STAGE_GENERATE = 0, // CPU content of the next frame
+    FRAME_STAGE_UPLOAD,       // issuing the texture upload
+    FRAME_STAGE_DRAW,         // issuing the draw calls
+    FRAME_STAGE_SWAP,         // eglSwapBuffers
+    FRAME_STAGE_EXPORT,       // dma-buf export and fence creation
+    FRAME_STAGE_SEND,         // FRAME_READY to the consumers
+    FRAME_STAGE_GPU_UPLOAD,   // GPU time of the upload
+    FRAME_STAGE_GPU_DRAW,     // GPU time of the draw
+    FRAME_STAGE_INTERVAL,     // between consecutive frames
+    FRAME_STAGE_COUNT
+};
+
+const char *frame_stage_name(enum frame_stage_t stage);
+
+// Each power of two is split into this many buckets, so values are
+// resolved to within 1/8 of their magnitude.
+#define HISTOGRAM_SUB_BUCKETS 8
+// Enough for durations up to 2^42 ns, over an hour
+#define HISTOGRAM_BUCKETS (43 * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram_summary_t
+{
+    uint64_t count;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p95_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+};
+
+// Log-linear histogram of durations.
+//
+// record() is a couple of relaxed atomic adds, so it can be called from
+// any thread without locking, and summaries can be read concurrently with
+// recording. A summary taken while recording goes on may be off by the
+// samples in flight, which does not matter for percentiles.
+class LatencyHistogram {
+
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    void summary(struct histogram_summary_t *summary) const;
+    void reset();
+
+private:
+    std::atomic<uint64_t> _buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+// One histogram per frame stage.
+class FrameStats {
+
+public:
+    void record(enum frame_stage_t stage, uint64_t ns) { _stages[stage].record(ns); }
+    void summary(enum frame_stage_t stage, struct histogram_summary_t *summary) const
+    {
+        _stages[stage].summary(summary);
+    }
+    void reset();
+
+    // Writes one line per stage that has samples:
+    //     stage count mean p50 p95 p99 max
+    // with times in microseconds. Returns the length written, truncated to
+    // fit size.
+    size_t format(char *buffer, size_t size) const;
+
+private:
+    LatencyHistogram _stages[FRAME_STAGE_COUNT];
+};
+
+// Parts of the way from a frame's content to the consumer's display.
+enum frame_latency_t {
+    FRAME_LATENCY_SEND = 0, // content ready to FRAME_READY sent
+    FRAME_LATENCY_GPU,      // content ready to GPU done
+    FRAME_LATENCY_DELIVERY, // sent to received by the consumer
+    FRAME_LATENCY_IMPORT,   // received to imported, fence wait included
+    FRAME_LATENCY_DISPLAY,  // imported to displayed
+    FRAME_LATENCY_TOTAL,    // content ready to displayed
+    FRAME_LATENCY_COUNT
+};
+
+const char *frame_latency_name(enum frame_latency_t latency);
+
+// Frames sent more recently than this many frames ago can still be
+// matched with their acks
+#define FRAME_LATENCY_HISTORY 64
+
+// End-to-end frame latency, from the producer's timestamps of each frame
+// sent and the consumers' FRAME_ACKs. Each consumer acking a frame adds a
+// sample. Acks for frames too old to be remembered are counted and
+// dropped. frameSent() and frameAcked() must be called from one thread.
+class FrameLatency {
+
+public:
+    FrameLatency();
+
+    void frameSent(uint64_t frame_id, const struct dmabuf_frame_timing_t &timing);
+    void frameAcked(uint64_t frame_id, const struct dmabuf_consumer_timing_t &timing);
+
+    void summary(enum frame_latency_t latency, struct histogram_summary_t *summary) const
+    {
+        _latencies[latency].summary(summary);
+    }
+    uint64_t unmatched() const { return _unmatched.load(std::memory_order_relaxed); }
+    void reset();
+
+    // Like FrameStats::format(), one line per part with samples.
+    size_t format(char *buffer, size_t size) const;
+
+private:
+    // times ordered wrong, e.g. 0 for not known, give no sample
+    void record(enum frame_latency_t latency, uint64_t from_ns, uint64_t to_ns);
+
+    struct sent_frame_t
+    {
+        uint64_t frame_id;
+        struct dmabuf_frame_timing_t timing;
+    };
+    struct sent_frame_t _sent[FRAME_LATENCY_HISTORY];
+    LatencyHistogram _latencies[FRAME_LATENCY_COUNT];
+    std::atomic<uint64_t> _unmatched;
+};
+
+// Measures the CPU time of a scope into a stage.
+class StageTimer {
+
+public:
+    StageTimer(FrameStats *stats, enum frame_stage_t stage);
+    ~StageTimer();
+
+private:
+    FrameStats *_stats;
+    enum frame_stage_t _stage;
+    uint64_t _start;
+};
+
+#endif // FRAME_STATS_H
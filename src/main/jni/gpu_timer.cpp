@@ -0,0 +1,137 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+#include <EGL/egl.h>
+
+#include "logger.h"
+#include "gpu_timer.h"
+
+#define LOG_TAG "EglSample"
+
+GpuTimer::GpuTimer()
+    : _available(false), _stats(NULL),
+      _glGenQueriesEXT(0), _glDeleteQueriesEXT(0), _glBeginQueryEXT(0), _glEndQueryEXT(0),
+      _glGetQueryObjectuivEXT(0), _glGetQueryObjectui64vEXT(0),
+      _first(0), _count(0), _active(false), _warming_up(false)
+{
+    memset(_queries, 0, sizeof(_queries));
+}
+
+GpuTimer::~GpuTimer()
+{
+}
+
+bool GpuTimer::init(FrameStats *stats)
+{
+    reset();
+    _stats = stats;
+
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        LOG_INFO("GL_EXT_disjoint_timer_query unsupported, no GPU stage times");
+        return false;
+    }
+    _glGenQueriesEXT = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+    _glDeleteQueriesEXT = (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+    _glBeginQueryEXT = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+    _glEndQueryEXT = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+    _glGetQueryObjectuivEXT = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+    _glGetQueryObjectui64vEXT = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!_glGenQueriesEXT || !_glDeleteQueriesEXT || !_glBeginQueryEXT || !_glEndQueryEXT ||
+        !_glGetQueryObjectuivEXT || !_glGetQueryObjectui64vEXT) {
+        return false;
+    }
+
+    _glGenQueriesEXT(GPU_TIMER_QUERIES, _queries);
+    // Some drivers, llvmpipe among them, report the first query from the
+    // start of their clock without flagging it disjoint
+    _warming_up = true;
+    // clears a disjoint flag left from before
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    _available = true;
+    return true;
+}
+
+void GpuTimer::reset()
+{
+    // The queries die with the context, which may already be gone
+    if (_available && _queries[0]) {
+        _glDeleteQueriesEXT(GPU_TIMER_QUERIES, _queries);
+    }
+    memset(_queries, 0, sizeof(_queries));
+    _available = false;
+    _first = 0;
+    _count = 0;
+    _active = false;
+}
+
+void GpuTimer::begin(enum frame_stage_t stage)
+{
+    if (!_available || _active) {
+        return;
+    }
+    if (_count == GPU_TIMER_QUERIES) {
+        // the GPU is further behind than we keep queries for
+        poll();
+        if (_count == GPU_TIMER_QUERIES) {
+            return;
+        }
+    }
+    int slot = (_first + _count) % GPU_TIMER_QUERIES;
+    _stages[slot] = stage;
+    _glBeginQueryEXT(GL_TIME_ELAPSED_EXT, _queries[slot]);
+    _active = true;
+}
+
+void GpuTimer::end()
+{
+    if (!_active) {
+        return;
+    }
+    _glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    _active = false;
+    _count++;
+}
+
+void GpuTimer::poll()
+{
+    if (!_available || _count == 0) {
+        return;
+    }
+
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+    // queries complete in order
+    while (_count > 0) {
+        GLuint query = _queries[_first];
+        GLuint ready = 0;
+        _glGetQueryObjectuivEXT(query, GL_QUERY_RESULT_AVAILABLE_EXT, &ready);
+        if (!ready) {
+            break;
+        }
+        GLuint64 elapsed = 0;
+        _glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT, &elapsed);
+        if (!disjoint && !_warming_up) {
+            _stats->record(_stages[_first], elapsed);
+        }
+        _warming_up = false;
+        _first = (_first + 1) % GPU_TIMER_QUERIES;
+        _count--;
+    }
+}
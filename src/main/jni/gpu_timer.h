@@ -0,0 +1,73 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "frame_stats.h"
+
+// Queries in flight; results arrive a few frames late
+#define GPU_TIMER_QUERIES 8
+
+// GPU durations of frame stages from GL_EXT_disjoint_timer_query.
+//
+// begin()/end() bracket the GL commands of a stage with a GL_TIME_ELAPSED
+// query. Results are collected by poll() without stalling the pipeline
+// once the GPU has them and recorded into the stage's histogram. Results
+// spanning a disjoint event (frequency change, context loss) are thrown
+// away. Without the extension every call does nothing.
+//
+// Must be used on the thread that has the GL context current.
+class GpuTimer {
+
+public:
+    GpuTimer();
+    virtual ~GpuTimer();
+
+    bool init(FrameStats *stats);
+    void reset();
+    bool isAvailable() const { return _available; }
+
+    // Only one stage can be timed at a time
+    void begin(enum frame_stage_t stage);
+    void end();
+
+    // Records every finished query. Never blocks.
+    void poll();
+
+private:
+    bool _available;
+    FrameStats *_stats;
+    PFNGLGENQUERIESEXTPROC _glGenQueriesEXT;
+    PFNGLDELETEQUERIESEXTPROC _glDeleteQueriesEXT;
+    PFNGLBEGINQUERYEXTPROC _glBeginQueryEXT;
+    PFNGLENDQUERYEXTPROC _glEndQueryEXT;
+    PFNGLGETQUERYOBJECTUIVEXTPROC _glGetQueryObjectuivEXT;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC _glGetQueryObjectui64vEXT;
+
+    // ring of queries, oldest at _first
+    GLuint _queries[GPU_TIMER_QUERIES];
+    enum frame_stage_t _stages[GPU_TIMER_QUERIES];
+    int _first;
+    int _count;
+    bool _active;
+    bool _warming_up;
+};
+
+#endif // GPU_TIMER_H
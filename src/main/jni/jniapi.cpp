@@ -15,6 +15,8 @@
 //
 
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <jni.h>
 #include <android/native_window.h> // requires ndk r5 or newer
 #include <android/native_window_jni.h> // requires ndk r5 or newer
@@ -28,11 +30,21 @@
 
 static ANativeWindow *window = 0;
 static Renderer *renderer = 0;
+static enum render_target_t render_target = RENDER_TARGET_WINDOW;
+static char cache_dir[PATH_MAX];
+static size_t memory_budget = BUFFER_POOL_DEFAULT_BUDGET;
 
 JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeOnStart(JNIEnv* jenv, jobject obj)
 {
     LOG_INFO("nativeOnStart");
-    renderer = new Renderer();
+    renderer = new Renderer(Renderer::DEFAULT_SWAPCHAIN_SIZE, SWAPCHAIN_MODE_MAILBOX, FRAME_MEMORY_UPLOAD,
+                            render_target);
+    renderer->setCacheDir(cache_dir);
+    renderer->setMemoryBudget(memory_budget);
+    // a surface kept across onStop is drawn into again
+    if (window) {
+        renderer->setWindow(window);
+    }
     return;
 }
 
@@ -60,15 +72,80 @@ JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeOnSt
 
 JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetSurface(JNIEnv* jenv, jobject obj, jobject surface)
 {
+    // The renderer keeps its own reference for as long as it draws
+    ANativeWindow *previous = window;
     if (surface != 0) {
         window = ANativeWindow_fromSurface(jenv, surface);
         LOG_INFO("Got window %p", window);
-        renderer->setWindow(window);
+        if (renderer) {
+            renderer->setWindow(window);
+        }
     } else {
+        // may come after nativeOnStop has deleted the renderer
         LOG_INFO("Releasing window");
-        ANativeWindow_release(window);
+        if (renderer) {
+            renderer->setWindow(NULL);
+        }
+        window = 0;
+    }
+    if (previous) {
+        ANativeWindow_release(previous);
+    }
+
+    return;
+}
+
+JNIEXPORT jstring JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeGetFrameStats(JNIEnv* jenv, jobject obj)
+{
+    char report[STATS_SERVER_MAX_REPORT];
+
+    report[0] = '\0';
+    if (renderer) {
+        renderer->formatStats(report, sizeof(report));
+    }
+    return jenv->NewStringUTF(report);
+}
+
+JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetOffscreen(JNIEnv* jenv, jobject obj, jboolean offscreen)
+{
+    // takes effect with the next nativeOnStart
+    render_target = offscreen ? RENDER_TARGET_OFFSCREEN : RENDER_TARGET_WINDOW;
+    return;
+}
+
+JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetCacheDir(JNIEnv* jenv, jobject obj, jstring path)
+{
+    // takes effect with the next nativeOnStart
+    cache_dir[0] = '\0';
+    if (path != 0) {
+        const char *chars = jenv->GetStringUTFChars(path, NULL);
+        // a path cut short would be some other directory
+        if (chars && strlen(chars) < sizeof(cache_dir)) {
+            strcpy(cache_dir, chars);
+        }
+        if (chars) {
+            jenv->ReleaseStringUTFChars(path, chars);
+        }
     }
+    return;
+}
 
+JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetFrameSize(JNIEnv* jenv, jobject obj, jint width, jint height)
+{
+    if (renderer) {
+        renderer->setFrameSize(width, height);
+    }
     return;
 }
 
+JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetMemoryBudget(JNIEnv* jenv, jobject obj, jlong bytes)
+{
+    if (bytes < 0) {
+        return;
+    }
+    memory_budget = (size_t)bytes;
+    if (renderer) {
+        renderer->setMemoryBudget(memory_budget);
+    }
+    return;
+}
@@ -23,6 +23,11 @@ extern "C" {
     JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeOnPause(JNIEnv* jenv, jobject obj);
     JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeOnStop(JNIEnv* jenv, jobject obj);
     JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetSurface(JNIEnv* jenv, jobject obj, jobject surface);
+    JNIEXPORT jstring JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeGetFrameStats(JNIEnv* jenv, jobject obj);
+    JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetOffscreen(JNIEnv* jenv, jobject obj, jboolean offscreen);
+    JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetCacheDir(JNIEnv* jenv, jobject obj, jstring path);
+    JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetFrameSize(JNIEnv* jenv, jobject obj, jint width, jint height);
+    JNIEXPORT void JNICALL Java_tsaarni_nativeeglexample_NativeEglExample_nativeSetMemoryBudget(JNIEnv* jenv, jobject obj, jlong bytes);
 };
 
 #endif // JNIAPI_H
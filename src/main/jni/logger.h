@@ -18,10 +18,25 @@
 #define LOGGER_H
 
 #include <strings.h>
+
+#ifdef __ANDROID__
+
 #include <android/log.h>
 
 #define LOG_INFO(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOG_ERROR(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
+#else
+
+// Desktop tools log to stderr, keeping stdout for their results
+#include <stdio.h>
+
+#define LOG_PRINT(level, ...) \
+    do { fprintf(stderr, "%s/%s: ", level, LOG_TAG); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOG_INFO(...) LOG_PRINT("I", __VA_ARGS__)
+#define LOG_ERROR(...) LOG_PRINT("E", __VA_ARGS__)
+
+#endif
+
 
 #endif // LOGGER_H
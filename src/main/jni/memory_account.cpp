@@ -0,0 +1,135 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdio.h>
+
+#include "memory_account.h"
+
+static const char *kind_names[MEMORY_KIND_COUNT] = {
+    "frame_data", "staging", "source_texture", "texture", "shared", "egl_image", "dmabuf"
+};
+
+const char *memory_kind_name(enum memory_kind_t kind)
+{
+    return kind < MEMORY_KIND_COUNT ? kind_names[kind] : "unknown";
+}
+
+MemoryAccount::MemoryAccount()
+{
+    for (int i = 0; i < MEMORY_KIND_COUNT; i++) {
+        _counts[i].store(0, std::memory_order_relaxed);
+        _bytes[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        _consumers[i].connected.store(false, std::memory_order_relaxed);
+        _consumers[i].imported.store(0, std::memory_order_relaxed);
+        _consumers[i].imported_bytes.store(0, std::memory_order_relaxed);
+        _consumers[i].held.store(0, std::memory_order_relaxed);
+        _consumers[i].held_bytes.store(0, std::memory_order_relaxed);
+    }
+    _peak.store(0, std::memory_order_relaxed);
+    _budget.store(0, std::memory_order_relaxed);
+    _evicted.store(0, std::memory_order_relaxed);
+}
+
+void MemoryAccount::set(enum memory_kind_t kind, uint32_t count, uint64_t bytes)
+{
+    _counts[kind].store(count, std::memory_order_relaxed);
+    _bytes[kind].store(bytes, std::memory_order_relaxed);
+
+    // only the render thread sets, nothing races this
+    uint64_t now = total();
+    if (now > _peak.load(std::memory_order_relaxed)) {
+        _peak.store(now, std::memory_order_relaxed);
+    }
+}
+
+void MemoryAccount::setConsumer(int index, const struct memory_consumer_t &consumer)
+{
+    struct consumer_t &entry = _consumers[index];
+
+    entry.connected.store(consumer.connected, std::memory_order_relaxed);
+    entry.imported.store(consumer.imported, std::memory_order_relaxed);
+    entry.imported_bytes.store(consumer.imported_bytes, std::memory_order_relaxed);
+    entry.held.store(consumer.held, std::memory_order_relaxed);
+    entry.held_bytes.store(consumer.held_bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccount::consumer(int index, struct memory_consumer_t *consumer) const
+{
+    const struct consumer_t &entry = _consumers[index];
+
+    consumer->connected = entry.connected.load(std::memory_order_relaxed);
+    consumer->imported = entry.imported.load(std::memory_order_relaxed);
+    consumer->imported_bytes = entry.imported_bytes.load(std::memory_order_relaxed);
+    consumer->held = entry.held.load(std::memory_order_relaxed);
+    consumer->held_bytes = entry.held_bytes.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryAccount::total() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < MEMORY_KIND_REFERENCES; i++) {
+        total += _bytes[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t MemoryAccount::format(char *buffer, size_t size) const
+{
+    size_t length = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    int written = snprintf(buffer, size, "memory total %llu peak %llu budget %llu evicted %llu\n",
+                           (unsigned long long)total(), (unsigned long long)peak(),
+                           (unsigned long long)budget(),
+                           (unsigned long long)_evicted.load(std::memory_order_relaxed));
+    if (written < 0) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    length = (size_t)written;
+    for (int i = 0; i < MEMORY_KIND_COUNT && length < size; i++) {
+        uint32_t count = _counts[i].load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        written = snprintf(buffer + length, size - length, "memory_%s %u %llu\n",
+                           memory_kind_name((enum memory_kind_t)i), count,
+                           (unsigned long long)_bytes[i].load(std::memory_order_relaxed));
+        if (written < 0) {
+            break;
+        }
+        length += (size_t)written;
+    }
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS && length < size; i++) {
+        struct memory_consumer_t c;
+        consumer(i, &c);
+        if (!c.connected) {
+            continue;
+        }
+        written = snprintf(buffer + length, size - length, "consumer %d %u %llu %u %llu\n", i,
+                           c.imported, (unsigned long long)c.imported_bytes,
+                           c.held, (unsigned long long)c.held_bytes);
+        if (written < 0) {
+            break;
+        }
+        length += (size_t)written;
+    }
+    return length < size ? length : size - 1;
+}
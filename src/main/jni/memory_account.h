@@ -0,0 +1,105 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef MEMORY_ACCOUNT_H
+#define MEMORY_ACCOUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "frame_broadcaster.h"
+
+// What the producer keeps memory pinned for. Images and dma-bufs only
+// refer to the memory of the textures and shared buffers they were made
+// from, so they are counted but left out of the total.
+enum memory_kind_t {
+    MEMORY_FRAME_DATA = 0, // CPU copy of the frame the uploads read
+    MEMORY_STAGING,        // pixel buffers uploads go through
+    MEMORY_SOURCE_TEXTURE, // texture offscreen frames are drawn from
+    MEMORY_TEXTURE,        // exported GL textures
+    MEMORY_SHARED,         // exported shared frame memory
+    MEMORY_EGL_IMAGE,      // images of exported buffers
+    MEMORY_DMABUF,         // exported buffers as the consumers import them
+    MEMORY_KIND_COUNT
+};
+
+// kinds from here on do not own their bytes
+#define MEMORY_KIND_REFERENCES MEMORY_EGL_IMAGE
+
+const char *memory_kind_name(enum memory_kind_t kind);
+
+// What one consumer keeps mapped, and of that what it reads right now
+struct memory_consumer_t
+{
+    bool connected;
+    uint32_t imported;
+    uint64_t imported_bytes;
+    uint32_t held;
+    uint64_t held_bytes;
+};
+
+// Snapshot of the memory the renderer pins, by kind and by consumer.
+//
+// The render thread replaces the figures whenever buffers come or go;
+// any thread may read them. Figures read while they are being replaced may
+// be one update apart, like the other statistics.
+class MemoryAccount {
+
+public:
+    MemoryAccount();
+
+    void set(enum memory_kind_t kind, uint32_t count, uint64_t bytes);
+    void setConsumer(int index, const struct memory_consumer_t &consumer);
+    void setBudget(uint64_t bytes) { _budget.store(bytes, std::memory_order_relaxed); }
+    // idle buffers given up to stay within the budget
+    void setEvicted(uint64_t evicted) { _evicted.store(evicted, std::memory_order_relaxed); }
+
+    uint32_t count(enum memory_kind_t kind) const { return _counts[kind].load(std::memory_order_relaxed); }
+    uint64_t bytes(enum memory_kind_t kind) const { return _bytes[kind].load(std::memory_order_relaxed); }
+    void consumer(int index, struct memory_consumer_t *consumer) const;
+    // bytes of the kinds that own memory
+    uint64_t total() const;
+    uint64_t peak() const { return _peak.load(std::memory_order_relaxed); }
+    uint64_t budget() const { return _budget.load(std::memory_order_relaxed); }
+
+    // Writes a line of totals in bytes, then one per kind with anything in
+    // it:
+    //     memory_kind count bytes
+    // and one per connected consumer:
+    //     consumer index imported imported_bytes held held_bytes
+    // Returns the length written, truncated to fit size.
+    size_t format(char *buffer, size_t size) const;
+
+private:
+    std::atomic<uint32_t> _counts[MEMORY_KIND_COUNT];
+    std::atomic<uint64_t> _bytes[MEMORY_KIND_COUNT];
+    std::atomic<uint64_t> _peak;
+    std::atomic<uint64_t> _budget;
+    std::atomic<uint64_t> _evicted;
+
+    struct consumer_t
+    {
+        std::atomic<bool> connected;
+        std::atomic<uint32_t> imported;
+        std::atomic<uint64_t> imported_bytes;
+        std::atomic<uint32_t> held;
+        std::atomic<uint64_t> held_bytes;
+    };
+    struct consumer_t _consumers[BROADCAST_MAX_CONSUMERS];
+};
+
+#endif // MEMORY_ACCOUNT_H
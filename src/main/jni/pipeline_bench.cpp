@@ -0,0 +1,701 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Runs the producer pipeline headless and measures it end to end.
+//
+//     pipeline_bench [frames [socket_path]]
+//
+// For every combination of frame size, format and ring depth the frames
+// are produced into shared buffers, registered with a consumer process
+// forked for the run and handed over with FRAME_READY through the same
+// FrameBroadcaster, Swapchain and FenceExporter the renderer uses. The
+// consumer maps the buffers, reads every frame and releases it.
+//
+// Two producers are measured:
+//   cpu  frames written by the pixel kernels into memfd buffers, the
+//        renderer's shared frame memory path
+//   gl   frames uploaded into GL textures exported as dma-bufs, the
+//        renderer's upload path; needs EGL_MESA_image_dma_buf_export on a
+//        surfaceless or pbuffer context (Mesa llvmpipe is fine)
+//
+// Prints one CSV line per run on stdout. Latency is from the start of
+// producing a frame until the consumer released it; display latency from
+// its content being complete until the consumer read it, as acked. Runs
+// that cannot be set up on this machine are logged and left out.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "logger.h"
+#include "consumer_session.h"
+#include "dmabuf_exporter.h"
+#include "dmabuf_format.h"
+#include "dmabuf_mapper.h"
+#include "frame_broadcaster.h"
+#include "frame_scheduler.h"
+#include "frame_stats.h"
+#include "pixel_kernels.h"
+#include "swapchain.h"
+#include "sync_fence.h"
+#include "texture_upload.h"
+
+#define LOG_TAG "PipelineBench"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#define DEFAULT_FRAMES 60
+#define DEFAULT_SOCKET "/tmp/pipeline_bench_socket"
+
+// A run gives up when no buffer comes back for this long
+#define RELEASE_TIMEOUT_MS 5000
+
+enum bench_producer_t {
+    BENCH_PRODUCER_CPU = 0,
+    BENCH_PRODUCER_GL
+};
+
+struct bench_size_t
+{
+    uint32_t width;
+    uint32_t height;
+};
+
+static const struct bench_size_t bench_sizes[] = {
+    { 256, 256 },
+    { 512, 512 },
+    { 1024, 1024 },
+    { 1920, 1080 },
+    { 3840, 2160 }
+};
+
+static const int bench_formats[] = {
+    DMABUF_FORMAT_ABGR8888,
+    DMABUF_FORMAT_ARGB8888,
+    DMABUF_FORMAT_NV12
+};
+
+static const int bench_ring_depths[] = { 2, 3, 4 };
+
+struct bench_config_t
+{
+    enum bench_producer_t producer;
+    int fourcc;
+    uint32_t width;
+    uint32_t height;
+    int buffers;
+    int frames;
+};
+
+struct bench_result_t
+{
+    double seconds;
+    uint64_t frames;
+    uint64_t frame_bytes;
+    struct histogram_summary_t latency;
+    struct histogram_summary_t display;
+};
+
+// GL state shared by every gl run
+struct bench_gl_t
+{
+    bool available;
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+    PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+    PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+};
+
+// One buffer of the ring on the producer side
+struct bench_buffer_t
+{
+    int fd;
+    void *pixels;
+    size_t size;
+    GLuint texture;
+    EGLImageKHR image;
+    struct dmabuf_buffer_registration_t registration;
+};
+
+static const char *format_name(int fourcc)
+{
+    switch (fourcc) {
+    case DMABUF_FORMAT_ABGR8888: return "ABGR8888";
+    case DMABUF_FORMAT_ARGB8888: return "ARGB8888";
+    case DMABUF_FORMAT_NV12:     return "NV12";
+    default:                     return "unknown";
+    }
+}
+
+static bool init_gl(struct bench_gl_t *gl)
+{
+    memset(gl, 0, sizeof(*gl));
+    gl->display = EGL_NO_DISPLAY;
+    gl->context = EGL_NO_CONTEXT;
+    gl->surface = EGL_NO_SURFACE;
+
+    // Prefer the surfaceless platform, which needs no window system
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (eglGetPlatformDisplayEXT && client_extensions &&
+        strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        gl->display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (gl->display == EGL_NO_DISPLAY) {
+        gl->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (gl->display == EGL_NO_DISPLAY || !eglInitialize(gl->display, NULL, NULL)) {
+        LOG_ERROR("cannot initialize EGL %x", eglGetError());
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+    const EGLint surface_attribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    eglBindAPI(EGL_OPENGL_ES_API);
+    if (!eglChooseConfig(gl->display, config_attribs, &config, 1, &num_configs) || num_configs < 1) {
+        LOG_ERROR("no EGL config for a pbuffer with OpenGL ES 3");
+        return false;
+    }
+    gl->context = eglCreateContext(gl->display, config, EGL_NO_CONTEXT, context_attribs);
+    if (gl->context == EGL_NO_CONTEXT) {
+        LOG_ERROR("eglCreateContext() returned error %x", eglGetError());
+        return false;
+    }
+    // Nothing is drawn to it, the pbuffer only makes the context current
+    // where EGL_KHR_surfaceless_context is missing
+    gl->surface = eglCreatePbufferSurface(gl->display, config, surface_attribs);
+    if (!eglMakeCurrent(gl->display, gl->surface, gl->surface, gl->context)) {
+        LOG_ERROR("eglMakeCurrent() returned error %x", eglGetError());
+        return false;
+    }
+    LOG_INFO("GL renderer %s", (const char *)glGetString(GL_RENDERER));
+
+    if (!dmabuf_exporter_supported(gl->display)) {
+        LOG_INFO("EGL_MESA_image_dma_buf_export unsupported, skipping gl runs");
+        return false;
+    }
+    gl->eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    gl->eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    if (!gl->eglCreateImageKHR || !gl->eglDestroyImageKHR) {
+        return false;
+    }
+    gl->available = true;
+    return true;
+}
+
+static void destroy_gl(struct bench_gl_t *gl)
+{
+    if (gl->display == EGL_NO_DISPLAY) {
+        return;
+    }
+    eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (gl->surface != EGL_NO_SURFACE) {
+        eglDestroySurface(gl->display, gl->surface);
+    }
+    if (gl->context != EGL_NO_CONTEXT) {
+        eglDestroyContext(gl->display, gl->context);
+    }
+    eglTerminate(gl->display);
+    gl->display = EGL_NO_DISPLAY;
+}
+
+static bool create_cpu_buffer(const struct bench_config_t *config, struct bench_buffer_t *buffer)
+{
+    struct dmabuf_buffer_registration_t *registration = &buffer->registration;
+
+    buffer->size = dmabuf_format_layout(config->fourcc, config->width, config->height, 64,
+                                        &registration->metadata);
+    if (buffer->size == 0) {
+        return false;
+    }
+    buffer->fd = syscall(SYS_memfd_create, "bench_frame", MFD_CLOEXEC);
+    if (buffer->fd < 0) {
+        LOG_ERROR("cannot create frame memory %s", strerror(errno));
+        return false;
+    }
+    registration->fds[0] = buffer->fd;
+    registration->num_fds = 1;
+    if (ftruncate(buffer->fd, buffer->size) < 0) {
+        LOG_ERROR("cannot size frame memory %s", strerror(errno));
+        return false;
+    }
+    buffer->pixels = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+    if (buffer->pixels == MAP_FAILED) {
+        buffer->pixels = NULL;
+        LOG_ERROR("cannot map frame memory %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool create_gl_buffer(const struct bench_gl_t *gl, const struct bench_config_t *config,
+                             struct bench_buffer_t *buffer)
+{
+    glGenTextures(1, &buffer->texture);
+    glBindTexture(GL_TEXTURE_2D, buffer->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, config->width, config->height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    if (glGetError() != GL_NO_ERROR) {
+        return false;
+    }
+    buffer->image = gl->eglCreateImageKHR(gl->display, gl->context, EGL_GL_TEXTURE_2D_KHR,
+                                          (EGLClientBuffer)(uintptr_t)buffer->texture, NULL);
+    if (buffer->image == EGL_NO_IMAGE_KHR) {
+        LOG_ERROR("cannot create EGLImage of texture %x", eglGetError());
+        return false;
+    }
+    if (!dmabuf_export_image(gl->display, buffer->image, &buffer->registration)) {
+        return false;
+    }
+    buffer->fd = buffer->registration.fds[0];
+    return true;
+}
+
+static void destroy_buffer(const struct bench_gl_t *gl, struct bench_buffer_t *buffer)
+{
+    if (buffer->pixels) {
+        munmap(buffer->pixels, buffer->size);
+    }
+    for (int i = 0; i < buffer->registration.num_fds; i++) {
+        close(buffer->registration.fds[i]);
+    }
+    if (buffer->image != EGL_NO_IMAGE_KHR) {
+        gl->eglDestroyImageKHR(gl->display, buffer->image);
+    }
+    if (buffer->texture) {
+        glDeleteTextures(1, &buffer->texture);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->fd = -1;
+}
+
+// Writes the RGBA source frame into a cpu buffer in its format.
+static void write_frame(const struct pixel_kernels_t *kernels, const struct bench_config_t *config,
+                        const uint32_t *src, struct bench_buffer_t *buffer)
+{
+    const struct texture_storage_metadata_t *metadata = &buffer->registration.metadata;
+    uint8_t *base = (uint8_t *)buffer->pixels;
+    uint8_t *plane0 = base + metadata->planes[0].offset;
+
+    switch (config->fourcc) {
+    case DMABUF_FORMAT_ABGR8888:
+        kernels->copy(plane0, metadata->planes[0].stride, src, config->width * 4,
+                      config->width * 4, config->height);
+        break;
+    case DMABUF_FORMAT_ARGB8888:
+        kernels->swizzle_rgba_bgra((uint32_t *)plane0, metadata->planes[0].stride / 4,
+                                   src, config->width, config->width, config->height);
+        break;
+    case DMABUF_FORMAT_NV12:
+        kernels->rgba_to_nv12(plane0, metadata->planes[0].stride,
+                              base + metadata->planes[1].offset, metadata->planes[1].stride,
+                              src, config->width, config->width, config->height);
+        break;
+    }
+}
+
+// Reads one word of every cache line of the frame, the way a consumer
+// scanning the frame pulls it through the cache.
+static uint32_t read_frame(const struct dmabuf_mapping_t *mapping)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < mapping->num_planes; i++) {
+        uint32_t row_bytes = dmabuf_format_plane_width_bytes(mapping->fourcc, i, mapping->width);
+        uint32_t rows = dmabuf_format_plane_height(mapping->fourcc, i, mapping->height);
+        for (uint32_t y = 0; y < rows; y++) {
+            const uint8_t *row = mapping->planes[i] + (size_t)y * mapping->strides[i];
+            for (uint32_t x = 0; x + 4 <= row_bytes; x += 64) {
+                uint32_t word;
+                memcpy(&word, row + x, sizeof(word));
+                sum += word;
+            }
+        }
+    }
+    return sum;
+}
+
+// Stand-in consumer, runs in the forked child until the producer hangs up.
+static int run_consumer(const char *path)
+{
+    ConsumerSession session;
+    DmabufMapper mapper;
+    struct consumer_event_t event;
+    volatile uint32_t checksum = 0;
+    struct dmabuf_format_set_t formats;
+
+    if (!session.subscribe(path)) {
+        return 1;
+    }
+    // it maps buffers with the CPU, linear ones only
+    DmabufMapper::supportedFormats(&formats);
+    if (!session.advertiseFormats(&formats)) {
+        return 1;
+    }
+    while (session.nextEvent(&event, true) > 0) {
+        switch (event.type) {
+        case DMABUF_MSG_REGISTER_BUFFER:
+            mapper.map(event.buffer_id, event.fds, event.num_fds, event.width, event.height, event.metadata);
+            for (int i = 0; i < event.num_fds; i++) {
+                close(event.fds[i]);
+            }
+            break;
+        case DMABUF_MSG_UNREGISTER_BUFFER:
+            mapper.unmap(event.buffer_id);
+            break;
+        case DMABUF_MSG_FRAME_READY: {
+            struct dmabuf_consumer_timing_t timing;
+            timing.receive_ns = event.receive_ns;
+            if (event.fence_fd >= 0) {
+                sync_fence_wait(event.fence_fd, -1);
+                close(event.fence_fd);
+            }
+            timing.ready_ns = dmabuf_timestamp_ns();
+            const struct dmabuf_mapping_t *mapping = mapper.begin(event.buffer_id, DMABUF_ACCESS_READ);
+            timing.import_ns = dmabuf_timestamp_ns();
+            timing.display_ns = 0;
+            if (mapping) {
+                // reading it all stands in for showing it
+                checksum += read_frame(mapping);
+                mapper.end(event.buffer_id);
+                timing.display_ns = dmabuf_timestamp_ns();
+            }
+            session.acknowledge(event.buffer_id, event.frame_id, timing);
+            session.release(event.buffer_id, event.frame_id);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+// Waits for released buffers and hands them back to the swapchain,
+// recording the latency of each frame. Returns false if nothing came back
+// in time or the consumer went away.
+static bool collect_releases(FrameBroadcaster *broadcaster, Swapchain *swapchain, FenceExporter *fences,
+                             const uint64_t *started, LatencyHistogram *latency, int *outstanding)
+{
+    uint32_t ids[DMABUF_MAX_BUFFERS];
+    struct pollfd fds[BROADCAST_MAX_CONSUMERS + 1];
+    uint64_t deadline = scheduler_now_ns() + (uint64_t)RELEASE_TIMEOUT_MS * 1000000;
+
+    for (;;) {
+        fences->signalCompleted();
+        broadcaster->poll();
+        int count = broadcaster->receiveReleases(ids, DMABUF_MAX_BUFFERS);
+        if (count > 0) {
+            uint64_t now = scheduler_now_ns();
+            for (int i = 0; i < count; i++) {
+                latency->record(now - started[ids[i]]);
+                swapchain->release(ids[i]);
+                (*outstanding)--;
+            }
+            return true;
+        }
+        if (broadcaster->consumerCount() == 0) {
+            LOG_ERROR("consumer went away");
+            return false;
+        }
+        if (scheduler_now_ns() > deadline) {
+            LOG_ERROR("no buffer released in %d ms", RELEASE_TIMEOUT_MS);
+            return false;
+        }
+        // eventfd fences are only signalled from here, so keep polling
+        // while they are pending
+        int count_fds = broadcaster->pollFds(fds, BROADCAST_MAX_CONSUMERS + 1);
+        poll(fds, count_fds, fences->hasPending() ? 1 : 100);
+    }
+}
+
+// Sends every frame the swapchain lets go, like Renderer::present_pending().
+// Returns false if the consumer did not take one.
+static bool present_pending(FrameBroadcaster *broadcaster, Swapchain *swapchain, int *fence_fds,
+                            const enum dmabuf_fence_type_t *fence_types, const uint64_t *content,
+                            uint64_t *frame_id, int *outstanding)
+{
+    int id;
+    bool taken = true;
+
+    while ((id = swapchain->acquireNext()) >= 0) {
+        struct dmabuf_frame_timing_t timing;
+        timing.content_ns = content[id];
+        timing.send_ns = scheduler_now_ns();
+        timing.gpu_done_ns = fence_fds[id] >= 0 && sync_fence_wait(fence_fds[id], 0) ? timing.send_ns : 0;
+        int holders = broadcaster->broadcastFrame(id, (*frame_id)++, fence_fds[id], fence_types[id], NULL,
+                                                  &timing);
+        if (fence_fds[id] >= 0) {
+            close(fence_fds[id]);
+            fence_fds[id] = -1;
+        }
+        if (holders == 0) {
+            LOG_ERROR("consumer did not take frame %llu", (unsigned long long)*frame_id - 1);
+            swapchain->release(id);
+            taken = false;
+        }
+        *outstanding += holders;
+    }
+    return taken;
+}
+
+static bool run_config(const struct bench_gl_t *gl, const struct bench_config_t *config,
+                       const char *path, struct bench_result_t *result)
+{
+    const struct pixel_kernels_t *kernels = pixel_kernels_get();
+    struct bench_buffer_t buffers[SWAPCHAIN_MAX_BUFFERS];
+    uint64_t started[SWAPCHAIN_MAX_BUFFERS];
+    uint64_t content[SWAPCHAIN_MAX_BUFFERS];
+    int fence_fds[SWAPCHAIN_MAX_BUFFERS];
+    enum dmabuf_fence_type_t fence_types[SWAPCHAIN_MAX_BUFFERS];
+    FrameBroadcaster broadcaster(config->buffers - 1);
+    Swapchain swapchain;
+    FenceExporter fences;
+    TextureUploader uploader;
+    LatencyHistogram latency;
+    FrameLatency frame_latency;
+    bool ok = true;
+    int created = 0;
+    pid_t child = -1;
+
+    memset(buffers, 0, sizeof(buffers));
+    memset(started, 0, sizeof(started));
+    memset(content, 0, sizeof(content));
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        fence_fds[i] = -1;
+        fence_types[i] = DMABUF_FENCE_NONE;
+    }
+    memset(result, 0, sizeof(*result));
+
+    uint32_t *src = (uint32_t *)malloc((size_t)config->width * config->height * 4);
+    if (!src) {
+        return false;
+    }
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < (size_t)config->width * config->height; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = seed;
+    }
+
+    for (int i = 0; i < config->buffers && ok; i++) {
+        buffers[i].fd = -1;
+        buffers[i].registration.buffer_id = i;
+        buffers[i].registration.width = config->width;
+        buffers[i].registration.height = config->height;
+        ok = config->producer == BENCH_PRODUCER_GL ? create_gl_buffer(gl, config, &buffers[i])
+                                                   : create_cpu_buffer(config, &buffers[i]);
+        created++;
+    }
+    if (ok && config->producer == BENCH_PRODUCER_GL) {
+        ok = uploader.init(config->width, config->height);
+        fences.init(gl->display);
+    } else {
+        fences.init(EGL_NO_DISPLAY);
+    }
+    ok = ok && swapchain.init(config->buffers, SWAPCHAIN_MODE_FIFO, config->buffers - 1);
+
+    struct dmabuf_buffer_registration_t registrations[SWAPCHAIN_MAX_BUFFERS];
+    for (int i = 0; i < config->buffers && ok; i++) {
+        registrations[i] = buffers[i].registration;
+    }
+    ok = ok && broadcaster.listen(path) && broadcaster.setBuffers(registrations, config->buffers);
+    broadcaster.setLatency(&frame_latency);
+
+    if (ok) {
+        child = fork();
+        if (child == 0) {
+            broadcaster.close();
+            _exit(run_consumer(path));
+        }
+        ok = child > 0;
+    }
+
+    // wait for the consumer to subscribe
+    uint64_t deadline = scheduler_now_ns() + (uint64_t)RELEASE_TIMEOUT_MS * 1000000;
+    while (ok && broadcaster.consumerCount() == 0) {
+        struct pollfd fds[BROADCAST_MAX_CONSUMERS + 1];
+        int count = broadcaster.pollFds(fds, BROADCAST_MAX_CONSUMERS + 1);
+        poll(fds, count, 10);
+        broadcaster.poll();
+        ok = scheduler_now_ns() < deadline;
+    }
+
+    int outstanding = 0;
+    int produced = 0;
+    uint64_t frame_id = 0;
+    uint64_t start = scheduler_now_ns();
+    while (ok && produced < config->frames) {
+        int id = swapchain.dequeue();
+        if (id < 0) {
+            ok = collect_releases(&broadcaster, &swapchain, &fences, started, &latency, &outstanding) &&
+                 present_pending(&broadcaster, &swapchain, fence_fds, fence_types, content, &frame_id,
+                                 &outstanding);
+            continue;
+        }
+        started[id] = scheduler_now_ns();
+        kernels->rotate_quadrants(src, config->width, config->height, config->width);
+        if (config->producer == BENCH_PRODUCER_GL) {
+            uploader.upload(buffers[id].texture, src);
+            content[id] = scheduler_now_ns();
+            fence_fds[id] = fences.createFence(&fence_types[id]);
+            if (fence_fds[id] < 0) {
+                glFinish();
+            } else {
+                glFlush();
+            }
+        } else {
+            write_frame(kernels, config, src, &buffers[id]);
+            content[id] = scheduler_now_ns();
+        }
+        swapchain.queue(id);
+        produced++;
+        ok = present_pending(&broadcaster, &swapchain, fence_fds, fence_types, content, &frame_id,
+                             &outstanding);
+    }
+    while (ok && (outstanding > 0 || (int)frame_id < produced)) {
+        ok = collect_releases(&broadcaster, &swapchain, &fences, started, &latency, &outstanding) &&
+             present_pending(&broadcaster, &swapchain, fence_fds, fence_types, content, &frame_id,
+                             &outstanding);
+    }
+    uint64_t end = scheduler_now_ns();
+
+    broadcaster.close();
+    if (child > 0) {
+        int status;
+        // A consumer stuck in a wait would never see the hangup
+        if (!ok) {
+            kill(child, SIGKILL);
+        }
+        waitpid(child, &status, 0);
+    }
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        if (fence_fds[i] >= 0) {
+            close(fence_fds[i]);
+        }
+    }
+    uploader.reset();
+    fences.reset();
+    for (int i = 0; i < created; i++) {
+        destroy_buffer(gl, &buffers[i]);
+    }
+    unlink(path);
+    free(src);
+
+    if (ok) {
+        result->seconds = (end - start) / 1e9;
+        result->frames = frame_id;
+        result->frame_bytes = dmabuf_format_frame_size(config->fourcc, config->width, config->height);
+        latency.summary(&result->latency);
+        frame_latency.summary(FRAME_LATENCY_TOTAL, &result->display);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+    const char *path = argc > 2 ? argv[2] : DEFAULT_SOCKET;
+    struct bench_gl_t gl;
+    int failed = 0;
+
+    if (frames <= 0) {
+        fprintf(stderr, "usage: %s [frames [socket_path]]\n", argv[0]);
+        return 2;
+    }
+    // a consumer that dies must not take us with it
+    signal(SIGPIPE, SIG_IGN);
+    init_gl(&gl);
+
+    printf("producer,format,width,height,buffers,frames,seconds,fps,"
+           "latency_mean_us,latency_p50_us,latency_p95_us,latency_p99_us,latency_max_us,"
+           "display_p50_us,display_p99_us,frame_bytes,mb_per_s\n");
+    for (int p = BENCH_PRODUCER_CPU; p <= BENCH_PRODUCER_GL; p++) {
+        for (size_t f = 0; f < sizeof(bench_formats) / sizeof(bench_formats[0]); f++) {
+            // textures are exported as they are stored, RGBA only
+            if (p == BENCH_PRODUCER_GL && (!gl.available || bench_formats[f] != DMABUF_FORMAT_ABGR8888)) {
+                continue;
+            }
+            for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+                for (size_t d = 0; d < sizeof(bench_ring_depths) / sizeof(bench_ring_depths[0]); d++) {
+                    struct bench_config_t config;
+                    struct bench_result_t result;
+                    config.producer = (enum bench_producer_t)p;
+                    config.fourcc = bench_formats[f];
+                    config.width = bench_sizes[s].width;
+                    config.height = bench_sizes[s].height;
+                    config.buffers = bench_ring_depths[d];
+                    config.frames = frames;
+
+                    if (!run_config(&gl, &config, path, &result)) {
+                        LOG_ERROR("%s %s %ux%u x%d failed", p == BENCH_PRODUCER_GL ? "gl" : "cpu",
+                                  format_name(config.fourcc), config.width, config.height, config.buffers);
+                        failed++;
+                        continue;
+                    }
+                    printf("%s,%s,%u,%u,%d,%llu,%.4f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%.1f\n",
+                           p == BENCH_PRODUCER_GL ? "gl" : "cpu", format_name(config.fourcc),
+                           config.width, config.height, config.buffers,
+                           (unsigned long long)result.frames, result.seconds,
+                           result.frames / result.seconds,
+                           result.latency.mean_ns / 1e3, result.latency.p50_ns / 1e3,
+                           result.latency.p95_ns / 1e3, result.latency.p99_ns / 1e3,
+                           result.latency.max_ns / 1e3,
+                           result.display.p50_ns / 1e3, result.display.p99_ns / 1e3,
+                           (unsigned long long)result.frame_bytes,
+                           result.frame_bytes * result.frames / result.seconds / 1e6);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    destroy_gl(&gl);
+    return failed ? 1 : 0;
+}
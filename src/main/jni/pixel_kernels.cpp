@@ -0,0 +1,203 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <pthread.h>
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+// Edge of the square tiles the scalar transpose works in
+#define TRANSPOSE_TILE 16
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+void pixel_rotate_quadrants_span(uint32_t *data, uint32_t stride, uint32_t width,
+                                 uint32_t height, uint32_t x0, uint32_t x1)
+{
+    // the right and bottom quadrants start after an odd middle column/row
+    uint32_t right = width - width / 2;
+    uint32_t bottom = height - height / 2;
+
+    for (uint32_t y = 0; y < height / 2; y++) {
+        uint32_t *tl = data + (size_t)y * stride;
+        uint32_t *tr = tl + right;
+        uint32_t *bl = tl + (size_t)bottom * stride;
+        uint32_t *br = bl + right;
+        for (uint32_t x = x0; x < x1; x++) {
+            uint32_t temp = tl[x];
+            tl[x] = tr[x];
+            tr[x] = br[x];
+            br[x] = bl[x];
+            bl[x] = temp;
+        }
+    }
+}
+
+void pixel_swizzle_span(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t p = src[i];
+        dst[i] = (p & 0xff00ff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+    }
+}
+
+static inline uint8_t luma(uint32_t p)
+{
+    int r = p & 0xff, g = (p >> 8) & 0xff, b = (p >> 16) & 0xff;
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+void pixel_rgba_to_nv12_rect(uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+                             const uint32_t *src, uint32_t src_stride,
+                             uint32_t width, uint32_t height, uint32_t x0, uint32_t x1)
+{
+    for (uint32_t row = 0; row < height; row += 2) {
+        const uint32_t *s0 = src + (size_t)row * src_stride;
+        const uint32_t *s1 = row + 1 < height ? s0 + src_stride : s0;
+        uint8_t *y0 = y + (size_t)row * y_stride;
+        uint8_t *y1 = row + 1 < height ? y0 + y_stride : NULL;
+        uint8_t *c = uv + (size_t)(row / 2) * uv_stride;
+
+        for (uint32_t x = x0; x < x1; x += 2) {
+            uint32_t xn = x + 1 < width ? x + 1 : x;
+            uint32_t p[4] = { s0[x], s0[xn], s1[x], s1[xn] };
+            int r = 0, g = 0, b = 0;
+
+            y0[x] = luma(p[0]);
+            if (x + 1 < width) {
+                y0[x + 1] = luma(p[1]);
+            }
+            if (y1) {
+                y1[x] = luma(p[2]);
+                if (x + 1 < width) {
+                    y1[x + 1] = luma(p[3]);
+                }
+            }
+
+            for (int i = 0; i < 4; i++) {
+                r += p[i] & 0xff;
+                g += (p[i] >> 8) & 0xff;
+                b += (p[i] >> 16) & 0xff;
+            }
+            // sums of four pixels: scale by 1/256 and 1/4 at once
+            c[x] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+            c[x + 1] = (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+        }
+    }
+}
+
+void pixel_transpose_tile(uint32_t *dst, uint32_t dst_stride,
+                          const uint32_t *src, uint32_t src_stride,
+                          uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1)
+{
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x++) {
+            dst[(size_t)x * dst_stride + y] = src[(size_t)y * src_stride + x];
+        }
+    }
+}
+
+static void rotate_quadrants_scalar(uint32_t *data, uint32_t width, uint32_t height, uint32_t stride)
+{
+    uint32_t half_width = width / 2;
+
+    pixel_rotate_quadrants_span(data, stride, width, height, 0, half_width);
+}
+
+static void fill_scalar(uint32_t *dst, uint32_t width, uint32_t height, uint32_t stride, uint32_t value)
+{
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *row = dst + (size_t)y * stride;
+        for (uint32_t x = 0; x < width; x++) {
+            row[x] = value;
+        }
+    }
+}
+
+static void swizzle_scalar(uint32_t *dst, uint32_t dst_stride,
+                           const uint32_t *src, uint32_t src_stride,
+                           uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++) {
+        pixel_swizzle_span(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, width);
+    }
+}
+
+static void rgba_to_nv12_scalar(uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+                                const uint32_t *src, uint32_t src_stride,
+                                uint32_t width, uint32_t height)
+{
+    pixel_rgba_to_nv12_rect(y, y_stride, uv, uv_stride, src, src_stride, width, height, 0, width);
+}
+
+static void copy_scalar(void *dst, size_t dst_stride, const void *src, size_t src_stride,
+                        size_t width_bytes, uint32_t height)
+{
+    if (dst_stride == width_bytes && src_stride == width_bytes) {
+        memcpy(dst, src, width_bytes * height);
+        return;
+    }
+    for (uint32_t y = 0; y < height; y++) {
+        memcpy((uint8_t *)dst + y * dst_stride, (const uint8_t *)src + y * src_stride, width_bytes);
+    }
+}
+
+static void transpose_scalar(uint32_t *dst, uint32_t dst_stride,
+                             const uint32_t *src, uint32_t src_stride,
+                             uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y += TRANSPOSE_TILE) {
+        for (uint32_t x = 0; x < width; x += TRANSPOSE_TILE) {
+            pixel_transpose_tile(dst, dst_stride, src, src_stride,
+                                 x, min_u32(x + TRANSPOSE_TILE, width),
+                                 y, min_u32(y + TRANSPOSE_TILE, height));
+        }
+    }
+}
+
+static const struct pixel_kernels_t scalar_kernels = {
+    "scalar",
+    rotate_quadrants_scalar,
+    fill_scalar,
+    swizzle_scalar,
+    rgba_to_nv12_scalar,
+    copy_scalar,
+    transpose_scalar
+};
+
+const struct pixel_kernels_t *pixel_kernels_scalar()
+{
+    return &scalar_kernels;
+}
+
+static const struct pixel_kernels_t *selected_kernels = NULL;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels()
+{
+    if ((selected_kernels = pixel_kernels_avx2()) ||
+        (selected_kernels = pixel_kernels_sse()) ||
+        (selected_kernels = pixel_kernels_neon())) {
+        return;
+    }
+    selected_kernels = &scalar_kernels;
+}
+
+const struct pixel_kernels_t *pixel_kernels_get()
+{
+    pthread_once(&select_once, select_kernels);
+    return selected_kernels;
+}
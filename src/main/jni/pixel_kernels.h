@@ -0,0 +1,86 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel loops used to generate and convert frames on the CPU.
+//
+// Pixels are 32-bit RGBA8 in memory byte order R, G, B, A. Strides are in
+// pixels for 32-bit images and in bytes for 8-bit planes; any width, height
+// and stride works. Every implementation produces bit-identical results;
+// the SIMD ones handle whole vectors and leave the edges to the scalar code.
+struct pixel_kernels_t
+{
+    const char *name;
+
+    // Moves each quadrant counter-clockwise: top right to top left, bottom
+    // right to top right and so on. With an odd size the middle row and
+    // column stay put.
+    void (*rotate_quadrants)(uint32_t *data, uint32_t width, uint32_t height, uint32_t stride);
+
+    void (*fill)(uint32_t *dst, uint32_t width, uint32_t height, uint32_t stride, uint32_t value);
+
+    // Swaps R and B; dst may equal src.
+    void (*swizzle_rgba_bgra)(uint32_t *dst, uint32_t dst_stride,
+                              const uint32_t *src, uint32_t src_stride,
+                              uint32_t width, uint32_t height);
+
+    // BT.601 limited range. Chroma is the average of each 2x2 block; odd
+    // edges repeat the last pixel.
+    void (*rgba_to_nv12)(uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+                         const uint32_t *src, uint32_t src_stride,
+                         uint32_t width, uint32_t height);
+
+    // Copies width_bytes of each row; strides in bytes.
+    void (*copy)(void *dst, size_t dst_stride, const void *src, size_t src_stride,
+                 size_t width_bytes, uint32_t height);
+
+    // dst (height x width) = src (width x height) transposed, in tiles that
+    // stay in cache.
+    void (*transpose)(uint32_t *dst, uint32_t dst_stride,
+                      const uint32_t *src, uint32_t src_stride,
+                      uint32_t width, uint32_t height);
+};
+
+// Best implementation the running CPU supports. Chosen once, thread safe.
+const struct pixel_kernels_t *pixel_kernels_get();
+
+// Individual implementations, NULL when not built for this architecture or
+// not supported by the CPU.
+const struct pixel_kernels_t *pixel_kernels_scalar();
+const struct pixel_kernels_t *pixel_kernels_sse();
+const struct pixel_kernels_t *pixel_kernels_avx2();
+const struct pixel_kernels_t *pixel_kernels_neon();
+
+// Scalar kernels on a sub-rectangle, used by the SIMD implementations for
+// the pixels that do not fill a whole vector.
+// x0 and x1 are columns of the top left quadrant.
+void pixel_rotate_quadrants_span(uint32_t *data, uint32_t stride, uint32_t width,
+                                 uint32_t height, uint32_t x0, uint32_t x1);
+void pixel_swizzle_span(uint32_t *dst, const uint32_t *src, uint32_t count);
+// x0 and x1 must be even or width.
+void pixel_rgba_to_nv12_rect(uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+                             const uint32_t *src, uint32_t src_stride,
+                             uint32_t width, uint32_t height, uint32_t x0, uint32_t x1);
+void pixel_transpose_tile(uint32_t *dst, uint32_t dst_stride,
+                          const uint32_t *src, uint32_t src_stride,
+                          uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1);
+
+#endif // PIXEL_KERNELS_H
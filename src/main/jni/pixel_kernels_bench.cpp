@@ -0,0 +1,178 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Measures every pixel kernel with every implementation the CPU supports
+// and checks the results against the scalar code.
+//
+//     pixel_kernels_bench [width height [iterations]]
+//
+// Prints one CSV line per kernel and implementation. Exits non-zero if an
+// implementation disagrees with the scalar one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pixel_kernels.h"
+
+struct bench_buffers_t
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // pixels, padded to exercise strided access
+    uint32_t *src;
+    uint32_t *dst;
+    uint8_t *nv12;
+    size_t nv12_size;
+};
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_pattern(struct bench_buffers_t *b)
+{
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < (size_t)b->stride * b->height; i++) {
+        seed = seed * 1103515245 + 12345;
+        b->src[i] = seed;
+    }
+}
+
+// Runs kernel number index once on b; returns the bytes read and written.
+static size_t run_kernel(const struct pixel_kernels_t *k, int index, struct bench_buffers_t *b)
+{
+    size_t image = (size_t)b->width * b->height * 4;
+    uint32_t uv_offset = b->width * b->height;
+
+    switch (index) {
+        case 0:
+            k->rotate_quadrants(b->dst, b->width, b->height, b->stride);
+            return image * 2;
+        case 1:
+            k->fill(b->dst, b->width, b->height, b->stride, 0xff336699);
+            return image;
+        case 2:
+            k->swizzle_rgba_bgra(b->dst, b->stride, b->src, b->stride, b->width, b->height);
+            return image * 2;
+        case 3:
+            k->rgba_to_nv12(b->nv12, b->width, b->nv12 + uv_offset, (b->width + 1) & ~1u,
+                            b->src, b->stride, b->width, b->height);
+            return image + b->nv12_size;
+        case 4:
+            k->copy(b->dst, b->stride * 4, b->src, b->stride * 4, (size_t)b->width * 4, b->height);
+            return image * 2;
+        case 5:
+            // transposed image fits as long as the stride covers the height
+            k->transpose(b->dst, b->stride, b->src, b->stride, b->width, b->height);
+            return image * 2;
+        default:
+            return 0;
+    }
+}
+
+static const char *kernel_names[] = {
+    "rotate_quadrants", "fill", "swizzle_rgba_bgra", "rgba_to_nv12", "copy", "transpose"
+};
+
+int main(int argc, char **argv)
+{
+    struct bench_buffers_t b;
+    int iterations = 50;
+    int failures = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.width = 1920;
+    b.height = 1080;
+    if (argc >= 3) {
+        b.width = atoi(argv[1]);
+        b.height = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        iterations = atoi(argv[3]);
+    }
+    if (b.width == 0 || b.height == 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+        return 2;
+    }
+
+    uint32_t edge = b.width > b.height ? b.width : b.height;
+    b.stride = edge + 16;
+    size_t pixels = (size_t)b.stride * (edge + 1);
+    b.nv12_size = (size_t)b.width * b.height + (size_t)((b.width + 1) & ~1u) * ((b.height + 1) / 2);
+    b.src = (uint32_t *)calloc(pixels, 4);
+    b.dst = (uint32_t *)calloc(pixels, 4);
+    b.nv12 = (uint8_t *)calloc(b.nv12_size, 1);
+    uint32_t *expected = (uint32_t *)calloc(pixels, 4);
+    uint8_t *expected_nv12 = (uint8_t *)calloc(b.nv12_size, 1);
+    if (!b.src || !b.dst || !b.nv12 || !expected || !expected_nv12) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_pattern(&b);
+
+    const struct pixel_kernels_t *impls[] = {
+        pixel_kernels_scalar(), pixel_kernels_sse(), pixel_kernels_avx2(), pixel_kernels_neon()
+    };
+
+    printf("kernel,isa,width,height,ms,gb_per_s,matches_scalar\n");
+    for (int kernel = 0; kernel < 6; kernel++) {
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            const struct pixel_kernels_t *k = impls[i];
+            if (!k) {
+                continue;
+            }
+
+            // one run from a known state for the comparison
+            memcpy(b.dst, b.src, pixels * 4);
+            memset(b.nv12, 0, b.nv12_size);
+            run_kernel(k, kernel, &b);
+            bool match = true;
+            if (k == pixel_kernels_scalar()) {
+                memcpy(expected, b.dst, pixels * 4);
+                memcpy(expected_nv12, b.nv12, b.nv12_size);
+            } else {
+                match = memcmp(expected, b.dst, pixels * 4) == 0 &&
+                        memcmp(expected_nv12, b.nv12, b.nv12_size) == 0;
+            }
+            if (!match) {
+                failures++;
+            }
+
+            size_t bytes = 0;
+            double start = now_seconds();
+            for (int n = 0; n < iterations; n++) {
+                bytes += run_kernel(k, kernel, &b);
+            }
+            double elapsed = now_seconds() - start;
+
+            printf("%s,%s,%u,%u,%.3f,%.2f,%s\n", kernel_names[kernel], k->name, b.width, b.height,
+                   elapsed * 1000.0 / iterations, bytes / elapsed / 1e9, match ? "yes" : "no");
+        }
+    }
+    printf("# selected: %s\n", pixel_kernels_get()->name);
+
+    free(b.src);
+    free(b.dst);
+    free(b.nv12);
+    free(expected);
+    free(expected_nv12);
+    return failures ? 1 : 0;
+}
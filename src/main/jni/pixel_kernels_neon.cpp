@@ -0,0 +1,206 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "pixel_kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+// NEON is part of every arm64 CPU and of the armeabi-v7a ABI the NDK
+// builds for, so no runtime check is needed.
+
+// Edge of the tiles the transpose works in
+#define TRANSPOSE_TILE 32
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+static void rotate_quadrants_neon(uint32_t *data, uint32_t width, uint32_t height, uint32_t stride)
+{
+    uint32_t right = width - width / 2;
+    uint32_t bottom = height - height / 2;
+    uint32_t vector_end = (width / 2) & ~3u;
+
+    for (uint32_t y = 0; y < height / 2; y++) {
+        uint32_t *tl = data + (size_t)y * stride;
+        uint32_t *tr = tl + right;
+        uint32_t *bl = tl + (size_t)bottom * stride;
+        uint32_t *br = bl + right;
+        for (uint32_t x = 0; x < vector_end; x += 4) {
+            uint32x4_t a = vld1q_u32(tl + x);
+            uint32x4_t b = vld1q_u32(tr + x);
+            uint32x4_t c = vld1q_u32(br + x);
+            uint32x4_t d = vld1q_u32(bl + x);
+            vst1q_u32(tl + x, b);
+            vst1q_u32(tr + x, c);
+            vst1q_u32(br + x, d);
+            vst1q_u32(bl + x, a);
+        }
+    }
+    pixel_rotate_quadrants_span(data, stride, width, height, vector_end, width / 2);
+}
+
+static void fill_neon(uint32_t *dst, uint32_t width, uint32_t height, uint32_t stride, uint32_t value)
+{
+    uint32x4_t v = vdupq_n_u32(value);
+    uint32_t vector_end = width & ~3u;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *row = dst + (size_t)y * stride;
+        uint32_t x = 0;
+        for (; x < vector_end; x += 4) {
+            vst1q_u32(row + x, v);
+        }
+        for (; x < width; x++) {
+            row[x] = value;
+        }
+    }
+}
+
+static void swizzle_neon(uint32_t *dst, uint32_t dst_stride,
+                         const uint32_t *src, uint32_t src_stride,
+                         uint32_t width, uint32_t height)
+{
+    uint32_t vector_end = width & ~15u;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *d = dst + (size_t)y * dst_stride;
+        const uint32_t *s = src + (size_t)y * src_stride;
+        for (uint32_t x = 0; x < vector_end; x += 16) {
+            // de-interleaved load gives one register per channel
+            uint8x16x4_t p = vld4q_u8((const uint8_t *)(s + x));
+            uint8x16_t r = p.val[0];
+            p.val[0] = p.val[2];
+            p.val[2] = r;
+            vst4q_u8((uint8_t *)(d + x), p);
+        }
+        pixel_swizzle_span(d + vector_end, s + vector_end, width - vector_end);
+    }
+}
+
+// Y of eight pixels; every term is positive so 16 bits suffice
+static inline uint8x8_t luma8_neon(uint8x8x4_t p)
+{
+    uint16x8_t sum = vmull_u8(p.val[0], vdup_n_u8(66));
+    sum = vmlal_u8(sum, p.val[1], vdup_n_u8(129));
+    sum = vmlal_u8(sum, p.val[2], vdup_n_u8(25));
+    sum = vaddq_u16(sum, vdupq_n_u16(128));
+    return vadd_u8(vshrn_n_u16(sum, 8), vdup_n_u8(16));
+}
+
+// One chroma value per 2x2 block from the sums of four pixels
+static inline int16x4_t chroma4_neon(int32x4_t r, int32x4_t g, int32x4_t b,
+                                     int32_t cr, int32_t cg, int32_t cb)
+{
+    int32x4_t sum = vmulq_n_s32(r, cr);
+    sum = vmlaq_n_s32(sum, g, cg);
+    sum = vmlaq_n_s32(sum, b, cb);
+    sum = vshrq_n_s32(vaddq_s32(sum, vdupq_n_s32(512)), 10);
+    return vmovn_s32(vaddq_s32(sum, vdupq_n_s32(128)));
+}
+
+static void rgba_to_nv12_neon(uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+                              const uint32_t *src, uint32_t src_stride,
+                              uint32_t width, uint32_t height)
+{
+    uint32_t vector_end = width & ~7u;
+
+    for (uint32_t row = 0; row < height; row += 2) {
+        const uint32_t *s0 = src + (size_t)row * src_stride;
+        const uint32_t *s1 = row + 1 < height ? s0 + src_stride : s0;
+        uint8_t *y0 = y + (size_t)row * y_stride;
+        uint8_t *y1 = row + 1 < height ? y0 + y_stride : NULL;
+        uint8_t *c = uv + (size_t)(row / 2) * uv_stride;
+
+        for (uint32_t x = 0; x < vector_end; x += 8) {
+            uint8x8x4_t a = vld4_u8((const uint8_t *)(s0 + x));
+            uint8x8x4_t b = vld4_u8((const uint8_t *)(s1 + x));
+
+            vst1_u8(y0 + x, luma8_neon(a));
+            if (y1) {
+                vst1_u8(y1 + x, luma8_neon(b));
+            }
+
+            // vertical then horizontal pair sums per channel
+            int32x4_t r = vreinterpretq_s32_u32(vpaddlq_u16(vaddl_u8(a.val[0], b.val[0])));
+            int32x4_t g = vreinterpretq_s32_u32(vpaddlq_u16(vaddl_u8(a.val[1], b.val[1])));
+            int32x4_t bl = vreinterpretq_s32_u32(vpaddlq_u16(vaddl_u8(a.val[2], b.val[2])));
+            int16x4x2_t uv4 = vzip_s16(chroma4_neon(r, g, bl, -38, -74, 112),
+                                       chroma4_neon(r, g, bl, 112, -94, -18));
+            vst1_u8(c + x, vqmovun_s16(vcombine_s16(uv4.val[0], uv4.val[1])));
+        }
+    }
+    if (vector_end < width) {
+        pixel_rgba_to_nv12_rect(y, y_stride, uv, uv_stride, src, src_stride, width, height,
+                                vector_end, width);
+    }
+}
+
+static void transpose_neon(uint32_t *dst, uint32_t dst_stride,
+                           const uint32_t *src, uint32_t src_stride,
+                           uint32_t width, uint32_t height)
+{
+    for (uint32_t ty = 0; ty < height; ty += TRANSPOSE_TILE) {
+        for (uint32_t tx = 0; tx < width; tx += TRANSPOSE_TILE) {
+            uint32_t x_end = min_u32(tx + TRANSPOSE_TILE, width);
+            uint32_t y_end = min_u32(ty + TRANSPOSE_TILE, height);
+            uint32_t x_vec = tx + ((x_end - tx) & ~3u);
+            uint32_t y_vec = ty + ((y_end - ty) & ~3u);
+
+            for (uint32_t y = ty; y < y_vec; y += 4) {
+                for (uint32_t x = tx; x < x_vec; x += 4) {
+                    const uint32_t *s = src + (size_t)y * src_stride + x;
+                    uint32x4x2_t t0 = vtrnq_u32(vld1q_u32(s), vld1q_u32(s + src_stride));
+                    uint32x4x2_t t1 = vtrnq_u32(vld1q_u32(s + 2 * src_stride), vld1q_u32(s + 3 * src_stride));
+                    uint32_t *d = dst + (size_t)x * dst_stride + y;
+                    vst1q_u32(d, vcombine_u32(vget_low_u32(t0.val[0]), vget_low_u32(t1.val[0])));
+                    vst1q_u32(d + dst_stride, vcombine_u32(vget_low_u32(t0.val[1]), vget_low_u32(t1.val[1])));
+                    vst1q_u32(d + 2 * dst_stride, vcombine_u32(vget_high_u32(t0.val[0]), vget_high_u32(t1.val[0])));
+                    vst1q_u32(d + 3 * dst_stride, vcombine_u32(vget_high_u32(t0.val[1]), vget_high_u32(t1.val[1])));
+                }
+            }
+            pixel_transpose_tile(dst, dst_stride, src, src_stride, x_vec, x_end, ty, y_end);
+            pixel_transpose_tile(dst, dst_stride, src, src_stride, tx, x_vec, y_vec, y_end);
+        }
+    }
+}
+
+static struct pixel_kernels_t make_neon_kernels()
+{
+    struct pixel_kernels_t kernels = *pixel_kernels_scalar();
+    kernels.name = "neon";
+    kernels.rotate_quadrants = rotate_quadrants_neon;
+    kernels.fill = fill_neon;
+    kernels.swizzle_rgba_bgra = swizzle_neon;
+    kernels.rgba_to_nv12 = rgba_to_nv12_neon;
+    kernels.transpose = transpose_neon;
+    return kernels;
+}
+
+const struct pixel_kernels_t *pixel_kernels_neon()
+{
+    static const struct pixel_kernels_t kernels = make_neon_kernels();
+    return &kernels;
+}
+
+#else
+
+const struct pixel_kernels_t *pixel_kernels_neon()
+{
+    return NULL;
+}
+
+#endif
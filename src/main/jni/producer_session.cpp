@@ -0,0 +1,517 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logger.h"
+#include "fd_transfer.h"
+#include "producer_session.h"
+#include "trace.h"
+
+#define LOG_TAG "EglSample"
+
+ProducerSession::ProducerSession(int max_in_flight)
+    : _sock(-1), _max_in_flight(max_in_flight), _held(0),
+      _frames_sent(0), _frames_dropped(0), _has_formats(false), _formats_changed(false),
+      _latency(NULL), _rx_len(0), _tx_len(0), _queue_head(0), _queued(0)
+{
+    dmabuf_format_set_clear(&_formats);
+    dmabuf_format_set_clear(&_incoming_formats);
+    damage_region_set_full(&_missed_damage);
+}
+
+ProducerSession::~ProducerSession()
+{
+    close();
+}
+
+bool ProducerSession::connect(const char *path)
+{
+    struct sockaddr_un server_addr;
+
+    if (_sock >= 0) {
+        return true;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        LOG_ERROR("create socket failed %s", strerror(errno));
+        return false;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strncpy(server_addr.sun_path, path, sizeof(server_addr.sun_path) - 1);
+
+    // A Unix socket connects at once or not at all: EAGAIN means the
+    // listener's backlog is full. The caller decides when to try again.
+    if (::connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        int error = errno;
+        ::close(sock);
+        errno = error;
+        return false;
+    }
+
+    LOG_INFO("session connected to %s", path);
+    return adopt(sock);
+}
+
+bool ProducerSession::adopt(int sock)
+{
+    close();
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOG_ERROR("session cannot make socket non-blocking %s", strerror(errno));
+        ::close(sock);
+        return false;
+    }
+
+    _sock = sock;
+    _held = 0;
+    // a new consumer has no previous frame to apply damage to
+    damage_region_set_full(&_missed_damage);
+    return true;
+}
+
+void ProducerSession::close()
+{
+    if (_sock >= 0) {
+        ::close(_sock);
+        _sock = -1;
+    }
+    _rx_len = 0;
+    _tx_len = 0;
+    clear_queue();
+}
+
+bool ProducerSession::registerBuffer(uint32_t buffer_id, int dmabuf_fd,
+                                     uint32_t width, uint32_t height,
+                                     const struct texture_storage_metadata_t &metadata)
+{
+    struct dmabuf_buffer_registration_t buffer;
+    buffer.buffer_id = buffer_id;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.metadata = metadata;
+    buffer.fds[0] = dmabuf_fd;
+    buffer.num_fds = 1;
+
+    return registerBuffers(&buffer, 1);
+}
+
+bool ProducerSession::registerBuffers(const struct dmabuf_buffer_registration_t *buffers, int count)
+{
+    struct dmabuf_register_buffer_msg_t msgs[PRODUCER_SESSION_MAX_BATCH];
+    struct iovec iov[PRODUCER_SESSION_MAX_BATCH];
+    int fds[PRODUCER_SESSION_MAX_BATCH * DMABUF_MAX_PLANES];
+    int num_fds = 0;
+    TRACE_SCOPE("register_buffers");
+
+    if (_sock < 0) {
+        return false;
+    }
+    if (count > PRODUCER_SESSION_MAX_BATCH) {
+        LOG_ERROR("session cannot register %d buffers at once", count);
+        return false;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < count; i++) {
+        if (buffers[i].num_fds < 1 || buffers[i].num_fds > DMABUF_MAX_PLANES) {
+            LOG_ERROR("session buffer %u has %d fds", buffers[i].buffer_id, buffers[i].num_fds);
+            return false;
+        }
+        dmabuf_init_header(&msgs[i].header, DMABUF_MSG_REGISTER_BUFFER, sizeof(msgs[i]));
+        msgs[i].buffer_id = buffers[i].buffer_id;
+        msgs[i].width = buffers[i].width;
+        msgs[i].height = buffers[i].height;
+        msgs[i].num_fds = buffers[i].num_fds;
+        msgs[i].metadata = buffers[i].metadata;
+        for (int j = 0; j < buffers[i].num_fds; j++) {
+            fds[num_fds++] = buffers[i].fds[j];
+        }
+        iov[i].iov_base = &msgs[i];
+        iov[i].iov_len = sizeof(msgs[i]);
+    }
+
+    int counts[PRODUCER_SESSION_MAX_BATCH];
+    for (int i = 0; i < count; i++) {
+        counts[i] = buffers[i].num_fds;
+    }
+    // Registrations cannot be dropped; they wait for a busy consumer
+    if (!send_control(iov, count, fds, counts)) {
+        LOG_ERROR("session could not register buffers");
+        return false;
+    }
+    return true;
+}
+
+bool ProducerSession::unregisterBuffer(uint32_t buffer_id)
+{
+    struct dmabuf_unregister_buffer_msg_t msg;
+    struct iovec io;
+
+    memset(&msg, 0, sizeof(msg));
+    dmabuf_init_header(&msg.header, DMABUF_MSG_UNREGISTER_BUFFER, sizeof(msg));
+    msg.buffer_id = buffer_id;
+    io.iov_base = &msg;
+    io.iov_len = sizeof(msg);
+
+    int no_fds = 0;
+    if (!send_control(&io, 1, NULL, &no_fds)) {
+        return false;
+    }
+    if (buffer_id < DMABUF_MAX_BUFFERS) {
+        _held &= ~(1u << buffer_id);
+    }
+    return true;
+}
+
+bool ProducerSession::frameReady(uint32_t buffer_id, uint64_t frame_id, int fence_fd,
+                                 enum dmabuf_fence_type_t fence_type,
+                                 const struct damage_region_t *damage,
+                                 const struct dmabuf_frame_timing_t *timing)
+{
+    TRACE_FRAME_SCOPE("frame_ready", frame_id);
+    struct dmabuf_frame_ready_msg_t msg;
+    struct iovec io;
+
+    if (_sock < 0 || buffer_id >= DMABUF_MAX_BUFFERS) {
+        return false;
+    }
+
+    // Backpressure: a consumer still holding its share of frames, or with
+    // previous messages stuck in the socket or queued, misses this one.
+    flush();
+    if (damage) {
+        damage_region_union(&_missed_damage, damage);
+    } else {
+        damage_region_set_full(&_missed_damage);
+    }
+    int in_flight = __builtin_popcount(_held);
+    if (in_flight >= _max_in_flight || hasPendingWrite()) {
+        _frames_dropped++;
+        return false;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.buffer_id = buffer_id;
+    msg.fence_type = fence_fd >= 0 ? fence_type : DMABUF_FENCE_NONE;
+    msg.frame_id = frame_id;
+    if (timing) {
+        msg.timing = *timing;
+    }
+    // num_damage stays 0, meaning the whole buffer, for a full region
+    if (!_missed_damage.full) {
+        msg.num_damage = _missed_damage.count;
+        memcpy(msg.damage, _missed_damage.rects, sizeof(struct dmabuf_rect_t) * msg.num_damage);
+    }
+    size_t size = DMABUF_FRAME_READY_MIN_SIZE + sizeof(struct dmabuf_rect_t) * msg.num_damage;
+    dmabuf_init_header(&msg.header, DMABUF_MSG_FRAME_READY, size);
+    io.iov_base = &msg;
+    io.iov_len = size;
+
+    switch (send_message(&io, 1, &fence_fd, fence_fd >= 0 ? 1 : 0)) {
+        case SEND_OK:
+            _held |= 1u << buffer_id;
+            _frames_sent++;
+            damage_region_clear(&_missed_damage);
+            return true;
+        case SEND_WOULD_BLOCK:
+            _frames_dropped++;
+            return false;
+        default:
+            close();
+            return false;
+    }
+}
+
+int ProducerSession::receiveReleases(uint32_t *ids, int max_ids)
+{
+    int count = 0;
+
+    if (_sock < 0) {
+        return -1;
+    }
+
+    for (;;) {
+        // hand out every complete message already buffered
+        while (count < max_ids && _rx_len >= sizeof(struct dmabuf_message_header_t)) {
+            struct dmabuf_message_header_t header;
+            memcpy(&header, _rx, sizeof(header));
+            if (header.magic == DMABUF_PROTOCOL_MAGIC && header.version != DMABUF_PROTOCOL_VERSION) {
+                LOG_ERROR("consumer speaks protocol version %u, not %u", header.version,
+                          DMABUF_PROTOCOL_VERSION);
+                close();
+                return -1;
+            }
+            if (header.magic != DMABUF_PROTOCOL_MAGIC ||
+                header.size < sizeof(header) || header.size > DMABUF_MAX_MESSAGE_SIZE) {
+                LOG_ERROR("session received malformed message");
+                close();
+                return -1;
+            }
+            if (_rx_len < header.size) {
+                break;
+            }
+            if (header.type == DMABUF_MSG_BUFFER_RELEASE &&
+                header.size >= sizeof(struct dmabuf_buffer_release_msg_t)) {
+                struct dmabuf_buffer_release_msg_t msg;
+                memcpy(&msg, _rx, sizeof(msg));
+                // ignore releases of buffers the consumer does not hold
+                if (msg.buffer_id < DMABUF_MAX_BUFFERS && (_held & (1u << msg.buffer_id))) {
+                    _held &= ~(1u << msg.buffer_id);
+                    ids[count++] = msg.buffer_id;
+                }
+            } else if (header.type == DMABUF_MSG_SUPPORTED_FORMATS &&
+                       header.size >= DMABUF_SUPPORTED_FORMATS_MIN_SIZE) {
+                struct dmabuf_supported_formats_msg_t msg;
+                memset(&msg, 0, sizeof(msg));
+                memcpy(&msg, _rx, header.size < sizeof(msg) ? header.size : sizeof(msg));
+                receive_formats(msg, header.size);
+            } else if (header.type == DMABUF_MSG_FRAME_ACK &&
+                       header.size >= sizeof(struct dmabuf_frame_ack_msg_t)) {
+                struct dmabuf_frame_ack_msg_t msg;
+                memcpy(&msg, _rx, sizeof(msg));
+                if (_latency) {
+                    _latency->frameAcked(msg.frame_id, msg.timing);
+                }
+            }
+            _rx_len -= header.size;
+            memmove(_rx, _rx + header.size, _rx_len);
+        }
+        if (count == max_ids) {
+            return count;
+        }
+
+        ssize_t received = recv(_sock, _rx + _rx_len, sizeof(_rx) - _rx_len, MSG_DONTWAIT);
+        if (received > 0) {
+            _rx_len += received;
+            continue;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return count;
+        }
+
+        LOG_INFO("consumer closed the session");
+        close();
+        return -1;
+    }
+}
+
+void ProducerSession::flush()
+{
+    if (_sock < 0) {
+        return;
+    }
+
+    if (_tx_len > 0) {
+        ssize_t sent = send(_sock, _tx, _tx_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR("session send failed %s", strerror(errno));
+                close();
+            }
+            return;
+        }
+        _tx_len -= sent;
+        memmove(_tx, _tx + sent, _tx_len);
+    }
+
+    // Queued messages follow in order once nothing is left half sent
+    while (_tx_len == 0 && _queued > 0) {
+        struct queued_message_t *message = &_queue[_queue_head];
+        struct iovec io;
+        io.iov_base = message->data;
+        io.iov_len = message->size;
+        ssize_t sent = send_fds_once(_sock, &io, 1, message->fds, message->num_fds, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR("session send failed %s", strerror(errno));
+                close();
+            }
+            return;
+        }
+        // the fds went out with the first byte, the rest is an ordinary tail
+        _tx_len = message->size - sent;
+        memcpy(_tx, message->data + sent, _tx_len);
+        for (int i = 0; i < message->num_fds; i++) {
+            ::close(message->fds[i]);
+        }
+        _queue_head = (_queue_head + 1) % PRODUCER_SESSION_MAX_QUEUED;
+        _queued--;
+    }
+}
+
+enum ProducerSession::send_result_t ProducerSession::send_message(const struct iovec *iov, int iovcnt,
+                                                                  const int *fds, int num_fds)
+{
+    size_t total = 0;
+
+    if (_sock < 0) {
+        return SEND_FAILED;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    // Keep message boundaries and order: nothing new goes out while a
+    // tail or a queued message is pending
+    flush();
+    if (_tx_len > 0 || _queued > 0) {
+        return SEND_WOULD_BLOCK;
+    }
+    if (_sock < 0) {
+        return SEND_FAILED;
+    }
+
+    ssize_t sent = send_fds_once(_sock, iov, iovcnt, fds, num_fds, MSG_DONTWAIT);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return SEND_WOULD_BLOCK;
+        }
+        LOG_ERROR("session send failed %s", strerror(errno));
+        return SEND_FAILED;
+    }
+
+    // The fds went out with the first byte; park the rest of the message
+    size_t skip = sent;
+    for (int i = 0; i < iovcnt && (size_t)sent < total; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t len = iov[i].iov_len - skip;
+        if (_tx_len + len > sizeof(_tx)) {
+            LOG_ERROR("session transmit buffer overflow");
+            return SEND_FAILED;
+        }
+        memcpy(_tx + _tx_len, (const char *)iov[i].iov_base + skip, len);
+        _tx_len += len;
+        skip = 0;
+    }
+    return SEND_OK;
+}
+
+bool ProducerSession::send_control(const struct iovec *iov, int iovcnt, const int *fds, const int *num_fds)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += num_fds[i];
+    }
+
+    switch (send_message(iov, iovcnt, fds, total)) {
+        case SEND_OK:
+            return true;
+        case SEND_WOULD_BLOCK:
+            break;
+        default:
+            close();
+            return false;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        if (!queue_message(iov[i].iov_base, iov[i].iov_len, fds, num_fds[i])) {
+            // it would only fall further behind; it may subscribe again
+            LOG_ERROR("consumer does not keep up with registrations, disconnecting");
+            close();
+            return false;
+        }
+        fds += num_fds[i];
+    }
+    return true;
+}
+
+bool ProducerSession::queue_message(const void *data, size_t size, const int *fds, int num_fds)
+{
+    if (_queued == PRODUCER_SESSION_MAX_QUEUED || size > DMABUF_MAX_MESSAGE_SIZE ||
+        num_fds > DMABUF_MAX_PLANES) {
+        return false;
+    }
+    struct queued_message_t *message = &_queue[(_queue_head + _queued) % PRODUCER_SESSION_MAX_QUEUED];
+    // the caller may close its fds as soon as this returns
+    for (int i = 0; i < num_fds; i++) {
+        message->fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+        if (message->fds[i] < 0) {
+            LOG_ERROR("session cannot keep fd %s", strerror(errno));
+            for (int j = 0; j < i; j++) {
+                ::close(message->fds[j]);
+            }
+            return false;
+        }
+    }
+    memcpy(message->data, data, size);
+    message->size = size;
+    message->num_fds = num_fds;
+    _queued++;
+    return true;
+}
+
+void ProducerSession::clear_queue()
+{
+    for (; _queued > 0; _queued--) {
+        struct queued_message_t *message = &_queue[_queue_head];
+        for (int i = 0; i < message->num_fds; i++) {
+            ::close(message->fds[i]);
+        }
+        _queue_head = (_queue_head + 1) % PRODUCER_SESSION_MAX_QUEUED;
+    }
+    _queue_head = 0;
+}
+
+bool ProducerSession::supportsFormat(int fourcc, uint64_t modifier) const
+{
+    return !_has_formats || dmabuf_format_set_contains(&_formats, fourcc, modifier);
+}
+
+bool ProducerSession::takeFormatsChanged()
+{
+    bool changed = _formats_changed;
+    _formats_changed = false;
+    return changed;
+}
+
+void ProducerSession::receive_formats(const struct dmabuf_supported_formats_msg_t &msg, size_t size)
+{
+    uint32_t count = msg.count;
+    size_t room = (size - DMABUF_SUPPORTED_FORMATS_MIN_SIZE) / sizeof(struct dmabuf_format_modifier_t);
+
+    if (count > DMABUF_FORMATS_PER_MESSAGE || count > room) {
+        LOG_ERROR("session received %u formats in a message with room for %zu", count, room);
+        count = room < DMABUF_FORMATS_PER_MESSAGE ? room : DMABUF_FORMATS_PER_MESSAGE;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        // what does not fit is as good as unsupported
+        dmabuf_format_set_add(&_incoming_formats, msg.formats[i].fourcc, msg.formats[i].modifier);
+    }
+    if (msg.last) {
+        _formats = _incoming_formats;
+        dmabuf_format_set_clear(&_incoming_formats);
+        _has_formats = true;
+        _formats_changed = true;
+        LOG_INFO("consumer imports %d format modifiers", _formats.count);
+    }
+}
@@ -0,0 +1,173 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PRODUCER_SESSION_H
+#define PRODUCER_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "damage_region.h"
+#include "dmabuf_format.h"
+#include "dmabuf_protocol.h"
+#include "frame_stats.h"
+
+#define PRODUCER_SESSION_MAX_BATCH 8
+// Registrations and unregistrations waiting for room in the socket; a
+// consumer that lets more pile up is disconnected
+#define PRODUCER_SESSION_MAX_QUEUED 32
+
+struct dmabuf_buffer_registration_t
+{
+    uint32_t buffer_id;
+    uint32_t width;
+    uint32_t height;
+    struct texture_storage_metadata_t metadata;
+    // one fd per distinct dma-buf, referenced by planes[].fd_index
+    int fds[DMABUF_MAX_PLANES];
+    int num_fds;
+};
+
+// Long-lived connection from the producer to one consumer.
+//
+// The session registers every shared buffer once (fds and metadata) and
+// then only sends small FRAME_READY notifications per frame. The socket is
+// non-blocking and nothing ever waits for it: a consumer that does not keep
+// up has frames dropped for it, while registrations, which cannot be
+// dropped, are queued with their fds until flush() gets them out. All
+// methods must be called from the same thread (the render thread).
+class ProducerSession {
+
+public:
+    // max_in_flight limits how many frames the consumer may hold at once.
+    ProducerSession(int max_in_flight = 1);
+    virtual ~ProducerSession();
+
+    // Dials a consumer listening on path. Does not block; fails when the
+    // consumer cannot take the connection right away.
+    bool connect(const char *path);
+    // Takes over a socket accepted from a subscribing consumer.
+    bool adopt(int sock);
+    void close();
+    bool isConnected() const { return _sock >= 0; }
+    int fd() const { return _sock; }
+
+    // Sends a single-fd buffer and its storage metadata. The caller keeps
+    // ownership of dmabuf_fd and may close it once this returns.
+    bool registerBuffer(uint32_t buffer_id, int dmabuf_fd,
+                        uint32_t width, uint32_t height,
+                        const struct texture_storage_metadata_t &metadata);
+    // Registers up to PRODUCER_SESSION_MAX_BATCH buffers, each with up to
+    // DMABUF_MAX_PLANES fds, with a single sendmsg carrying all their fds.
+    bool registerBuffers(const struct dmabuf_buffer_registration_t *buffers, int count);
+    bool unregisterBuffer(uint32_t buffer_id);
+
+    // Tells the consumer that buffer_id holds frame frame_id. The frame may
+    // only be read once fence_fd signals; the caller keeps ownership of it.
+    // damage is what changed since the previous frame, NULL for
+    // everything; damage of frames dropped for this consumer is carried
+    // over into the next frame it gets. timing goes out with the frame,
+    // NULL sends zeros.
+    // Returns true if the consumer now holds buffer_id, false if the frame
+    // was dropped for this consumer or the session failed.
+    bool frameReady(uint32_t buffer_id, uint64_t frame_id, int fence_fd = -1,
+                    enum dmabuf_fence_type_t fence_type = DMABUF_FENCE_NONE,
+                    const struct damage_region_t *damage = NULL,
+                    const struct dmabuf_frame_timing_t *timing = NULL);
+
+    // Drains BUFFER_RELEASE messages without blocking. Stores up to
+    // max_ids released buffer ids and returns their count, or -1 if the
+    // consumer went away. Only buffers the consumer held are reported.
+    // Format lists the consumer sends are taken on the way, and so are
+    // FRAME_ACKs when there is a FrameLatency to record them into.
+    int receiveReleases(uint32_t *ids, int max_ids);
+    void setLatency(FrameLatency *latency) { _latency = latency; }
+
+    // Whether the consumer can import fourcc with modifier. True for
+    // everything until the consumer sends a format list.
+    bool supportsFormat(int fourcc, uint64_t modifier) const;
+    bool hasFormats() const { return _has_formats; }
+    // True once after a new format list arrived
+    bool takeFormatsChanged();
+
+    // Writes out the remainder of a partially sent message and whatever
+    // was queued behind it.
+    void flush();
+    bool hasPendingWrite() const { return _tx_len > 0 || _queued > 0; }
+    int queued() const { return _queued; }
+
+    // bitmask of buffer ids the consumer holds, or held when the session
+    // was closed
+    uint32_t heldBuffers() const { return _held; }
+
+    uint64_t framesSent() const { return _frames_sent; }
+    uint64_t framesDropped() const { return _frames_dropped; }
+
+private:
+    enum send_result_t {
+        SEND_OK,
+        SEND_WOULD_BLOCK,
+        SEND_FAILED
+    };
+    enum send_result_t send_message(const struct iovec *iov, int iovcnt,
+                                    const int *fds, int num_fds);
+    // Sends one control message per iov, with num_fds[i] of fds each, or
+    // queues them when the socket is busy. False once the session failed.
+    bool send_control(const struct iovec *iov, int iovcnt, const int *fds, const int *num_fds);
+    bool queue_message(const void *data, size_t size, const int *fds, int num_fds);
+    void clear_queue();
+    void receive_formats(const struct dmabuf_supported_formats_msg_t &msg, size_t size);
+
+    int _sock;
+    int _max_in_flight;
+    uint32_t _held;
+    uint64_t _frames_sent;
+    uint64_t _frames_dropped;
+
+    // what the consumer imports, and the list being received
+    struct dmabuf_format_set_t _formats;
+    struct dmabuf_format_set_t _incoming_formats;
+    bool _has_formats;
+    bool _formats_changed;
+
+    FrameLatency *_latency;
+
+    // damage of frames the consumer has not seen
+    struct damage_region_t _missed_damage;
+
+    // partially received consumer messages
+    char _rx[DMABUF_MAX_MESSAGE_SIZE * 4];
+    size_t _rx_len;
+
+    // tail of a message the socket did not take in one go
+    char _tx[DMABUF_MAX_MESSAGE_SIZE * PRODUCER_SESSION_MAX_BATCH];
+    size_t _tx_len;
+
+    // control messages behind it, each with duplicates of its fds
+    struct queued_message_t
+    {
+        char data[DMABUF_MAX_MESSAGE_SIZE];
+        size_t size;
+        int fds[DMABUF_MAX_PLANES];
+        int num_fds;
+    };
+    struct queued_message_t _queue[PRODUCER_SESSION_MAX_QUEUED];
+    int _queue_head;
+    int _queued;
+};
+
+#endif // PRODUCER_SESSION_H
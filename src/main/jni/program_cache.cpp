@@ -0,0 +1,322 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "program_cache.h"
+#include "trace.h"
+
+#define LOG_TAG "EglSample"
+
+// "PRGC" in the first bytes of a cache file
+#define PROGRAM_CACHE_MAGIC 0x43475250
+// bump when program_cache_header_t changes
+#define PROGRAM_CACHE_VERSION 1
+
+// Start of every cache file, followed by length bytes of binary
+struct program_cache_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// FNV-1a, good enough to tell sources and drivers apart
+static uint64_t hash_string(uint64_t hash, const char *s)
+{
+    if (!s) {
+        s = "";
+    }
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 0x100000001b3ULL;
+    }
+    // separator, so that "ab" + "c" differs from "a" + "bc"
+    hash ^= 0xff;
+    hash *= 0x100000001b3ULL;
+    return hash;
+}
+
+static bool read_all(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        GLint infoLen = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
+        if (infoLen > 1) {
+            char *infoLog = (char *)malloc(sizeof(char) * infoLen);
+            glGetShaderInfoLog(shader, infoLen, NULL, infoLog);
+            LOG_ERROR(" error compiling %s shader \n %s \n",
+                      type == GL_VERTEX_SHADER ? "vertex" : "fragment", infoLog);
+            free(infoLog);
+        }
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+ProgramCache::ProgramCache()
+    : _hits(0), _misses(0)
+{
+    _directory[0] = '\0';
+}
+
+ProgramCache::~ProgramCache()
+{
+}
+
+void ProgramCache::setDirectory(const char *directory)
+{
+    _directory[0] = '\0';
+    if (directory && strlen(directory) < sizeof(_directory)) {
+        strcpy(_directory, directory);
+    }
+}
+
+GLuint ProgramCache::build(const char *name, const char *vertex_source, const char *fragment_source)
+{
+    TRACE_SCOPE("build_program");
+    uint64_t start = now_us();
+    char file[PATH_MAX];
+    GLint formats = 0;
+
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    bool cached = formats > 0 && path(name, file, sizeof(file));
+    uint64_t program_key = cached ? key(vertex_source, fragment_source) : 0;
+
+    GLuint program = glCreateProgram();
+    if (cached && load(file, program_key, program)) {
+        _hits++;
+        LOG_INFO("program %s loaded from cache in %llu us", name, (unsigned long long)(now_us() - start));
+        return program;
+    }
+
+    GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+    GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+    if (!vertex_shader || !fragment_shader) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        glDeleteProgram(program);
+        return 0;
+    }
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    if (cached) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    // the program keeps what it needs
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLint infoLen = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
+        if (infoLen > 1) {
+            char *infoLog = (char *)malloc(sizeof(char) * infoLen);
+            glGetProgramInfoLog(program, infoLen, NULL, infoLog);
+            LOG_ERROR(" error linking program %s \n %s \n", name, infoLog);
+            free(infoLog);
+        }
+        glDeleteProgram(program);
+        return 0;
+    }
+    _misses++;
+    if (cached) {
+        store(file, program_key, program);
+    }
+    LOG_INFO("program %s compiled in %llu us", name, (unsigned long long)(now_us() - start));
+    return program;
+}
+
+uint64_t ProgramCache::key(const char *vertex_source, const char *fragment_source)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = hash_string(hash, vertex_source);
+    hash = hash_string(hash, fragment_source);
+    // a driver update invalidates every binary
+    hash = hash_string(hash, (const char *)glGetString(GL_VENDOR));
+    hash = hash_string(hash, (const char *)glGetString(GL_RENDERER));
+    hash = hash_string(hash, (const char *)glGetString(GL_VERSION));
+    return hash;
+}
+
+bool ProgramCache::path(const char *name, char *path, size_t size)
+{
+    if (_directory[0] == '\0') {
+        return false;
+    }
+    int length = snprintf(path, size, "%s/%s.program", _directory, name);
+    return length > 0 && (size_t)length < size;
+}
+
+bool ProgramCache::load(const char *path, uint64_t key, GLuint program)
+{
+    struct program_cache_header_t header;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (!read_all(fd, &header, sizeof(header)) ||
+        header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION) {
+        LOG_INFO("%s is not a program cache file", path);
+        close(fd);
+        return false;
+    }
+    if (header.key != key) {
+        // other sources or another driver, replaced after compiling
+        LOG_INFO("%s is out of date", path);
+        close(fd);
+        return false;
+    }
+    if (header.length == 0 || header.length > PROGRAM_CACHE_MAX_BINARY) {
+        close(fd);
+        return false;
+    }
+    void *binary = malloc(header.length);
+    if (!binary) {
+        close(fd);
+        return false;
+    }
+    bool complete = read_all(fd, binary, header.length);
+    close(fd);
+    if (!complete) {
+        LOG_ERROR("%s is truncated", path);
+        free(binary);
+        return false;
+    }
+
+    glProgramBinary(program, header.format, binary, header.length);
+    free(binary);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        // drivers may refuse binaries for reasons the key does not cover
+        LOG_INFO("%s rejected by the driver", path);
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+void ProgramCache::store(const char *path, uint64_t key, GLuint program)
+{
+    struct program_cache_header_t header;
+    char temp[PATH_MAX];
+    GLint length = 0;
+    GLenum format = 0;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || length > PROGRAM_CACHE_MAX_BINARY) {
+        return;
+    }
+    void *binary = malloc(length);
+    if (!binary) {
+        return;
+    }
+    // an error left from before is not ours
+    glGetError();
+    glGetProgramBinary(program, length, &length, &format, binary);
+    if (glGetError() != GL_NO_ERROR || length <= 0) {
+        free(binary);
+        return;
+    }
+
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = length;
+
+    // Written aside and renamed, so that a reader, or a crash halfway,
+    // never leaves a partial file in place
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR("cannot create %s: %s", temp, strerror(errno));
+        free(binary);
+        return;
+    }
+    bool written = write_all(fd, &header, sizeof(header)) && write_all(fd, binary, length);
+    free(binary);
+    if (close(fd) < 0) {
+        written = false;
+    }
+    if (!written || rename(temp, path) < 0) {
+        LOG_ERROR("cannot write %s: %s", path, strerror(errno));
+        unlink(temp);
+        return;
+    }
+}
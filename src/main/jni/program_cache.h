@@ -0,0 +1,65 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <GLES3/gl3.h>
+
+// Binaries larger than this are neither stored nor loaded
+#define PROGRAM_CACHE_MAX_BINARY (16 * 1024 * 1024)
+
+// Shader programs linked from source once and then loaded from disk.
+//
+// build() looks for "<directory>/<name>.program", written by an earlier
+// build() with glGetProgramBinary. The file is used only when it was made
+// from the same shader sources by the same driver: its key hashes the
+// sources with GL_VENDOR, GL_RENDERER and GL_VERSION. On any mismatch, or
+// when the driver rejects the binary, the program is compiled and the
+// file replaced. Without a directory, or when the driver has no binary
+// formats, programs are always compiled.
+//
+// Must be used on the thread that has the GL context current.
+class ProgramCache {
+
+public:
+    ProgramCache();
+    virtual ~ProgramCache();
+
+    // NULL or "" turns the cache off. The directory must exist.
+    void setDirectory(const char *directory);
+
+    // Returns a linked program, or 0 when the sources do not compile.
+    GLuint build(const char *name, const char *vertex_source, const char *fragment_source);
+
+    // programs loaded from disk and compiled since construction
+    unsigned hits() const { return _hits; }
+    unsigned misses() const { return _misses; }
+
+private:
+    char _directory[PATH_MAX];
+    unsigned _hits;
+    unsigned _misses;
+
+    uint64_t key(const char *vertex_source, const char *fragment_source);
+    bool path(const char *name, char *path, size_t size);
+    bool load(const char *path, uint64_t key, GLuint program);
+    void store(const char *path, uint64_t key, GLuint program);
+};
+
+#endif // PROGRAM_CACHE_H
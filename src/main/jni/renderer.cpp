@@ -23,19 +23,32 @@
 #include <EGL/eglext.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <GLES3/gl32.h>
 
 #include "logger.h"
+#include "pixel_kernels.h"
 #include "renderer.h"
+#include "dmabuf_exporter.h"
+#include "dmabuf_format.h"
+#include "trace.h"
 
 #define LOG_TAG "EglSample"
 
+// Consumer the producer dials on start
+static const char *SERVER_FILE = "/data/my_socket1";
+// Additional consumers subscribe here
+static const char *PRODUCER_FILE = "/data/my_socket_producer";
+// Frame stats are served here
+static const char *STATS_FILE = "/data/my_socket_stats";
+
 static GLint vertices[][3] = {
             { -0x10000, -0x10000, -0x10000 },
             {  0x10000, -0x10000, -0x10000 },
@@ -68,7 +81,7 @@ GLubyte indices[] = {
 };
 
 
-void gl_setup_scene()
+void gl_setup_scene(ProgramCache *programs)
 {
     // Shader source that draws a textures quad
     const char *vertex_shader_source = "#version 320 es\n"
@@ -95,61 +108,10 @@ void gl_setup_scene()
                                          "   FragColor = texture(Texture1, TexCoords);\n"
                                          "}\0";
 
-    // vertex shader
-    int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
-    GLint compiled;
-    glGetShaderiv(vertex_shader,GL_COMPILE_STATUS,&compiled);
-    if (!compiled) {
-        GLint infoLen = 0 ;
-        glGetShaderiv(vertex_shader,GL_INFO_LOG_LENGTH,&infoLen);
-        if (infoLen > 1){
-            char * infoLog = (char*)malloc(sizeof(char)*infoLen);
-            glGetShaderInfoLog(vertex_shader,infoLen,NULL,infoLog);
-            LOG_ERROR(" error compiled program \n %s \n",infoLog);
-            free(infoLog);
-            return ;
-        }
-    }
-    // fragment shader
-    int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
-    glGetShaderiv(fragment_shader,GL_COMPILE_STATUS,&compiled);
-    if (!compiled) {
-        GLint infoLen = 0 ;
-        glGetShaderiv(fragment_shader,GL_INFO_LOG_LENGTH,&infoLen);
-        if (infoLen > 1){
-            char * infoLog = (char*)malloc(sizeof(char)*infoLen);
-            glGetShaderInfoLog(fragment_shader,infoLen,NULL,infoLog);
-            LOG_ERROR(" error compiled fragment program \n %s \n",infoLog);
-            free(infoLog);
-            return ;
-        }
-    }
-    // link shaders
-    int shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex_shader);
-    glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program);
-    GLint linked;
-    glGetProgramiv(shader_program,GL_LINK_STATUS,&linked);
-    if (!linked) {
-        GLint infoLen = 0 ;
-        glGetProgramiv(shader_program,GL_INFO_LOG_LENGTH,&infoLen);
-        if (infoLen > 1){
-            char * infoLog = (char*)malloc(sizeof(char)*infoLen);
-            glGetProgramInfoLog(shader_program,infoLen,NULL,infoLog);
-            LOG_ERROR(" error linking program \n %s \n",infoLog);
-            free(infoLog);
-            return ;
-        }
-    }
-    // delete shaders
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-
+    GLuint shader_program = programs->build("scene", vertex_shader_source, fragment_shader_source);
+    if (!shader_program) {
+        return ;
+    }
 
     // quad
     float vertices[] = {
@@ -194,19 +156,56 @@ void gl_setup_scene()
     }
 }
 
-Renderer::Renderer()
-    : _msg(MSG_NONE), _display(0), _surface(0), _context(0), _angle(0)
+Renderer::Renderer(int buffer_count, enum swapchain_mode_t swapchain_mode,
+                   enum frame_memory_t frame_memory, enum render_target_t render_target)
+    : _overflow(0), _requested_window(WINDOW_UNCHANGED), _requested_size(0),
+      _requested_frame_size((uint64_t)DEFAULT_FRAME_WIDTH << 32 | DEFAULT_FRAME_HEIGHT),
+      _requested_budget(BUFFER_POOL_DEFAULT_BUDGET), _window(NULL),
+      _display(0), _surface(0), _context(0), _config(0), _idle_surface(EGL_NO_SURFACE), _current(false), _angle(0),
+      _frame_due(false), _redraw(false), _last_stats_ns(0), _last_frame_ns(0),
+      _frame_id(0), _frame_width(DEFAULT_FRAME_WIDTH), _frame_height(DEFAULT_FRAME_HEIGHT),
+      _buffer_count(buffer_count), _swapchain_mode(swapchain_mode), _display_buffer(0), _over_budget(false),
+      _frame_memory(frame_memory), _zero_copy(false), _linear(false),
+      _driver_fourcc(0), _driver_modifier(DMABUF_MOD_INVALID), _render_target(render_target), _source_texture(0),
+      _eglSwapBuffersWithDamage(0)
 {
     LOG_INFO("Renderer instance created");
-    texture_data    = create_data(TEXTURE_DATA_SIZE);
-    pthread_mutex_init(&_mutex, 0);
+    for (int i = 0; i < DMABUF_MAX_BUFFERS; i++) {
+        _textures[i] = 0;
+        _images[i] = EGL_NO_IMAGE_KHR;
+        _framebuffers[i] = 0;
+        _sent_frames[i] = 0;
+    }
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        _ring[i] = -1;
+        _fence_fds[i] = -1;
+        _fence_types[i] = DMABUF_FENCE_NONE;
+        _content_ns[i] = 0;
+        damage_region_clear(&_buffer_damage[i]);
+        damage_region_clear(&_frame_damage[i]);
+    }
+    damage_region_clear(&_pending_damage);
+    damage_region_set_full(&_surface_damage);
+    texture_data    = create_data(_frame_width, _frame_height);
+    _broadcaster.setLatency(&_latency);
+    _memory.setBudget(BUFFER_POOL_DEFAULT_BUDGET);
+    if (_scheduler.init()) {
+        _scheduler.setFrameRate(DEFAULT_FRAME_RATE);
+    }
     return;
 }
 
 Renderer::~Renderer()
 {
     LOG_INFO("Renderer instance destroyed");
-    pthread_mutex_destroy(&_mutex);
+    ANativeWindow *requested = _requested_window.exchange(WINDOW_UNCHANGED);
+    if (requested != WINDOW_UNCHANGED && requested) {
+        ANativeWindow_release(requested);
+    }
+    if (_window) {
+        ANativeWindow_release(_window);
+    }
+    free(texture_data);
     return;
 }
 
@@ -222,9 +221,8 @@ void Renderer::stop()
     LOG_INFO("Stopping renderer thread");
 
     // send message to render thread to stop rendering
-    pthread_mutex_lock(&_mutex);
-    _msg = MSG_RENDER_LOOP_EXIT;
-    pthread_mutex_unlock(&_mutex);    
+    post(RENDER_COMMAND_STOP);
+    _scheduler.wake();
 
     pthread_join(_threadId, 0);
     LOG_INFO("Renderer thread stopped");
@@ -232,296 +230,808 @@ void Renderer::stop()
     return;
 }
 
+void Renderer::post(enum render_command_type_t type, const struct dmabuf_rect_t *rect)
+{
+    struct render_command_t command;
+
+    memset(&command, 0, sizeof(command));
+    command.type = type;
+    if (rect) {
+        command.rect = *rect;
+    }
+    // A full queue still loses nothing: the flag stands for every command
+    // of its type, damage is widened to the whole texture.
+    if (!_commands.push(command)) {
+        _overflow.fetch_or(1u << type, std::memory_order_release);
+    }
+}
+
+void Renderer::addDamage(const struct dmabuf_rect_t *rects, int count)
+{
+    // picked up with the next frame, no need to wake the thread
+    for (int i = 0; i < count; i++) {
+        post(RENDER_COMMAND_DAMAGE, &rects[i]);
+    }
+}
+
+void Renderer::requestFrame()
+{
+    post(RENDER_COMMAND_TEXTURE_UPDATE);
+    _scheduler.wake();
+}
+
+void Renderer::setFrameRate(double fps)
+{
+    _scheduler.setFrameRate(fps);
+}
+
+void Renderer::setCacheDir(const char *directory)
+{
+    _program_cache.setDirectory(directory);
+}
+
+void Renderer::setFrameSize(int width, int height)
+{
+    if (width < 1 || height < 1) {
+        LOG_ERROR("frame size %dx%d ignored", width, height);
+        return;
+    }
+    _requested_frame_size.store((uint64_t)(uint32_t)width << 32 | (uint32_t)height, std::memory_order_release);
+    post(RENDER_COMMAND_FRAME_SIZE);
+    _scheduler.wake();
+}
+
+void Renderer::setMemoryBudget(size_t bytes)
+{
+    _requested_budget.store(bytes, std::memory_order_release);
+    post(RENDER_COMMAND_MEMORY_BUDGET);
+    _scheduler.wake();
+}
+
 void Renderer::setWindow(ANativeWindow *window)
 {
+    // The render thread gets its own reference, so the caller may release
+    // the window at any time. One not picked up yet is replaced.
+    if (window) {
+        ANativeWindow_acquire(window);
+    }
+    ANativeWindow *replaced = _requested_window.exchange(window, std::memory_order_acq_rel);
+    if (replaced != WINDOW_UNCHANGED && replaced) {
+        ANativeWindow_release(replaced);
+    }
+
     // notify render thread that window has changed
-    pthread_mutex_lock(&_mutex);
-    _msg = MSG_WINDOW_SET;
-    _window = window;
-    pthread_mutex_unlock(&_mutex);
+    post(RENDER_COMMAND_WINDOW_SET);
+    _scheduler.wake();
 
     return;
 }
 
+void Renderer::resize(int width, int height)
+{
+    _requested_size.store((uint64_t)(uint32_t)width << 32 | (uint32_t)height, std::memory_order_release);
+    post(RENDER_COMMAND_RESIZE);
+    _scheduler.wake();
+}
+
 
-int Renderer::create_socket(const char *path)
+void Renderer::renderLoop()
 {
-    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-    if (sock < 0 ) {
-        LOG_ERROR("create socket failed");
-        return -1;
+    bool renderingEnabled = true;
+    
+    LOG_INFO("renderLoop()");
+    // Offscreen there is no window to wait for, and a window kept from
+    // before stop() is drawn into again unless it went away meanwhile
+    set_requested_window(false);
+    if (_render_target == RENDER_TARGET_OFFSCREEN || _window) {
+        if (!initialize()) {
+            // destroy() left no display, so nothing below draws until a new
+            // window tries again
+            LOG_ERROR("initialize() failed, not drawing");
+        } else {
+            if (_window) {
+                create_window_surface();
+            }
+            watch_consumers();
+        }
     }
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, path);
-    unlink(path);
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-    {
-        exit(-1);
+    while (renderingEnabled) {
+        struct scheduler_events_t events;
+
+        // eventfd fences are signalled by polling their GL fence, the only
+        // thing that cannot wake us up besides redialing the consumer
+        int timeout = -1;
+        if (_fences.hasPending()) {
+            timeout = 1;
+        } else if (_display && _current) {
+            timeout = _broadcaster.dialTimeoutMs();
+        }
+        if (!_scheduler.wait(timeout, &events)) {
+            _broadcaster.close();
+            destroy();
+            break;
+        }
+
+        // process incoming messages
+        renderingEnabled = process_commands();
+        if (!renderingEnabled) {
+            continue;
+        }
+        if (events.frames_due) {
+            _frame_due = true;
+        }
+        if (events.io_ready) {
+            _stats_server.serve(format_stats, this);
+        }
+        if (_display && _current) {
+            _gpu_timer.poll();
+            _fences.signalCompleted();
+            process_releases();
+            if (_broadcaster.takeFormatsChanged() && !check_formats()) {
+                destroy();
+                continue;
+            }
+            present_pending();
+            account_memory();
+
+            // A frame that found no free buffer is retried once a consumer
+            // releases one
+            if (_frame_due && update_shared_buffer()) {
+                _frame_due = false;
+                _redraw = _render_target == RENDER_TARGET_WINDOW && _surface != EGL_NO_SURFACE;
+
+                uint64_t now = scheduler_now_ns();
+                if (now - _last_stats_ns >= 1000000000ULL) {
+                    struct swapchain_stats_t stats = _swapchain.stats();
+                    struct scheduler_stats_t pacing = _scheduler.stats();
+                    LOG_INFO("draw scene, frames queued %llu presented %llu dropped %llu stalls %llu "
+                             "wakeups %llu missed %llu",
+                             (unsigned long long)stats.queued, (unsigned long long)stats.presented,
+                             (unsigned long long)stats.dropped, (unsigned long long)stats.stalls,
+                             (unsigned long long)pacing.wakeups, (unsigned long long)pacing.frames_missed);
+                    _last_stats_ns = now;
+                }
+            }
+            if (_redraw) {
+                {
+                    StageTimer timer(&_frame_stats, FRAME_STAGE_DRAW);
+                    _gpu_timer.begin(FRAME_STAGE_GPU_DRAW);
+                    gl_draw_scene(_textures[_ring[_display_buffer]]);
+                    _gpu_timer.end();
+                }
+                StageTimer timer(&_frame_stats, FRAME_STAGE_SWAP);
+                if (!swap_buffers()) {
+                    LOG_ERROR("eglSwapBuffers() returned error %d", eglGetError());
+                }
+                _redraw = false;
+            }
+            watch_consumers();
+        }
     }
+    
+    LOG_INFO("Render loop exits");
+    
+    return;
+}
 
-    return sock;
+bool Renderer::process_commands()
+{
+    struct render_command_t command;
+
+    // Only whether a command came matters, not how often
+    uint32_t pending = _overflow.exchange(0, std::memory_order_acquire);
+    if (pending & (1u << RENDER_COMMAND_DAMAGE)) {
+        damage_region_set_full(&_pending_damage);
+    }
+    while (_commands.pop(&command)) {
+        if (command.type == RENDER_COMMAND_DAMAGE) {
+            damage_region_add(&_pending_damage, &command.rect);
+        }
+        pending |= 1u << command.type;
+    }
+
+    // Whatever else is pending is moot once we stop
+    if (pending & (1u << RENDER_COMMAND_STOP)) {
+        set_requested_window(false);
+        _broadcaster.close();
+        _stats_server.close();
+        destroy();
+        return false;
+    }
+    if (pending & (1u << RENDER_COMMAND_WINDOW_SET)) {
+        // a new window comes with its own size
+        set_requested_window(true);
+    } else if ((pending & (1u << RENDER_COMMAND_RESIZE)) && _surface != EGL_NO_SURFACE) {
+        resize_surface();
+    }
+    if ((pending & (1u << RENDER_COMMAND_FRAME_SIZE)) && !resize_frames()) {
+        // as if initialize() had failed
+        destroy();
+    }
+    if (pending & (1u << RENDER_COMMAND_MEMORY_BUDGET)) {
+        size_t budget = _requested_budget.load(std::memory_order_acquire);
+        _pool.setBudget(budget);
+        _memory.setBudget(budget);
+        _over_budget = false;
+        if (_display) {
+            enforce_budget();
+        }
+    }
+    if (pending & (1u << RENDER_COMMAND_TEXTURE_UPDATE)) {
+        _frame_due = true;
+    }
+    return true;
 }
 
-int Renderer::connect_socket(int sock, const char *path)
+void Renderer::set_requested_window(bool draw)
 {
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, path);
-    return connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+    ANativeWindow *window = _requested_window.exchange(WINDOW_UNCHANGED, std::memory_order_acq_rel);
+    if (window == WINDOW_UNCHANGED) {
+        return;
+    }
+    // offscreen frames are never shown
+    if (_render_target == RENDER_TARGET_OFFSCREEN) {
+        if (window) {
+            ANativeWindow_release(window);
+        }
+        return;
+    }
+    if (window && window == _window && _surface != EGL_NO_SURFACE) {
+        // the window we draw into again, only its size may differ
+        ANativeWindow_release(window);
+        if (draw) {
+            update_viewport();
+        }
+        return;
+    }
+
+    // Only the surface goes; the context, the buffers and the consumers
+    // stay as they are
+    if (_display) {
+        destroy_window_surface();
+    }
+    if (_window) {
+        ANativeWindow_release(_window);
+    }
+    _window = window;
+    if (!draw || !_window || (!_display && !initialize())) {
+        return;
+    }
+    create_window_surface();
+}
+
+bool Renderer::create_window_surface()
+{
+    TRACE_SCOPE("create_window_surface");
+    uint64_t start = scheduler_now_ns();
+    EGLint format;
+
+    if (eglGetConfigAttrib(_display, _config, EGL_NATIVE_VISUAL_ID, &format)) {
+        ANativeWindow_setBuffersGeometry(_window, 0, 0, format);
+    }
+    EGLSurface surface;
+    {
+        TRACE_SCOPE("eglCreateWindowSurface");
+        surface = eglCreateWindowSurface(_display, _config, _window, 0);
+    }
+    if (surface == EGL_NO_SURFACE) {
+        LOG_ERROR("eglCreateWindowSurface() returned error %d", eglGetError());
+        return false;
+    }
+    if (!eglMakeCurrent(_display, surface, surface, _context)) {
+        LOG_ERROR("eglMakeCurrent() returned error %d", eglGetError());
+        eglDestroySurface(_display, surface);
+        make_current_idle();
+        return false;
+    }
+    _surface = surface;
+    _current = true;
+    update_viewport();
+    LOG_INFO("window surface created in %llu us", (unsigned long long)(scheduler_now_ns() - start) / 1000);
+    return true;
 }
 
-void Renderer::write_fd(int sock, int fd, void *data, size_t data_len)
+void Renderer::destroy_window_surface()
 {
-    struct msghdr msg = {0};
-    char buf[CMSG_SPACE(sizeof(fd))];
-    memset(buf, '\0', sizeof(buf));
+    if (_surface == EGL_NO_SURFACE) {
+        return;
+    }
+    make_current_idle();
+    eglDestroySurface(_display, _surface);
+    _surface = EGL_NO_SURFACE;
+}
 
-    struct iovec io = {.iov_base = data, .iov_len = data_len};
+bool Renderer::make_current_idle()
+{
+    // Frames for the consumers go on without a window
+    _current = eglMakeCurrent(_display, _idle_surface, _idle_surface, _context);
+    if (!_current) {
+        LOG_ERROR("cannot keep the context current without a window %x", eglGetError());
+        eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    return _current;
+}
 
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_control = buf;
-    msg.msg_controllen = sizeof(buf);
+void Renderer::update_viewport()
+{
+    EGLint width, height;
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+    if (!eglQuerySurface(_display, _surface, EGL_WIDTH, &width) ||
+        !eglQuerySurface(_display, _surface, EGL_HEIGHT, &height)) {
+        LOG_ERROR("eglQuerySurface() returned error %d", eglGetError());
+        return;
+    }
+    LOG_INFO("%d width %d height", width, height);
+    glViewport(0, 0, width, height);
+    damage_region_set_full(&_surface_damage);
+    _redraw = true;
+}
 
-    memmove(CMSG_DATA(cmsg), &fd, sizeof(fd));
+void Renderer::resize_surface()
+{
+    uint64_t size = _requested_size.load(std::memory_order_acquire);
+    GLsizei width = (GLsizei)(size >> 32);
+    GLsizei height = (GLsizei)(size & 0xffffffff);
+
+    LOG_INFO("%d width %d height", width, height);
+    glViewport(0, 0, width, height);
+    damage_region_set_full(&_surface_damage);
+    _redraw = true;
+}
 
-    msg.msg_controllen = CMSG_SPACE(sizeof(fd));
+void Renderer::watch_consumers()
+{
+    struct pollfd fds[BROADCAST_MAX_CONSUMERS + 2];
+
+    int count = _broadcaster.pollFds(fds, BROADCAST_MAX_CONSUMERS + 1);
+    if (_stats_server.fd() >= 0) {
+        fds[count].fd = _stats_server.fd();
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        count++;
+    }
+    _scheduler.watch(fds, count);
+}
 
-    if (sendmsg(sock, &msg, 0) < 0)
-    {
-        exit(-1);
+size_t Renderer::formatStats(char *buffer, size_t size) const
+{
+    struct swapchain_stats_t stats = _swapchain.stats();
+    struct scheduler_stats_t pacing = _scheduler.stats();
+
+    // every counter is atomic, but they are read one by one and may be a
+    // frame apart
+    int length = snprintf(buffer, size,
+                          "frames queued %llu presented %llu dropped %llu stalls %llu missed %llu\n"
+                          "stage count mean_us p50_us p95_us p99_us max_us\n",
+                          (unsigned long long)stats.queued, (unsigned long long)stats.presented,
+                          (unsigned long long)stats.dropped, (unsigned long long)stats.stalls,
+                          (unsigned long long)pacing.frames_missed);
+    if (length < 0 || (size_t)length >= size) {
+        return size ? strlen(buffer) : 0;
     }
+    length += _frame_stats.format(buffer + length, size - length);
+    length += _latency.format(buffer + length, size - length);
+    return length + _memory.format(buffer + length, size - length);
 }
 
-void Renderer::read_fd(int sock, int *fd, void *data, size_t data_len)
+size_t Renderer::format_stats(void *renderer, char *buffer, size_t size)
 {
-    struct msghdr msg = {0};
+    return ((Renderer *)renderer)->formatStats(buffer, size);
+}
+
+
+
+bool Renderer::update_shared_buffer()
+{
+    // Only write into a buffer the consumer is not reading from
+    int id = _swapchain.dequeue();
+    if (id < 0) {
+        return false;
+    }
 
-    struct iovec io = {.iov_base = data, .iov_len = data_len};
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
+    // a fence of a frame that was dropped before being sent
+    if (_fence_fds[id] >= 0) {
+        close(_fence_fds[id]);
+        _fence_fds[id] = -1;
+    }
 
-    char c_buffer[256];
-    msg.msg_control = c_buffer;
-    msg.msg_controllen = sizeof(c_buffer);
+    uint64_t start = scheduler_now_ns();
+    if (_last_frame_ns) {
+        _frame_stats.record(FRAME_STAGE_INTERVAL, start - _last_frame_ns);
+    }
+    _last_frame_ns = start;
+
+    if (_zero_copy) {
+        // The frame is written where the GPU and the consumers read it
+        StageTimer timer(&_frame_stats, FRAME_STAGE_GENERATE);
+        if (!generate_shared_frame(id)) {
+            _swapchain.release(id);
+            return false;
+        }
+    } else if (_render_target == RENDER_TARGET_OFFSCREEN) {
+        {
+            StageTimer timer(&_frame_stats, FRAME_STAGE_GENERATE);
+            rotate_data();
+        }
 
-    if (recvmsg(sock, &msg, 0) < 0)
+        // The one source texture only misses what changed since the last
+        // frame
+        {
+            StageTimer timer(&_frame_stats, FRAME_STAGE_UPLOAD);
+            _gpu_timer.begin(FRAME_STAGE_GPU_UPLOAD);
+            upload_texture(_source_texture, &_pending_damage);
+            _gpu_timer.end();
+        }
+        draw_offscreen(id);
+        // the scene is drawn whole into the buffer
+        damage_region_set_full(&_pending_damage);
+    } else {
+        {
+            StageTimer timer(&_frame_stats, FRAME_STAGE_GENERATE);
+            rotate_data();
+        }
+
+        // The buffer also misses whatever changed while it was away
+        for (int i = 0; i < _buffer_count; i++) {
+            damage_region_union(&_buffer_damage[i], &_pending_damage);
+        }
+        StageTimer timer(&_frame_stats, FRAME_STAGE_UPLOAD);
+        _gpu_timer.begin(FRAME_STAGE_GPU_UPLOAD);
+        upload_texture(_textures[_ring[id]], &_buffer_damage[id]);
+        _gpu_timer.end();
+        damage_region_clear(&_buffer_damage[id]);
+    }
+
+    // The consumer waits on this fence rather than us waiting on the GPU
+    _content_ns[id] = scheduler_now_ns();
     {
-        exit(-1);
+        StageTimer timer(&_frame_stats, FRAME_STAGE_EXPORT);
+        _fence_fds[id] = _fences.createFence(&_fence_types[id]);
+        if (_fence_fds[id] < 0) {
+            // consumers read unfenced frames right away
+            glFinish();
+        }
+    }
+
+    // Frames replaced before being sent pass their damage on to this one;
+    // a buffer taken back from the pending queue still carries its own.
+    bool was_pending[SWAPCHAIN_MAX_BUFFERS];
+    for (int i = 0; i < _buffer_count; i++) {
+        was_pending[i] = i != id && _swapchain.state(i) == SWAPCHAIN_BUFFER_PENDING;
+    }
+    damage_region_union(&_frame_damage[id], &_pending_damage);
+    _swapchain.queue(id);
+    for (int i = 0; i < _buffer_count; i++) {
+        if (was_pending[i] && _swapchain.state(i) != SWAPCHAIN_BUFFER_PENDING) {
+            damage_region_union(&_frame_damage[id], &_frame_damage[i]);
+            damage_region_clear(&_frame_damage[i]);
+        }
     }
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    damage_region_union(&_surface_damage, &_pending_damage);
+    damage_region_clear(&_pending_damage);
+    _display_buffer = id;
+    present_pending();
+    return true;
+}
 
-    memmove(fd, CMSG_DATA(cmsg), sizeof(fd));
+void Renderer::upload_texture(GLuint texture, const struct damage_region_t *damage)
+{
+    TRACE_SCOPE("upload_texture");
+    struct dmabuf_rect_t rects[DMABUF_MAX_DAMAGE_RECTS];
+    int count = damage_region_rects(damage, _frame_width, _frame_height, rects);
+
+    // The GPU copies from the unpack buffer while we go on drawing
+    if (count == 0 || _uploader.upload(texture, texture_data, rects, count)) {
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, _frame_width);
+    for (int i = 0; i < count; i++) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+                        GL_RGBA, GL_UNSIGNED_BYTE,
+                        texture_data + rects[i].y * _frame_width + rects[i].x);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
+bool Renderer::generate_shared_frame(int id)
+{
+    TRACE_SCOPE("generate_shared_frame");
+    const struct pixel_kernels_t *kernels = pixel_kernels_get();
+    SharedBuffer *dst_buffer = &_shared_buffers[_ring[id]];
+    SharedBuffer *src_buffer = &_shared_buffers[_ring[_display_buffer]];
+
+    uint32_t *dst = dst_buffer->lock(id == _display_buffer ? DMABUF_ACCESS_READ_WRITE : DMABUF_ACCESS_WRITE);
+    if (!dst) {
+        return false;
+    }
+    if (id == _display_buffer) {
+        kernels->rotate_quadrants(dst, _frame_width, _frame_height, dst_buffer->stride());
+        dst_buffer->unlock();
+        damage_region_set_full(&_pending_damage);
+        return true;
+    }
+    // The consumer may be reading the previous frame too, which is fine
+    // as neither of us writes it.
+    const uint32_t *src = src_buffer->lock(DMABUF_ACCESS_READ);
+    if (!src) {
+        dst_buffer->unlock();
+        return false;
+    }
 
+    // The next frame is the previous one with its quadrants rotated, moved
+    // quadrant by quadrant into the new buffer. An odd middle row and
+    // column stay put.
+    size_t src_stride = src_buffer->stride() * 4;
+    size_t dst_stride = dst_buffer->stride() * 4;
+    uint32_t half_width = _frame_width / 2;
+    uint32_t half_height = _frame_height / 2;
+    uint32_t right = _frame_width - half_width;
+    uint32_t bottom = _frame_height - half_height;
+    const uint32_t *src_tl = src;
+    const uint32_t *src_tr = src + right;
+    const uint32_t *src_bl = src + (size_t)bottom * src_buffer->stride();
+    const uint32_t *src_br = src_bl + right;
+    uint32_t *dst_tl = dst;
+    uint32_t *dst_tr = dst + right;
+    uint32_t *dst_bl = dst + (size_t)bottom * dst_buffer->stride();
+    uint32_t *dst_br = dst_bl + right;
+    size_t quadrant_bytes = half_width * 4;
+
+    kernels->copy(dst_tl, dst_stride, src_tr, src_stride, quadrant_bytes, half_height);
+    kernels->copy(dst_tr, dst_stride, src_br, src_stride, quadrant_bytes, half_height);
+    kernels->copy(dst_br, dst_stride, src_bl, src_stride, quadrant_bytes, half_height);
+    kernels->copy(dst_bl, dst_stride, src_tl, src_stride, quadrant_bytes, half_height);
+    if (right != half_width) {
+        kernels->copy(dst + half_width, dst_stride, src + half_width, src_stride, 4, _frame_height);
+    }
+    if (bottom != half_height) {
+        kernels->copy(dst + (size_t)half_height * dst_buffer->stride(), dst_stride,
+                      src + (size_t)half_height * src_buffer->stride(), src_stride,
+                      _frame_width * 4, 1);
+    }
 
+    src_buffer->unlock();
+    dst_buffer->unlock();
 
-void Renderer::renderLoop()
+    // every quadrant moves
+    damage_region_set_full(&_pending_damage);
+    return true;
+}
+
+void Renderer::draw_offscreen(int id)
 {
-    bool renderingEnabled = true;
-    
-    LOG_INFO("renderLoop()");
-    time_t last_time = time(NULL);
-    while (renderingEnabled) {
+    StageTimer timer(&_frame_stats, FRAME_STAGE_DRAW);
+    _gpu_timer.begin(FRAME_STAGE_GPU_DRAW);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[_ring[id]]);
+    glViewport(0, 0, _frame_width, _frame_height);
+    gl_draw_scene(_source_texture);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    _gpu_timer.end();
+}
 
-        pthread_mutex_lock(&_mutex);
+bool Renderer::swap_buffers()
+{
+    TRACE_SCOPE("eglSwapBuffers");
+    EGLint width, height;
 
-        // process incoming messages
-        switch (_msg) {
+    if (!_eglSwapBuffersWithDamage ||
+        !eglQuerySurface(_display, _surface, EGL_WIDTH, &width) ||
+        !eglQuerySurface(_display, _surface, EGL_HEIGHT, &height)) {
+        return eglSwapBuffers(_display, _surface);
+    }
 
-            case MSG_WINDOW_SET:
-                initialize();
-                break;
+    // The texture is drawn on a quad covering the middle half of the
+    // surface; EGL rects have their origin at the bottom left.
+    struct dmabuf_rect_t rects[DMABUF_MAX_DAMAGE_RECTS];
+    int count = damage_region_rects(&_surface_damage, _frame_width, _frame_height, rects);
+    EGLint egl_rects[DMABUF_MAX_DAMAGE_RECTS * 4];
+    EGLint frame_width = _frame_width;
+    EGLint frame_height = _frame_height;
+    for (int i = 0; i < count; i++) {
+        EGLint x0 = width / 4 + rects[i].x * width / (2 * frame_width);
+        EGLint x1 = width / 4 + ((rects[i].x + rects[i].width) * width + 2 * frame_width - 1) /
+                    (2 * frame_width);
+        EGLint top = height * 3 / 4 - rects[i].y * height / (2 * frame_height);
+        EGLint bottom = height * 3 / 4 - ((rects[i].y + rects[i].height) * height + 2 * frame_height - 1) /
+                        (2 * frame_height);
+        egl_rects[i * 4 + 0] = x0;
+        egl_rects[i * 4 + 1] = bottom;
+        egl_rects[i * 4 + 2] = x1 - x0;
+        egl_rects[i * 4 + 3] = top - bottom;
+    }
+    if (count == 0) {
+        // nothing changed; n_rects 0 would mean the whole surface
+        memset(egl_rects, 0, sizeof(EGLint) * 4);
+        count = 1;
+    }
 
-            case MSG_RENDER_LOOP_EXIT:
-                renderingEnabled = false;
-                destroy();
-                break;
+    damage_region_clear(&_surface_damage);
+    return _eglSwapBuffersWithDamage(_display, _surface, egl_rects, count);
+}
 
-            default:
-                break;
+void Renderer::present_pending()
+{
+    int id;
+    while ((id = _swapchain.acquireNext()) >= 0) {
+        uint64_t frame_id = _frame_id++;
+        TRACE_FRAME_SCOPE("present", frame_id);
+        uint64_t start = scheduler_now_ns();
+        struct dmabuf_frame_timing_t timing;
+        timing.content_ns = _content_ns[id];
+        timing.send_ns = start;
+        // only known when the GPU is done already, nothing waits for it here
+        timing.gpu_done_ns = _fence_fds[id] >= 0 && sync_fence_wait(_fence_fds[id], 0) ? start : 0;
+        int holders = _broadcaster.broadcastFrame(_ring[id], frame_id, _fence_fds[id], _fence_types[id],
+                                                  &_frame_damage[id], &timing);
+        _frame_stats.record(FRAME_STAGE_SEND, scheduler_now_ns() - start);
+        // Nobody took the frame, it is immediately ours again
+        if (holders == 0) {
+            _swapchain.release(id);
+        } else {
+            TRACE_ASYNC_BEGIN("frame", frame_id);
+            _sent_frames[_ring[id]] = frame_id;
         }
-        _msg = MSG_NONE;
-        if (_display) {
-            gl_draw_scene();
-//            drawFrame( &cur_time);
-            if (!eglSwapBuffers(_display, _surface)) {
-                LOG_ERROR("eglSwapBuffers() returned error %d", eglGetError());
-            }
-            time_t  cur_time =   time(NULL);
-            if (last_time < cur_time)
-            {
-                LOG_INFO("draw scene");
-                last_time = cur_time;
-                rotate_data();
-                glBindTexture(GL_TEXTURE_2D, texture);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_DATA_WIDTH, TEXTURE_DATA_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, texture_data);
-            }
+        damage_region_clear(&_frame_damage[id]);
+        if (_fence_fds[id] >= 0) {
+            close(_fence_fds[id]);
+            _fence_fds[id] = -1;
         }
-        
-        pthread_mutex_unlock(&_mutex);
     }
-    
-    LOG_INFO("Render loop exits");
-    
-    return;
 }
 
+void Renderer::process_releases()
+{
+    uint32_t ids[DMABUF_MAX_BUFFERS];
+
+    _broadcaster.poll();
+    int count = _broadcaster.receiveReleases(ids, DMABUF_MAX_BUFFERS);
+    bool released = false;
+    for (int i = 0; i < count; i++) {
+        TRACE_ASYNC_END("frame", _sent_frames[ids[i]]);
+        int slot = 0;
+        while (slot < _buffer_count && _ring[slot] != (int)ids[i]) {
+            slot++;
+        }
+        if (slot < _buffer_count) {
+            _swapchain.release(slot);
+        } else {
+            // left the ring while a consumer still read from it
+            _pool.release(ids[i]);
+            released = true;
+        }
+    }
+    // what was kept for the consumer alone may have to go now
+    if (released) {
+        enforce_budget();
+    }
+}
 
-
-int* Renderer::create_data(size_t size)
+int* Renderer::create_data(size_t width, size_t height)
 {
-    size_t edge = sqrt(size);
-    size_t half_edge = edge / 2;
+    const struct pixel_kernels_t *kernels = pixel_kernels_get();
+    size_t half_width = width / 2;
+    size_t half_height = height / 2;
 
-    int* data = (int *)malloc(size * sizeof(int));
+    uint32_t *data = (uint32_t *)malloc(width * height * sizeof(uint32_t));
 
     // Paint the texture like so:
     // RG
     // BW
     // where R - red, G - green, B - blue, W - white
-    int red = 0x000000FF;
-    int green = 0x0000FF00;
-    int blue = 0X00FF0000;
-    int white = 0x00FFFFFF;
-    for (size_t i = 0; i < size; i++) {
-        size_t x = i % edge;
-        size_t y = i / edge;
-
-        if (x < half_edge) {
-            if (y < half_edge) {
-                data[i] = red;
-            } else {
-                data[i] = blue;
-            }
-        } else {
-            if (y < half_edge) {
-                data[i] = green;
-            } else {
-                data[i] = white;
-            }
-        }
-    }
-
-    return data;
+    uint32_t red = 0x000000FF;
+    uint32_t green = 0x0000FF00;
+    uint32_t blue = 0X00FF0000;
+    uint32_t white = 0x00FFFFFF;
+    uint32_t *bottom = data + half_height * width;
+    kernels->fill(data, half_width, half_height, width, red);
+    kernels->fill(data + half_width, width - half_width, half_height, width, green);
+    kernels->fill(bottom, half_width, height - half_height, width, blue);
+    kernels->fill(bottom + half_width, width - half_width, height - half_height, width, white);
+
+    return (int *)data;
 }
 
 void Renderer::rotate_data()
 {
-    size_t  size =  TEXTURE_DATA_SIZE;
-    int *data = texture_data;
-    size_t edge = sqrt(size);
-    size_t half_edge = edge / 2;
+    pixel_kernels_get()->rotate_quadrants((uint32_t *)texture_data, _frame_width,
+                                          _frame_height, _frame_width);
 
-    for (size_t i = 0; i < half_edge * half_edge; i++) {
-        size_t x = i % half_edge;
-        size_t y = i / half_edge;
-
-        int temp = data[x + y * edge];
-        data[x + y * edge] = data[(x + half_edge) + y * edge];
-        data[(x + half_edge) + y * edge] = data[(x + half_edge) + (y + half_edge) * edge];
-        data[(x + half_edge) + (y + half_edge) * edge] = data[x + (y + half_edge) * edge];
-        data[x + (y + half_edge) * edge] = temp;
-    }
+    // every quadrant moves
+    damage_region_set_full(&_pending_damage);
 }
 
 bool Renderer::initialize()
 {
-    const EGLint attribs[] = {
-        EGL_SURFACE_TYPE,EGL_WINDOW_BIT,
+    // Without a window the context stays current on a pbuffer, unless
+    // EGL_KHR_surfaceless_context lets it go without any surface
+    EGLint window_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT | EGL_PBUFFER_BIT,
+        EGL_BLUE_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_RED_SIZE, 8,
+        EGL_NONE
+    };
+    const EGLint offscreen_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
         EGL_BLUE_SIZE, 8,
         EGL_GREEN_SIZE, 8,
         EGL_RED_SIZE, 8,
         EGL_NONE
     };
+    const EGLint *attribs = _render_target == RENDER_TARGET_OFFSCREEN ? offscreen_attribs : window_attribs;
     EGLDisplay display;
     EGLConfig config;    
-    EGLint numConfigs;
-    EGLint format;
-    EGLSurface surface;
+    EGLint numConfigs = 0;
     EGLContext context;
-    EGLint width;
-    EGLint height;
-    GLfloat ratio;
     
+    TRACE_SCOPE("initialize");
     LOG_INFO("Initializing context");
 //    eglBindAPI(EGL_OPENGL_API);
     if ((display = eglGetDisplay(EGL_DEFAULT_DISPLAY)) == EGL_NO_DISPLAY) {
         LOG_ERROR("eglGetDisplay() returned error %d", eglGetError());
         return false;
     }
-    if (!eglInitialize(display, 0, 0)) {
-        LOG_ERROR("eglInitialize() returned error %d", eglGetError());
-        return false;
+    {
+        TRACE_SCOPE("eglInitialize");
+        if (!eglInitialize(display, 0, 0)) {
+            LOG_ERROR("eglInitialize() returned error %d", eglGetError());
+            return false;
+        }
     }
+    _display = display;
 
-    if (!eglChooseConfig(display, attribs, &config, 1, &numConfigs)) {
-        LOG_ERROR("eglChooseConfig() returned error %d", eglGetError());
-        destroy();
-        return false;
+    if (eglChooseConfig(display, attribs, &config, 1, &numConfigs) && numConfigs < 1 &&
+        _render_target == RENDER_TARGET_WINDOW) {
+        // some drivers have no config for both; surfaceless contexts do
+        // without the pbuffer
+        window_attribs[1] = EGL_WINDOW_BIT;
+        eglChooseConfig(display, attribs, &config, 1, &numConfigs);
     }
-
-    if (!eglGetConfigAttrib(display, config, EGL_NATIVE_VISUAL_ID, &format)) {
-        LOG_ERROR("eglGetConfigAttrib() returned error %d", eglGetError());
+    if (numConfigs < 1) {
+        LOG_ERROR("eglChooseConfig() returned error %d", eglGetError());
         destroy();
         return false;
     }
-    LOG_INFO("%d format \n",format);
-    ANativeWindow_setBuffersGeometry(_window, 0, 0, format);
-
+    _config = config;
 
     EGLint const attrib_list[] = {
 //            EGL_CONTEXT_MAJOR_VERSION,3,
 //            EGL_CONTEXT_MINOR_VERSION,2,
             EGL_CONTEXT_CLIENT_VERSION, 3,
             EGL_NONE};
-    context =  eglCreateContext(display, config, EGL_NO_CONTEXT, attrib_list);
+    {
+        TRACE_SCOPE("eglCreateContext");
+        context =  eglCreateContext(display, config, EGL_NO_CONTEXT, attrib_list);
+    }
     if (context == EGL_NO_CONTEXT) {
         LOG_ERROR("eglCreateContext() returned error %x", eglGetError());
         destroy();
         return false;
     }
+    _context = context;
 
-    if (!(surface = eglCreateWindowSurface(display, config, _window, 0))) {
-        LOG_ERROR("eglCreateWindowSurface() returned error %d", eglGetError());
-        destroy();
-        return false;
+    const char *egl_extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!egl_extensions || !strstr(egl_extensions, "EGL_KHR_surfaceless_context")) {
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        _idle_surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+        if (_idle_surface == EGL_NO_SURFACE) {
+            LOG_ERROR("eglCreatePbufferSurface() returned error %d", eglGetError());
+            destroy();
+            return false;
+        }
     }
-    
-    if (!eglMakeCurrent(display, surface, surface, context)) {
-        LOG_ERROR("eglMakeCurrent() returned error %d", eglGetError());
+    // A window surface is made current once there is one
+    if (!make_current_idle()) {
         destroy();
         return false;
     }
+    _gpu_timer.init(&_frame_stats);
+    _stats_server.listen(STATS_FILE);
 
-    if (!eglQuerySurface(display, surface, EGL_WIDTH, &width) ||
-        !eglQuerySurface(display, surface, EGL_HEIGHT, &height)) {
-        LOG_ERROR("eglQuerySurface() returned error %d", eglGetError());
-        destroy();
-        return false;
-    }
-    LOG_INFO("%d width %d height",width,height);
-    _display = display;
-    _surface = surface;
-    _context = context;
-
-    gl_setup_scene();
-    glGenTextures(1, &texture);
-    EGLint err = glGetError();
-    if (err != GL_NO_ERROR) {
-        LOG_ERROR("error happened tex bind parameteri %08X \n",err);
-        return false;
-    }
+    gl_setup_scene(&_program_cache);
 
 //
 //    glDisable(GL_DITHER);
@@ -538,35 +1048,437 @@ bool Renderer::initialize()
 //    glLoadIdentity();
 //    glFrustumf(-ratio, ratio, -1, 1, 1, 10);
 
+    const char* version = eglQueryString(display, EGL_VERSION);
+    EGLint err = eglGetError();
+    if (err !=EGL_SUCCESS) {
+        LOG_ERROR("error happened tex parameteri %08X \n",err);
+        destroy();
+        return false;
+    }
+    LOG_INFO("%s", version);
 
+    // Each consumer's session limits the frames it holds; a shared limit
+    // here would let one slow consumer stall all the others
+    if (!_swapchain.init(_buffer_count, _swapchain_mode, _buffer_count - 1)) {
+        destroy();
+        return false;
+    }
+    _fences.init(display);
+
+    if (egl_extensions && strstr(egl_extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        _eglSwapBuffersWithDamage =
+                (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (egl_extensions && strstr(egl_extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        _eglSwapBuffersWithDamage =
+                (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        damage_region_clear(&_buffer_damage[i]);
+        damage_region_clear(&_frame_damage[i]);
+    }
+    damage_region_set_full(&_surface_damage);
+    if (!_uploader.init(_frame_width, _frame_height)) {
+        LOG_INFO("pixel buffer uploads unavailable, uploading from client memory");
+    }
+    if (_render_target == RENDER_TARGET_OFFSCREEN && !create_source_texture()) {
+        destroy();
+        return false;
+    }
 
-
-    const char *SERVER_FILE = "/data/my_socket1";
-    const char *CLIENT_FILE = "/data/test_client";
-    // Custom image storage data description to transfer over socket
-    struct texture_storage_metadata_t
+#ifdef UPLOAD_BENCHMARK
+    struct upload_benchmark_result_t results[8];
+    texture_upload_benchmark(30, results, 8);
+#endif
+
+    // Every buffer of the ring is exported and the whole ring is registered
+    // with one sendmsg. The consumer keeps its own reference to each dma-buf;
+    // subsequent frames only send FRAME_READY. The GPU writes offscreen
+    // frames, there is nothing to share with it.
+    _zero_copy = _frame_memory == FRAME_MEMORY_SHARED && _render_target == RENDER_TARGET_WINDOW;
+    _pool.setBudget(_requested_budget.load(std::memory_order_acquire));
+    bool created = create_ring();
+    if (!created && _zero_copy) {
+        LOG_INFO("shared frame memory unavailable, uploading frames");
+        destroy_buffers();
+        _zero_copy = false;
+        created = create_ring();
+    }
+    if (!created) {
+        destroy();
+        return false;
+    }
     {
-        int fourcc;
-        EGLuint64KHR modifiers;
-        EGLint stride;
-        EGLint offset;
-    };
+        TRACE_SCOPE("connect_consumers");
+        _broadcaster.listen(PRODUCER_FILE);
+        // the server may come and go, it is dialed again while nobody is
+        // connected
+        _broadcaster.dial(SERVER_FILE);
+    }
+    _display_buffer = 0;
+
+    return true;
+}
+
+bool Renderer::resize_frames()
+{
+    uint64_t size = _requested_frame_size.load(std::memory_order_acquire);
+    uint32_t width = (uint32_t)(size >> 32);
+    uint32_t height = (uint32_t)(size & 0xffffffff);
+
+    if (width == _frame_width && height == _frame_height) {
+        return true;
+    }
+    if (_display) {
+        GLint max_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        if (width > (uint32_t)max_size || height > (uint32_t)max_size) {
+            LOG_ERROR("frame size %ux%u above the GL limit %d, keeping %ux%u",
+                      width, height, max_size, _frame_width, _frame_height);
+            return true;
+        }
+    }
+    TRACE_SCOPE("resize_frames");
+    uint64_t start = scheduler_now_ns();
+    uint64_t reused = _pool.stats().reused;
+
+    free(texture_data);
+    texture_data = create_data(width, height);
+    _frame_width = width;
+    _frame_height = height;
+    damage_region_set_full(&_pending_damage);
+    damage_region_set_full(&_surface_damage);
+    if (!_display) {
+        // initialize() starts out at the new size
+        return true;
+    }
+
+    if (!_uploader.init(_frame_width, _frame_height)) {
+        LOG_INFO("pixel buffer uploads unavailable, uploading from client memory");
+    }
+    if (_source_texture) {
+        glDeleteTextures(1, &_source_texture);
+        _source_texture = 0;
+        if (!create_source_texture()) {
+            return false;
+        }
+    }
+    if (!recreate_ring()) {
+        return false;
+    }
+    LOG_INFO("frames resized to %ux%u in %llu us, %d of %d buffers reused, %zu bytes exported",
+             width, height, (unsigned long long)(scheduler_now_ns() - start) / 1000,
+             (int)(_pool.stats().reused - reused), _buffer_count, _pool.bytes());
+    return true;
+}
 
+bool Renderer::recreate_ring()
+{
+    // The ring goes back to the pool. Frames not sent yet are dropped;
+    // consumers go on reading the ones they hold until they release them.
+    for (int i = 0; i < _buffer_count; i++) {
+        _pool.retire(_ring[i], _swapchain.state(i) == SWAPCHAIN_BUFFER_ACQUIRED);
+        _ring[i] = -1;
+        if (_fence_fds[i] >= 0) {
+            close(_fence_fds[i]);
+            _fence_fds[i] = -1;
+        }
+        damage_region_clear(&_frame_damage[i]);
+    }
+    _swapchain.restart();
+
+    if (!create_ring()) {
+        return false;
+    }
+    _display_buffer = 0;
+    _frame_due = true;
+    _redraw = _render_target == RENDER_TARGET_WINDOW && _surface != EGL_NO_SURFACE;
+    return true;
+}
+
+bool Renderer::check_formats()
+{
+    // Zero-copy buffers are linear already, and nothing was exported with
+    // the driver's own layout yet to judge
+    if (_zero_copy || _driver_modifier == DMABUF_MOD_INVALID) {
+        return true;
+    }
+    bool linear = !_broadcaster.supportsFormat(_driver_fourcc, _driver_modifier);
+    if (linear == _linear) {
+        return true;
+    }
+    LOG_INFO("consumers %s import modifier 0x%llx, switching to %s buffers",
+             linear ? "cannot" : "now all", (unsigned long long)_driver_modifier,
+             linear ? "linear" : "driver layout");
+    return recreate_ring();
+}
+
+bool Renderer::create_ring()
+{
+    TRACE_SCOPE("export_buffers");
+    struct buffer_pool_key_t key;
+    struct dmabuf_buffer_registration_t buffers[SWAPCHAIN_MAX_BUFFERS];
+    bool reused[SWAPCHAIN_MAX_BUFFERS] = { false };
+    bool created = true;
+    int exported = 0;
+    int missing = 0;
+
+    key.width = _frame_width;
+    key.height = _frame_height;
+    key.fourcc = DMABUF_FORMAT_ABGR8888;
+    key.modifier = DMABUF_MOD_INVALID;
+
+    // Consumers that cannot import the driver's layout get linear buffers
+    if (!_zero_copy && _driver_modifier != DMABUF_MOD_INVALID) {
+        _linear = !_broadcaster.supportsFormat(_driver_fourcc, _driver_modifier);
+        key.modifier = _linear ? DMABUF_MOD_LINEAR : _driver_modifier;
+    }
+
+    // Buffers the consumers imported before cost nothing to bring back
+    for (int i = 0; i < _buffer_count && created; i++) {
+        _ring[i] = _pool.reuse(key);
+        reused[i] = _ring[i] >= 0;
+        if (_ring[i] < 0) {
+            missing++;
+        } else {
+            damage_region_set_full(&_buffer_damage[i]);
+            created = !_zero_copy || seed_shared_buffer(_ring[i]);
+        }
+    }
+
+    // Older sizes make room before anything is allocated, so the peak
+    // stays within the budget where it can
+    size_t frame_bytes = dmabuf_format_frame_size(key.fourcc, key.width, key.height);
+    if (created) {
+        evict_idle(missing * frame_bytes);
+    }
+
+    for (int i = 0; i < _buffer_count && created; i++) {
+        if (_ring[i] >= 0) {
+            continue;
+        }
+        int id = _pool.reserve();
+        if (id < 0) {
+            created = false;
+            break;
+        }
+        struct dmabuf_buffer_registration_t *buffer = &buffers[exported];
+        buffer->buffer_id = id;
+        buffer->width = _frame_width;
+        buffer->height = _frame_height;
+        buffer->num_fds = 0;
+        created = create_buffer(id, buffer);
+        if (!created) {
+            destroy_buffer(id);
+            _pool.remove(id);
+            break;
+        }
+        // what the consumers import it as; tightly packed it would be
+        // frame_bytes
+        size_t bytes = 0;
+        for (int plane = 0; plane < buffer->metadata.num_planes; plane++) {
+            bytes += (size_t)buffer->metadata.planes[plane].stride * _frame_height;
+        }
+        key.modifier = buffer->metadata.modifiers;
+        _pool.add(id, key, bytes ? bytes : frame_bytes);
+        _ring[i] = id;
+        damage_region_clear(&_buffer_damage[i]);
+        exported++;
+    }
+
+    // Consumers only hear about the new ones
+    if (created) {
+        created = _broadcaster.addBuffers(buffers, exported);
+    }
+    for (int i = 0; i < exported; i++) {
+        for (int j = 0; j < buffers[i].num_fds; j++) {
+            close(buffers[i].fds[j]);
+        }
+    }
+
+    // No half a ring is left behind: the new buffers go, the reused ones
+    // return to the pool, and no slot points at either
+    if (!created) {
+        for (int i = 0; i < _buffer_count; i++) {
+            if (_ring[i] < 0) {
+                continue;
+            }
+            if (reused[i]) {
+                _pool.retire(_ring[i], false);
+            } else {
+                destroy_buffer(_ring[i]);
+                _pool.remove(_ring[i]);
+            }
+            _ring[i] = -1;
+        }
+    }
+    account_memory();
+    return created;
+}
+
+int Renderer::evict_idle(size_t extra)
+{
+    int evicted[DMABUF_MAX_BUFFERS];
+
+    int count = _pool.trim(extra + unpooled_bytes(), evicted, DMABUF_MAX_BUFFERS);
+    for (int i = 0; i < count; i++) {
+        _broadcaster.removeBuffer(evicted[i]);
+        destroy_buffer(evicted[i]);
+        _pool.remove(evicted[i]);
+    }
+
+    // Buffers in use are never given up, so say once when they alone
+    // exceed the budget
+    bool over = _pool.bytes() + extra + unpooled_bytes() > _pool.budget();
+    if (over && !_over_budget) {
+        LOG_INFO("memory in use %zu exceeds budget %zu, nothing idle left to give up",
+                 _pool.bytes() + extra + unpooled_bytes(), _pool.budget());
+    }
+    _over_budget = over;
+    return count;
+}
+
+void Renderer::enforce_budget()
+{
+    if (evict_idle(0) > 0) {
+        account_memory();
+    }
+}
+
+size_t Renderer::unpooled_bytes() const
+{
+    size_t frame_bytes = (size_t)_frame_width * _frame_height * 4;
+    size_t bytes = _uploader.bytes();
+
+    if (texture_data) {
+        bytes += frame_bytes;
+    }
+    if (_source_texture) {
+        bytes += frame_bytes;
+    }
+    return bytes;
+}
+
+void Renderer::account_memory()
+{
+    size_t frame_bytes = (size_t)_frame_width * _frame_height * 4;
+    uint32_t textures = 0, shared = 0, images = 0, dmabufs = 0;
+    uint64_t texture_bytes = 0, shared_bytes = 0, image_bytes = 0, dmabuf_bytes = 0;
+
+    _memory.set(MEMORY_FRAME_DATA, texture_data ? 1 : 0, texture_data ? frame_bytes : 0);
+    _memory.set(MEMORY_STAGING, _uploader.slots(), _uploader.bytes());
+    _memory.set(MEMORY_SOURCE_TEXTURE, _source_texture ? 1 : 0, _source_texture ? frame_bytes : 0);
+    for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+        enum buffer_pool_state_t state = _pool.state(id);
+        if (state != BUFFER_POOL_ACTIVE && state != BUFFER_POOL_IDLE) {
+            continue;
+        }
+        size_t bytes = _pool.bytes(id);
+        if (_shared_buffers[id].kind() != SHARED_BUFFER_NONE) {
+            shared++;
+            shared_bytes += bytes;
+        } else {
+            textures++;
+            texture_bytes += bytes;
+        }
+        if (_images[id] != EGL_NO_IMAGE_KHR) {
+            images++;
+            image_bytes += bytes;
+        }
+        dmabufs++;
+        dmabuf_bytes += bytes;
+    }
+    _memory.set(MEMORY_TEXTURE, textures, texture_bytes);
+    _memory.set(MEMORY_SHARED, shared, shared_bytes);
+    _memory.set(MEMORY_EGL_IMAGE, images, image_bytes);
+    _memory.set(MEMORY_DMABUF, dmabufs, dmabuf_bytes);
+
+    // Every consumer is sent every buffer the pool has
+    for (int i = 0; i < BROADCAST_MAX_CONSUMERS; i++) {
+        struct memory_consumer_t consumer;
+        uint32_t held = _broadcaster.heldBuffers(i);
+
+        memset(&consumer, 0, sizeof(consumer));
+        consumer.connected = _broadcaster.isConnected(i);
+        if (consumer.connected) {
+            consumer.imported = dmabufs;
+            consumer.imported_bytes = dmabuf_bytes;
+        }
+        for (int id = 0; id < DMABUF_MAX_BUFFERS; id++) {
+            if (held & (1u << id)) {
+                consumer.held++;
+                consumer.held_bytes += _pool.bytes(id);
+            }
+        }
+        _memory.setConsumer(i, consumer);
+    }
+    _memory.setEvicted(_pool.stats().evicted);
+}
+
+bool Renderer::create_buffer(int id, struct dmabuf_buffer_registration_t *buffer)
+{
+    if (_zero_copy) {
+        return create_zero_copy_texture(id, buffer);
+    }
+    if (!_linear) {
+        if (!create_shared_texture(id, buffer)) {
+            return false;
+        }
+        bool known = _driver_modifier != DMABUF_MOD_INVALID;
+        _driver_fourcc = buffer->metadata.fourcc;
+        _driver_modifier = buffer->metadata.modifiers;
+        if (!known) {
+            LOG_INFO("buffers exported with fourcc %08x modifier 0x%llx", _driver_fourcc,
+                     (unsigned long long)_driver_modifier);
+        }
+        if (known || _broadcaster.supportsFormat(_driver_fourcc, _driver_modifier)) {
+            return attach_framebuffer(id, buffer);
+        }
+        LOG_INFO("consumers cannot import modifier 0x%llx, switching to linear buffers",
+                 (unsigned long long)_driver_modifier);
+        for (int i = 0; i < buffer->num_fds; i++) {
+            close(buffer->fds[i]);
+        }
+        buffer->num_fds = 0;
+        destroy_buffer(id);
+        _linear = true;
+    }
+
+    // Linear shared memory, which every consumer can import and map
+    if (create_zero_copy_texture(id, buffer)) {
+        return attach_framebuffer(id, buffer);
+    }
+    LOG_ERROR("cannot create linear buffer %d, consumers may fail to import it", id);
+    for (int i = 0; i < buffer->num_fds; i++) {
+        close(buffer->fds[i]);
+    }
+    buffer->num_fds = 0;
+    destroy_buffer(id);
+    _linear = false;
+    return create_shared_texture(id, buffer) && attach_framebuffer(id, buffer);
+}
+
+bool Renderer::create_shared_texture(int id, struct dmabuf_buffer_registration_t *buffer)
+{
+    GLuint texture;
 
     // GL: Create and populate the texture
+    glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
-    err = glGetError();
+    EGLint err = glGetError();
     if (err != GL_NO_ERROR) {
         LOG_ERROR("error happened tex bind parameteri %08X \n",err);
         return false;
     }
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEXTURE_DATA_WIDTH, TEXTURE_DATA_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _frame_width, _frame_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     err = glGetError();
     if (err != GL_NO_ERROR) {
         LOG_ERROR("error happened tex parameteri %08X \n",err);
         return false;
     }
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TEXTURE_DATA_WIDTH, TEXTURE_DATA_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, texture_data);
+    struct damage_region_t everything;
+    damage_region_set_full(&everything);
+    upload_texture(texture, &everything);
+    glBindTexture(GL_TEXTURE_2D, texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     err = glGetError();
@@ -574,16 +1486,9 @@ bool Renderer::initialize()
         LOG_ERROR("error happened tex parameteri %08X \n",err);
         return false;
     }
-    const char* version = eglQueryString(display, EGL_VERSION);
-    err = eglGetError();
-    if (err !=EGL_SUCCESS) {
-        LOG_ERROR("error happened tex parameteri %08X \n",err);
-        return false;
-    }
-    LOG_INFO("%s", version);
+    _textures[id] = texture;
 
     PFNEGLCREATEIMAGEKHRPROC eglCreateImage;
-//    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
     eglCreateImage =
             (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImage");
     err = eglGetError();
@@ -591,120 +1496,198 @@ bool Renderer::initialize()
         LOG_ERROR("error happened tex parameteri %08X \n",err);
         return false;
     }
-//    glEGLImageTargetTexture2DOES =
-//            (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
 
-//    // EGL: Create EGL image from the GL texture
+    // EGL: Create EGL image from the GL texture
     EGLImage image = eglCreateImage(_display,
                                     _context,
                                     EGL_GL_TEXTURE_2D,
                                     (EGLClientBuffer)(uint64_t)texture,
                                     NULL);
     err = eglGetError();
-    eglQueryString
     if (err !=EGL_SUCCESS) {
         LOG_ERROR("error happened tex parameteri %08X \n",err);
         return false;
     }
+    _images[id] = image;
 
-    // The next line works around an issue in radeonsi driver (fixed in master at the time of writing). If you are
-    // having problems with texture rendering until the first texture update you can uncomment this line
-     glFlush();
+    return export_image(image, buffer);
+}
 
-    // EGL (extension: EGL_MESA_image_dma_buf_export): Get file descriptor (texture_dmabuf_fd) for the EGL image and get its
-    // storage data (texture_storage_metadata)
-    int texture_dmabuf_fd;
-    struct texture_storage_metadata_t texture_storage_metadata;
+bool Renderer::attach_framebuffer(int id, struct dmabuf_buffer_registration_t *buffer)
+{
+    // Offscreen frames are drawn into the exported texture instead of
+    // uploaded
+    if (_render_target != RENDER_TARGET_OFFSCREEN) {
+        return true;
+    }
 
-    int num_planes;
-    PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC eglExportDMABUFImageQueryMESA =
-            (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)eglGetProcAddress("eglExportDMABUFImageQueryMESA");
-    EGLBoolean queried = eglExportDMABUFImageQueryMESA(_display,
-                                                       image,
-                                                       &texture_storage_metadata.fourcc,
-                                                       &num_planes,
-                                                       &texture_storage_metadata.modifiers);
-    err = eglGetError();
-    if (err !=EGL_SUCCESS) {
-        LOG_ERROR("error happened tex parameteri %08X \n",err);
+    glGenFramebuffers(1, &_framebuffers[id]);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[id]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _textures[id], 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_ERROR("cannot render into buffer %d, framebuffer status %x", id, status);
+        for (int i = 0; i < buffer->num_fds; i++) {
+            close(buffer->fds[i]);
+        }
+        buffer->num_fds = 0;
         return false;
     }
-    PFNEGLEXPORTDMABUFIMAGEMESAPROC eglExportDMABUFImageMESA =
-            (PFNEGLEXPORTDMABUFIMAGEMESAPROC)eglGetProcAddress("eglExportDMABUFImageMESA");
-    EGLBoolean exported = eglExportDMABUFImageMESA(_display,
-                                                   image,
-                                                   &texture_dmabuf_fd,
-                                                   &texture_storage_metadata.stride,
-                                                   &texture_storage_metadata.offset);
-    err = eglGetError();
-    if (err !=EGL_SUCCESS) {
-        LOG_ERROR("error happened tex parameteri %08X \n",err);
+    return true;
+}
+
+bool Renderer::create_source_texture()
+{
+    glGenTextures(1, &_source_texture);
+    glBindTexture(GL_TEXTURE_2D, _source_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _frame_width, _frame_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    struct damage_region_t everything;
+    damage_region_set_full(&everything);
+    upload_texture(_source_texture, &everything);
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOG_ERROR("cannot create source texture %08X", err);
         return false;
     }
-    LOG_INFO("should create socket next");
-    int client_fd;
-    struct sockaddr_un server_addr;
-
-    // 创建 Unix 域套接字
-    client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (client_fd == -1) {
-        LOG_ERROR("create socket failed");
-        return -1;
-    }
-    LOG_INFO("create socket failed1");
-    // 指定 Unix 域套接字地址
-    server_addr.sun_family = AF_UNIX;
-    strncpy(server_addr.sun_path, SERVER_FILE, sizeof(server_addr.sun_path) - 1);
-    LOG_INFO("create socket failed2");
-    // 连接到服务器
-    if (connect(client_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
-        LOG_ERROR("connect failed %s",strerror(errno));
-        return -1;
-    }
-    LOG_INFO("create socket failed3");
-
-
-    // 发送数据到服务器
-//    if (write(client_fd, "Hello, server!", 14) == -1) {
-//        perror("write");
-//        exit(EXIT_FAILURE);
-//    }
-//
-//    // 关闭套接字
-//    close(client_fd);
-//
-//    // Unix Domain Socket: Send file descriptor (texture_dmabuf_fd) and texture storage data (texture_storage_metadata)
-//    int sock = create_socket(SERVER_FILE);
-//    if (sock < 0 ) {
-//        LOG_INFO("create socket failed\n");
-//        return false ;
-//    }
-//    while (connect_socket(sock, CLIENT_FILE) != 0)
-//        ;
-    write_fd(client_fd, texture_dmabuf_fd, &texture_storage_metadata, sizeof(texture_storage_metadata));
-    close(client_fd);
-    close(texture_dmabuf_fd);
+    return true;
+}
+
+bool Renderer::create_zero_copy_texture(int id, struct dmabuf_buffer_registration_t *buffer)
+{
+    SharedBuffer *shared = &_shared_buffers[id];
+    if (!shared->allocate(_frame_width, _frame_height) || !seed_shared_buffer(id)) {
+        return false;
+    }
+
+    EGLImageKHR image = shared->createImage(_display);
+    if (image == EGL_NO_IMAGE_KHR) {
+        return false;
+    }
+    _images[id] = image;
+
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES =
+            (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!glEGLImageTargetTexture2DOES) {
+        return false;
+    }
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, (GLeglImageOES)image);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    _textures[id] = texture;
+    EGLint err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOG_ERROR("cannot bind shared buffer %d to a texture %08X", id, err);
+        return false;
+    }
+
+    // Hardware buffers have no fd of their own to send, but the EGLImage
+    // can still be exported as a dma-buf
+    return shared->exportBuffer(buffer) || export_image(image, buffer);
+}
 
+bool Renderer::seed_shared_buffer(int id)
+{
+    SharedBuffer *shared = &_shared_buffers[id];
+
+    // Every buffer starts out with the seed frame
+    uint32_t *pixels = shared->lock(DMABUF_ACCESS_WRITE);
+    if (!pixels) {
+        return false;
+    }
+    pixel_kernels_get()->copy(pixels, shared->stride() * 4, texture_data, _frame_width * 4,
+                              _frame_width * 4, _frame_height);
+    shared->unlock();
     return true;
 }
 
+bool Renderer::export_image(EGLImageKHR image, struct dmabuf_buffer_registration_t *buffer)
+{
+    TRACE_SCOPE("export_image");
+    StageTimer timer(&_frame_stats, FRAME_STAGE_EXPORT);
+    return dmabuf_export_image(_display, image, buffer);
+}
+
 void Renderer::destroy() {
     LOG_INFO("Destroying context");
 
+    destroy_buffers();
+    _fences.reset();
+    _uploader.reset();
+    _gpu_timer.reset();
+    account_memory();
+
+    // The window itself is kept, a restarted render loop draws into it
     eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     eglDestroyContext(_display, _context);
-    eglDestroySurface(_display, _surface);
+    if (_surface != EGL_NO_SURFACE) {
+        eglDestroySurface(_display, _surface);
+    }
+    if (_idle_surface != EGL_NO_SURFACE) {
+        eglDestroySurface(_display, _idle_surface);
+    }
     eglTerminate(_display);
     
     _display = EGL_NO_DISPLAY;
     _surface = EGL_NO_SURFACE;
+    _idle_surface = EGL_NO_SURFACE;
     _context = EGL_NO_CONTEXT;
+    _current = false;
 
     return;
 }
 
+void Renderer::destroy_buffers()
+{
+    for (int i = 0; i < DMABUF_MAX_BUFFERS; i++) {
+        destroy_buffer(i);
+    }
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        _ring[i] = -1;
+        if (_fence_fds[i] >= 0) {
+            close(_fence_fds[i]);
+            _fence_fds[i] = -1;
+        }
+    }
+    if (_source_texture) {
+        glDeleteTextures(1, &_source_texture);
+        _source_texture = 0;
+    }
+    _pool.reset();
+    _broadcaster.clearBuffers();
+    _zero_copy = false;
+    _linear = false;
+    _over_budget = false;
+}
+
+void Renderer::destroy_buffer(int id)
+{
+    PFNEGLDESTROYIMAGEKHRPROC eglDestroyImage =
+            (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImage");
+    if (_images[id] != EGL_NO_IMAGE_KHR) {
+        eglDestroyImage(_display, _images[id]);
+        _images[id] = EGL_NO_IMAGE_KHR;
+    }
+    if (_framebuffers[id]) {
+        glDeleteFramebuffers(1, &_framebuffers[id]);
+        _framebuffers[id] = 0;
+    }
+    if (_textures[id]) {
+        glDeleteTextures(1, &_textures[id]);
+        _textures[id] = 0;
+    }
+    // after the image, which may still reference the memory
+    _shared_buffers[id].release();
+}
+
 
-void Renderer::gl_draw_scene(){
+void Renderer::gl_draw_scene(GLuint texture){
+    TRACE_SCOPE("gl_draw_scene");
     // clear
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -713,7 +1696,6 @@ void Renderer::gl_draw_scene(){
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     EGLint err = glGetError();
     if (err != GL_NO_ERROR) {
         LOG_ERROR("error happened tex bind parameteri %08X \n",err);
@@ -737,11 +1719,6 @@ void Renderer::gl_draw_scene(){
 //    _angle += 1.2f;
 }
 
-void Renderer::drawFrame(time_t *last_time)
-{
-
-}
-
 void* Renderer::threadStartCallback(void *myself)
 {
     Renderer *renderer = (Renderer*)myself;
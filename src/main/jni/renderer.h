@@ -18,65 +18,284 @@
 #define RENDERER_H
 
 #include <pthread.h>
+#include <atomic>
 #include <EGL/egl.h> // requires ndk r5 or newer
 #include <GLES/gl.h>
 #include <GLES/glext.h>
 #include <GLES3/gl3.h>
 
+#include <EGL/eglext.h>
 
+#include "buffer_pool.h"
+#include "command_queue.h"
+#include "damage_region.h"
+#include "frame_broadcaster.h"
+#include "frame_scheduler.h"
+#include "frame_stats.h"
+#include "gpu_timer.h"
+#include "memory_account.h"
+#include "program_cache.h"
+#include "shared_buffer.h"
+#include "stats_server.h"
+#include "swapchain.h"
+#include "sync_fence.h"
+#include "texture_upload.h"
+
+
+// Where the CPU frames live.
+enum frame_memory_t {
+    // texture_data in client memory, uploaded into exported textures
+    FRAME_MEMORY_UPLOAD = 0,
+    // every ring buffer is a SharedBuffer the frames are generated in;
+    // the GPU and the consumers read them without a copy
+    FRAME_MEMORY_SHARED
+};
+
+// What the scene is drawn into.
+enum render_target_t {
+    // the window from setWindow(); every frame is also shown locally
+    RENDER_TARGET_WINDOW = 0,
+    // the exported buffers themselves, through a framebuffer object each,
+    // on a surfaceless context; nothing is presented locally and
+    // rendering starts without a window
+    RENDER_TARGET_OFFSCREEN
+};
+
+// _requested_window when no window change is pending
+#define WINDOW_UNCHANGED ((ANativeWindow *)~(uintptr_t)0)
 
 class Renderer {
 
 public:
-    Renderer();
+    // buffer_count shared textures are exported and cycled between the
+    // producer and the consumer.
+    // With FRAME_MEMORY_SHARED texture_data only seeds the first frame;
+    // when shared buffers cannot be created or imported the renderer
+    // falls back to uploads.
+    // With RENDER_TARGET_OFFSCREEN consumers get the drawn scene instead
+    // of texture_data and frames always go through uploads.
+    Renderer(int buffer_count = DEFAULT_SWAPCHAIN_SIZE,
+             enum swapchain_mode_t swapchain_mode = SWAPCHAIN_MODE_MAILBOX,
+             enum frame_memory_t frame_memory = FRAME_MEMORY_UPLOAD,
+             enum render_target_t render_target = RENDER_TARGET_WINDOW);
     virtual ~Renderer();
 
     // Following methods can be called from any thread.
-    // They send message to render thread which executes required actions.
+    // They queue a command for the render thread, which executes required
+    // actions, and never wait for rendering. Only stop() waits for the
+    // thread to exit.
     void start();
     void stop();
     void setWindow(ANativeWindow* window);
-    void read_fd(int sock, int *fd, void *data, size_t data_len);
-    int connect_socket(int sock, const char *path);
-   void  write_fd(int sock, int fd, void *data, size_t data_len);
-   int create_socket(const char *path);
+    void resize(int width, int height);
+    // Marks parts of texture_data as changed. Only damaged parts are
+    // uploaded with the next update and consumers are told about them.
+    void addDamage(const struct dmabuf_rect_t *rects, int count);
+    // Generates the next frame now instead of at the next frame period.
+    void requestFrame();
+    // Rate at which new frames are generated; 0 only redraws on events.
+    void setFrameRate(double fps);
+    // Size of the frames shared with the consumers. Buffers of a size used
+    // before are taken from the pool, which consumers have imported already.
+    void setFrameSize(int width, int height);
+    // Where linked shader programs are kept between runs; NULL compiles
+    // them every time. Only before start().
+    void setCacheDir(const char *directory);
+    // Most memory the renderer keeps pinned: the CPU frame, upload staging
+    // and every exported buffer. Idle buffers of frame sizes not in use are
+    // given up to stay within it, buffers in use never are. May be called
+    // at any time.
+    void setMemoryBudget(size_t bytes);
+   // one frame size, replaced by the render thread when the size changes
    int * texture_data = NULL;
     void rotate_data();
-    const size_t TEXTURE_DATA_WIDTH = 256;
-    const size_t TEXTURE_DATA_HEIGHT = TEXTURE_DATA_WIDTH;
-    const size_t TEXTURE_DATA_SIZE = TEXTURE_DATA_WIDTH * TEXTURE_DATA_HEIGHT;
+    static const int DEFAULT_FRAME_WIDTH = 256;
+    static const int DEFAULT_FRAME_HEIGHT = DEFAULT_FRAME_WIDTH;
+    static const int DEFAULT_SWAPCHAIN_SIZE = 3;
+    static const int DEFAULT_FRAME_RATE = 1;
+
+    struct swapchain_stats_t swapchainStats() const { return _swapchain.stats(); }
+    // Per-stage frame times. Safe to read from any thread.
+    const FrameStats &frameStats() const { return _frame_stats; }
+    // Content to consumer display, from the consumers' acks. Safe to read
+    // from any thread.
+    const FrameLatency &frameLatency() const { return _latency; }
+    // Memory pinned, by kind and by consumer. Safe to read from any thread.
+    const MemoryAccount &memoryAccount() const { return _memory; }
+    // Text report of frame counters, stage times, latencies and memory,
+    // see FrameStats::format and MemoryAccount::format. Safe to call from
+    // any thread.
+    size_t formatStats(char *buffer, size_t size) const;
     
     
 private:
-    GLuint texture ;
-    enum RenderThreadMessage {
-        MSG_NONE = 0,
-        MSG_WINDOW_SET,
-        MSG_RENDER_LOOP_EXIT
-    };
-
-    int* create_data(size_t size);
+    int* create_data(size_t width, size_t height);
     pthread_t _threadId;
-    pthread_mutex_t _mutex;
-    enum RenderThreadMessage _msg;
+
+    // commands from other threads
+    CommandQueue _commands;
+    // types of commands that did not fit in the queue, one bit each
+    std::atomic<uint32_t> _overflow;
+    // newest values from setWindow() and resize(); the window is
+    // WINDOW_UNCHANGED once taken by the render thread, which then owns
+    // its reference
+    std::atomic<ANativeWindow *> _requested_window;
+    std::atomic<uint64_t> _requested_size;
+    std::atomic<uint64_t> _requested_frame_size;
+    std::atomic<uint64_t> _requested_budget;
     
     // android window, supported by NDK r5 and newer
     ANativeWindow* _window;
 
+    // Display, context and everything made with it live until stop();
+    // a new window only replaces _surface
     EGLDisplay _display;
     EGLSurface _surface;
     EGLContext _context;
+    EGLConfig _config;
+    // current while there is no window: a pbuffer, or EGL_NO_SURFACE with
+    // EGL_KHR_surfaceless_context
+    EGLSurface _idle_surface;
+    bool _current;
     GLfloat _angle;
+
+    // sleeps between frames and events
+    FrameScheduler _scheduler;
+    // a frame is due but has not been generated, e.g. no buffer was free
+    bool _frame_due;
+    // the surface shows something outdated
+    bool _redraw;
+    uint64_t _last_stats_ns;
+
+    // where frame time goes
+    FrameStats _frame_stats;
+    FrameLatency _latency;
+    GpuTimer _gpu_timer;
+    StatsServer _stats_server;
+    uint64_t _last_frame_ns;
+
+    // shader programs from earlier runs
+    ProgramCache _program_cache;
+
+    // connections to the consumers, kept open across frames
+    FrameBroadcaster _broadcaster;
+    uint64_t _frame_id;
+
+    // size of texture_data and of the buffers in the ring
+    uint32_t _frame_width;
+    uint32_t _frame_height;
+
+    // ring of exported textures shared with the consumer; the swapchain
+    // counts in ring slots, _ring maps them to buffer ids
+    int _buffer_count;
+    enum swapchain_mode_t _swapchain_mode;
+    Swapchain _swapchain;
+    int _ring[SWAPCHAIN_MAX_BUFFERS];
+    int _display_buffer;
+
+    // every exported buffer, in the ring or kept for another frame size,
+    // by buffer id
+    BufferPool _pool;
+    MemoryAccount _memory;
+    // above the budget with nothing idle left to give up
+    bool _over_budget;
+    GLuint _textures[DMABUF_MAX_BUFFERS];
+    EGLImageKHR _images[DMABUF_MAX_BUFFERS];
+
+    // fence of the frame last written into each ring slot, not yet sent
+    FenceExporter _fences;
+    int _fence_fds[SWAPCHAIN_MAX_BUFFERS];
+    enum dmabuf_fence_type_t _fence_types[SWAPCHAIN_MAX_BUFFERS];
+    // when the content of the frame in each ring slot was complete
+    uint64_t _content_ns[SWAPCHAIN_MAX_BUFFERS];
+    // frame last sent in each buffer, until the consumers give it back
+    uint64_t _sent_frames[DMABUF_MAX_BUFFERS];
+
+    // streams texture_data into the shared textures
+    TextureUploader _uploader;
+
+    // frame memory of each buffer when frames are not uploaded
+    enum frame_memory_t _frame_memory;
+    bool _zero_copy;
+    SharedBuffer _shared_buffers[DMABUF_MAX_BUFFERS];
+    // Uploaded and offscreen frames go into textures in whatever layout the
+    // driver exports them with, tiled or compressed as it likes. When some
+    // consumer cannot import that modifier, they go into linear shared
+    // buffers instead.
+    bool _linear;
+    int _driver_fourcc;
+    uint64_t _driver_modifier;
+
+    // offscreen rendering: texture_data is uploaded into _source_texture
+    // and the scene drawn into the exported textures
+    enum render_target_t _render_target;
+    GLuint _source_texture;
+    GLuint _framebuffers[DMABUF_MAX_BUFFERS];
+
+    // damage added since the last update
+    struct damage_region_t _pending_damage;
+    // changed since each buffer was last written
+    struct damage_region_t _buffer_damage[SWAPCHAIN_MAX_BUFFERS];
+    // of the frame queued in each buffer, until it is sent
+    struct damage_region_t _frame_damage[SWAPCHAIN_MAX_BUFFERS];
+    // changed since the last eglSwapBuffers, in texture pixels
+    struct damage_region_t _surface_damage;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC _eglSwapBuffersWithDamage;
     
     // RenderLoop is called in a rendering thread started in start() method
     // It creates rendering context and renders scene until stop() is called
     void renderLoop();
+    void post(enum render_command_type_t type, const struct dmabuf_rect_t *rect = NULL);
+    // Applies queued commands, coalescing repeated ones. Returns false once
+    // the loop should exit.
+    bool process_commands();
+    // Takes the window from setWindow(). With draw false it is only
+    // remembered for the next initialize().
+    void set_requested_window(bool draw);
+    bool create_window_surface();
+    void destroy_window_surface();
+    bool make_current_idle();
+    void update_viewport();
+    void resize_surface();
+    bool resize_frames();
+    // Gives up the ring and fills it again at the current frame size
+    bool recreate_ring();
+    // Rebuilds the ring when the consumers' formats call for the other
+    // buffer layout. Returns false when that failed.
+    bool check_formats();
 
     bool initialize();
     void destroy();
+    // Fills the ring with buffers of the frame size, from the pool or new
+    bool create_ring();
+    bool create_buffer(int id, struct dmabuf_buffer_registration_t *buffer);
+    // Gives up idle buffers until extra more bytes fit in the budget,
+    // besides what is pinned outside the pool. Returns how many went.
+    int evict_idle(size_t extra);
+    void enforce_budget();
+    size_t unpooled_bytes() const;
+    // Refreshes _memory from the buffers and consumers
+    void account_memory();
+    void destroy_buffer(int id);
+    bool create_shared_texture(int id, struct dmabuf_buffer_registration_t *buffer);
+    bool create_zero_copy_texture(int id, struct dmabuf_buffer_registration_t *buffer);
+    bool export_image(EGLImageKHR image, struct dmabuf_buffer_registration_t *buffer);
+    bool attach_framebuffer(int id, struct dmabuf_buffer_registration_t *buffer);
+    bool create_source_texture();
+    bool seed_shared_buffer(int id);
+    void destroy_buffers();
+
+    bool update_shared_buffer();
+    void upload_texture(GLuint texture, const struct damage_region_t *damage);
+    bool generate_shared_frame(int id);
+    void draw_offscreen(int id);
+    bool swap_buffers();
+    void present_pending();
+    void process_releases();
+    void watch_consumers();
+    static size_t format_stats(void *renderer, char *buffer, size_t size);
 
-    void drawFrame(time_t *cur_time);
-    void gl_draw_scene();
+    void gl_draw_scene(GLuint texture);
 
     // Helper method for starting the thread 
     static void* threadStartCallback(void *myself);
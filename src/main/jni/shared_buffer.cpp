@@ -0,0 +1,389 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/dma-buf.h>
+
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#include <android/hardware_buffer.h>
+#endif
+
+#include "logger.h"
+#include "dmabuf_format.h"
+#include "shared_buffer.h"
+
+#define LOG_TAG "EglSample"
+
+// Not in every libc or NDK sysroot
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#endif
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+// linux/udmabuf.h
+struct shared_udmabuf_create_t
+{
+    uint32_t memfd;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+};
+#define SHARED_UDMABUF_FLAGS_CLOEXEC 0x01
+#define SHARED_UDMABUF_CREATE _IOW('u', 0x42, struct shared_udmabuf_create_t)
+
+static const char *UDMABUF_DEVICE = "/dev/udmabuf";
+
+#ifdef __ANDROID__
+
+// AHardwareBuffer is resolved at run time so the library still loads on
+// releases older than 8.0, where the zero-copy mode is simply unavailable.
+struct hardware_buffer_api_t
+{
+    int (*allocate)(const AHardwareBuffer_Desc *desc, AHardwareBuffer **buffer);
+    void (*release)(AHardwareBuffer *buffer);
+    void (*describe)(const AHardwareBuffer *buffer, AHardwareBuffer_Desc *desc);
+    int (*lock)(AHardwareBuffer *buffer, uint64_t usage, int32_t fence,
+                const ARect *rect, void **address);
+    int (*unlock)(AHardwareBuffer *buffer, int32_t *fence);
+};
+
+static struct hardware_buffer_api_t hardware_buffer_api;
+static bool hardware_buffer_loaded = false;
+static pthread_once_t hardware_buffer_once = PTHREAD_ONCE_INIT;
+
+static void load_hardware_buffer_api()
+{
+    void *lib = dlopen("libnativewindow.so", RTLD_NOW);
+    if (!lib) {
+        return;
+    }
+    hardware_buffer_api.allocate = (int (*)(const AHardwareBuffer_Desc *, AHardwareBuffer **))
+            dlsym(lib, "AHardwareBuffer_allocate");
+    hardware_buffer_api.release = (void (*)(AHardwareBuffer *))dlsym(lib, "AHardwareBuffer_release");
+    hardware_buffer_api.describe = (void (*)(const AHardwareBuffer *, AHardwareBuffer_Desc *))
+            dlsym(lib, "AHardwareBuffer_describe");
+    hardware_buffer_api.lock = (int (*)(AHardwareBuffer *, uint64_t, int32_t, const ARect *, void **))
+            dlsym(lib, "AHardwareBuffer_lock");
+    hardware_buffer_api.unlock = (int (*)(AHardwareBuffer *, int32_t *))dlsym(lib, "AHardwareBuffer_unlock");
+    hardware_buffer_loaded = hardware_buffer_api.allocate && hardware_buffer_api.release &&
+                             hardware_buffer_api.describe && hardware_buffer_api.lock &&
+                             hardware_buffer_api.unlock;
+}
+
+#endif
+
+SharedBuffer::SharedBuffer()
+    : _kind(SHARED_BUFFER_NONE), _width(0), _height(0), _stride(0),
+      _fd(-1), _pixels(NULL), _size(0), _access((enum dmabuf_access_t)0),
+      _hardware_buffer(NULL)
+{
+}
+
+SharedBuffer::~SharedBuffer()
+{
+    release();
+}
+
+bool SharedBuffer::allocate(uint32_t width, uint32_t height)
+{
+    release();
+    _width = width;
+    _height = height;
+
+    if (allocate_hardware() || allocate_memfd()) {
+        return true;
+    }
+    _width = _height = 0;
+    return false;
+}
+
+bool SharedBuffer::allocate_hardware()
+{
+#ifdef __ANDROID__
+    pthread_once(&hardware_buffer_once, load_hardware_buffer_api);
+    if (!hardware_buffer_loaded) {
+        return false;
+    }
+
+    AHardwareBuffer_Desc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.width = _width;
+    desc.height = _height;
+    desc.layers = 1;
+    desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM;
+    desc.usage = AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN | AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN |
+                 AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE;
+    if (hardware_buffer_api.allocate(&desc, &_hardware_buffer) != 0) {
+        LOG_ERROR("shared buffer: AHardwareBuffer_allocate %ux%u failed", _width, _height);
+        _hardware_buffer = NULL;
+        return false;
+    }
+    hardware_buffer_api.describe(_hardware_buffer, &desc);
+    _stride = desc.stride;
+    _kind = SHARED_BUFFER_HARDWARE;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SharedBuffer::allocate_memfd()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    _stride = _width;
+    // udmabuf only takes whole pages
+    _size = ((size_t)_stride * _height * 4 + page - 1) & ~(size_t)(page - 1);
+
+    _fd = syscall(SYS_memfd_create, "shared_frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (_fd < 0) {
+        LOG_ERROR("shared buffer: memfd_create failed %s", strerror(errno));
+        return false;
+    }
+    if (ftruncate(_fd, _size) < 0 || fcntl(_fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+        LOG_ERROR("shared buffer: cannot size memfd %s", strerror(errno));
+        release();
+        return false;
+    }
+    _pixels = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (_pixels == MAP_FAILED) {
+        LOG_ERROR("shared buffer: mmap failed %s", strerror(errno));
+        _pixels = NULL;
+        release();
+        return false;
+    }
+    _kind = SHARED_BUFFER_MEMFD;
+
+    // The mapping of the memfd stays valid; from now on the dma-buf is the
+    // fd that is synced and shared.
+    int device = open(UDMABUF_DEVICE, O_RDWR | O_CLOEXEC);
+    if (device < 0) {
+        LOG_INFO("shared buffer: %s unavailable, memfd can only be mapped by consumers", UDMABUF_DEVICE);
+        return true;
+    }
+    struct shared_udmabuf_create_t create;
+    memset(&create, 0, sizeof(create));
+    create.memfd = _fd;
+    create.flags = SHARED_UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = _size;
+    int dmabuf = ioctl(device, SHARED_UDMABUF_CREATE, &create);
+    close(device);
+    if (dmabuf < 0) {
+        LOG_INFO("shared buffer: UDMABUF_CREATE failed %s", strerror(errno));
+        return true;
+    }
+    close(_fd);
+    _fd = dmabuf;
+    _kind = SHARED_BUFFER_UDMABUF;
+    return true;
+}
+
+void SharedBuffer::release()
+{
+    if (_access) {
+        unlock();
+    }
+#ifdef __ANDROID__
+    if (_hardware_buffer) {
+        hardware_buffer_api.release(_hardware_buffer);
+    }
+#endif
+    _hardware_buffer = NULL;
+    if (_pixels) {
+        munmap(_pixels, _size);
+        _pixels = NULL;
+    }
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _kind = SHARED_BUFFER_NONE;
+    _size = 0;
+    _stride = 0;
+}
+
+uint32_t *SharedBuffer::lock(enum dmabuf_access_t access)
+{
+    if (_access) {
+        LOG_ERROR("shared buffer: already locked");
+        return NULL;
+    }
+
+    switch (_kind) {
+#ifdef __ANDROID__
+        case SHARED_BUFFER_HARDWARE: {
+            uint64_t usage = 0;
+            void *address = NULL;
+            if (access & DMABUF_ACCESS_READ) {
+                usage |= AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN;
+            }
+            if (access & DMABUF_ACCESS_WRITE) {
+                usage |= AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN;
+            }
+            if (hardware_buffer_api.lock(_hardware_buffer, usage, -1, NULL, &address) != 0) {
+                LOG_ERROR("shared buffer: AHardwareBuffer_lock failed");
+                return NULL;
+            }
+            _access = access;
+            return (uint32_t *)address;
+        }
+#endif
+        case SHARED_BUFFER_UDMABUF: {
+            struct dma_buf_sync sync_args;
+            int ret;
+            sync_args.flags = DMA_BUF_SYNC_START |
+                              ((access & DMABUF_ACCESS_READ) ? DMA_BUF_SYNC_READ : 0) |
+                              ((access & DMABUF_ACCESS_WRITE) ? DMA_BUF_SYNC_WRITE : 0);
+            do {
+                ret = ioctl(_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+            } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+            if (ret < 0) {
+                LOG_ERROR("shared buffer: DMA_BUF_IOCTL_SYNC failed %s", strerror(errno));
+                return NULL;
+            }
+            _access = access;
+            return (uint32_t *)_pixels;
+        }
+        case SHARED_BUFFER_MEMFD:
+            _access = access;
+            return (uint32_t *)_pixels;
+        default:
+            return NULL;
+    }
+}
+
+bool SharedBuffer::unlock()
+{
+    enum dmabuf_access_t access = _access;
+    if (!access) {
+        return false;
+    }
+    _access = (enum dmabuf_access_t)0;
+
+    switch (_kind) {
+#ifdef __ANDROID__
+        case SHARED_BUFFER_HARDWARE:
+            return hardware_buffer_api.unlock(_hardware_buffer, NULL) == 0;
+#endif
+        case SHARED_BUFFER_UDMABUF: {
+            struct dma_buf_sync sync_args;
+            int ret;
+            sync_args.flags = DMA_BUF_SYNC_END |
+                              ((access & DMABUF_ACCESS_READ) ? DMA_BUF_SYNC_READ : 0) |
+                              ((access & DMABUF_ACCESS_WRITE) ? DMA_BUF_SYNC_WRITE : 0);
+            do {
+                ret = ioctl(_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+            } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+            return ret == 0;
+        }
+        default:
+            return true;
+    }
+}
+
+EGLImageKHR SharedBuffer::createImage(EGLDisplay display)
+{
+    PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR =
+            (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    if (!eglCreateImageKHR) {
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    if (_kind == SHARED_BUFFER_HARDWARE) {
+        PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC eglGetNativeClientBufferANDROID =
+                (PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID");
+        if (!eglGetNativeClientBufferANDROID) {
+            LOG_ERROR("shared buffer: EGL_ANDROID_get_native_client_buffer unsupported");
+            return EGL_NO_IMAGE_KHR;
+        }
+        EGLClientBuffer client_buffer = eglGetNativeClientBufferANDROID(_hardware_buffer);
+        const EGLint attribs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+        EGLImageKHR image = eglCreateImageKHR(display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID,
+                                              client_buffer, attribs);
+        if (image == EGL_NO_IMAGE_KHR) {
+            LOG_ERROR("shared buffer: cannot import hardware buffer %x", eglGetError());
+        }
+        return image;
+    }
+
+    if (_kind != SHARED_BUFFER_UDMABUF) {
+        return EGL_NO_IMAGE_KHR;
+    }
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_EXT_image_dma_buf_import")) {
+        LOG_ERROR("shared buffer: EGL_EXT_image_dma_buf_import unsupported");
+        return EGL_NO_IMAGE_KHR;
+    }
+    const EGLint attribs[] = {
+        EGL_WIDTH, (EGLint)_width,
+        EGL_HEIGHT, (EGLint)_height,
+        EGL_LINUX_DRM_FOURCC_EXT, DMABUF_FORMAT_ABGR8888,
+        EGL_DMA_BUF_PLANE0_FD_EXT, _fd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)(_stride * 4),
+        EGL_NONE
+    };
+    EGLImageKHR image = eglCreateImageKHR(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+                                          (EGLClientBuffer)NULL, attribs);
+    if (image == EGL_NO_IMAGE_KHR) {
+        LOG_ERROR("shared buffer: cannot import udmabuf %x", eglGetError());
+    }
+    return image;
+}
+
+bool SharedBuffer::exportBuffer(struct dmabuf_buffer_registration_t *buffer)
+{
+    if (_fd < 0) {
+        return false;
+    }
+    int fd = fcntl(_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("shared buffer: cannot dup fd %s", strerror(errno));
+        return false;
+    }
+
+    struct texture_storage_metadata_t *metadata = &buffer->metadata;
+    memset(metadata, 0, sizeof(*metadata));
+    metadata->fourcc = DMABUF_FORMAT_ABGR8888;
+    metadata->modifiers = DMABUF_MOD_LINEAR;
+    metadata->num_planes = 1;
+    metadata->planes[0].fd_index = 0;
+    metadata->planes[0].stride = _stride * 4;
+    metadata->planes[0].offset = 0;
+    metadata->planes[0].modifier = DMABUF_MOD_LINEAR;
+    buffer->width = _width;
+    buffer->height = _height;
+    buffer->fds[0] = fd;
+    buffer->num_fds = 1;
+    return true;
+}
@@ -0,0 +1,95 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "dmabuf_mapper.h"
+#include "producer_session.h"
+
+struct AHardwareBuffer;
+
+enum shared_buffer_kind_t {
+    SHARED_BUFFER_NONE = 0,
+    SHARED_BUFFER_HARDWARE, // AHardwareBuffer, Android 8.0 and newer
+    SHARED_BUFFER_UDMABUF,  // memfd turned into a dma-buf by /dev/udmabuf
+    SHARED_BUFFER_MEMFD     // plain memfd, CPU consumers only
+};
+
+// RGBA8 frame memory that the CPU writes and the GPU and the consumers
+// read in place.
+//
+// On Android the memory is an AHardwareBuffer, elsewhere a sealed memfd
+// that /dev/udmabuf wraps into a dma-buf. Either way the pixels the
+// producer writes are the ones sampled by the GL texture made from
+// createImage() and mapped by consumers, so no upload or copy is made.
+// Without udmabuf the memfd can still be sent to consumers that map it
+// with DmabufMapper, but it cannot be imported into EGL.
+//
+// Writes must be bracketed by lock() and unlock() so caches are kept
+// coherent with the GPU.
+class SharedBuffer {
+
+public:
+    SharedBuffer();
+    virtual ~SharedBuffer();
+
+    bool allocate(uint32_t width, uint32_t height);
+    void release();
+
+    // Starts CPU access and returns the first pixel, NULL on failure.
+    // Rows are stride() pixels apart.
+    uint32_t *lock(enum dmabuf_access_t access);
+    bool unlock();
+
+    enum shared_buffer_kind_t kind() const { return _kind; }
+    uint32_t width() const { return _width; }
+    uint32_t height() const { return _height; }
+    uint32_t stride() const { return _stride; }
+
+    // EGLImage sampling the buffer, EGL_NO_IMAGE_KHR if this display cannot
+    // import it. The caller destroys the image.
+    EGLImageKHR createImage(EGLDisplay display);
+
+    // Describes the buffer for consumers with a dup of its fd, which the
+    // caller closes. False for hardware buffers, which are exported through
+    // their EGLImage instead.
+    bool exportBuffer(struct dmabuf_buffer_registration_t *buffer);
+
+private:
+    bool allocate_hardware();
+    bool allocate_memfd();
+
+    enum shared_buffer_kind_t _kind;
+    uint32_t _width;
+    uint32_t _height;
+    uint32_t _stride;
+
+    // udmabuf or memfd
+    int _fd;
+    void *_pixels;
+    size_t _size;
+    enum dmabuf_access_t _access;
+
+    struct AHardwareBuffer *_hardware_buffer;
+};
+
+#endif // SHARED_BUFFER_H
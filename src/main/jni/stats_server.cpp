@@ -0,0 +1,102 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logger.h"
+#include "stats_server.h"
+
+#define LOG_TAG "EglSample"
+
+StatsServer::StatsServer()
+    : _sock(-1)
+{
+}
+
+StatsServer::~StatsServer()
+{
+    close();
+}
+
+bool StatsServer::listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (_sock >= 0) {
+        return true;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        LOG_ERROR("create socket failed %s", strerror(errno));
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(sock, 4) < 0) {
+        LOG_ERROR("listen on %s failed %s", path, strerror(errno));
+        ::close(sock);
+        return false;
+    }
+
+    LOG_INFO("serving frame stats on %s", path);
+    _sock = sock;
+    return true;
+}
+
+void StatsServer::close()
+{
+    if (_sock >= 0) {
+        ::close(_sock);
+        _sock = -1;
+    }
+}
+
+void StatsServer::serve(size_t (*format)(void *context, char *buffer, size_t size), void *context)
+{
+    char report[STATS_SERVER_MAX_REPORT];
+    size_t length = 0;
+    bool formatted = false;
+
+    if (_sock < 0) {
+        return;
+    }
+    for (;;) {
+        int client = accept4(_sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (client < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR("accept failed %s", strerror(errno));
+            }
+            return;
+        }
+        if (!formatted) {
+            length = format(context, report, sizeof(report));
+            formatted = true;
+        }
+        if (send(client, report, length, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            LOG_ERROR("stats: send failed %s", strerror(errno));
+        }
+        ::close(client);
+    }
+}
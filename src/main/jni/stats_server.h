@@ -0,0 +1,47 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include <stddef.h>
+
+#define STATS_SERVER_MAX_REPORT 4096
+
+// Local stream socket that hands out a text report to whoever connects,
+// e.g. `socat - UNIX-CONNECT:/data/my_socket_stats`. Each client gets one
+// report and is disconnected.
+class StatsServer {
+
+public:
+    StatsServer();
+    virtual ~StatsServer();
+
+    bool listen(const char *path);
+    void close();
+    int fd() const { return _sock; }
+
+    // Answers every client waiting to be accepted with the report written
+    // by format, which is only called when someone is waiting. Never
+    // blocks; a client whose socket cannot take the report at once gets a
+    // truncated one.
+    void serve(size_t (*format)(void *context, char *buffer, size_t size), void *context);
+
+private:
+    int _sock;
+};
+
+#endif // STATS_SERVER_H
@@ -0,0 +1,168 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+
+#include "logger.h"
+#include "swapchain.h"
+
+#define LOG_TAG "EglSample"
+
+Swapchain::Swapchain()
+    : _count(0), _max_acquired(1), _acquired(0), _mode(SWAPCHAIN_MODE_FIFO), _pending_count(0)
+{
+    memset(_state, 0, sizeof(_state));
+    reset_stats();
+}
+
+bool Swapchain::init(int buffer_count, enum swapchain_mode_t mode, int max_acquired)
+{
+    if (buffer_count < SWAPCHAIN_MIN_BUFFERS || buffer_count > SWAPCHAIN_MAX_BUFFERS) {
+        LOG_ERROR("swapchain size %d out of range [%d, %d]",
+                  buffer_count, SWAPCHAIN_MIN_BUFFERS, SWAPCHAIN_MAX_BUFFERS);
+        return false;
+    }
+    if (max_acquired < 1 || max_acquired >= buffer_count) {
+        LOG_ERROR("swapchain max_acquired %d out of range", max_acquired);
+        return false;
+    }
+
+    _count = buffer_count;
+    _mode = mode;
+    _max_acquired = max_acquired;
+    _acquired = 0;
+    _pending_count = 0;
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        _state[i] = SWAPCHAIN_BUFFER_FREE;
+    }
+    reset_stats();
+    return true;
+}
+
+void Swapchain::restart()
+{
+    _dropped.fetch_add(_pending_count, std::memory_order_relaxed);
+    _acquired = 0;
+    _pending_count = 0;
+    for (int i = 0; i < SWAPCHAIN_MAX_BUFFERS; i++) {
+        _state[i] = SWAPCHAIN_BUFFER_FREE;
+    }
+}
+
+int Swapchain::dequeue()
+{
+    for (int i = 0; i < _count; i++) {
+        if (_state[i] == SWAPCHAIN_BUFFER_FREE) {
+            _state[i] = SWAPCHAIN_BUFFER_DEQUEUED;
+            return i;
+        }
+    }
+
+    // Latest frame wins: recycle the oldest frame the consumer has not seen.
+    if (_mode == SWAPCHAIN_MODE_MAILBOX && _pending_count > 0) {
+        int id = pop_pending();
+        _state[id] = SWAPCHAIN_BUFFER_DEQUEUED;
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    _stalls.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+}
+
+void Swapchain::queue(int id)
+{
+    if (id < 0 || id >= _count || _state[id] != SWAPCHAIN_BUFFER_DEQUEUED) {
+        LOG_ERROR("swapchain queue of buffer %d that is not dequeued", id);
+        return;
+    }
+
+    if (_mode == SWAPCHAIN_MODE_MAILBOX) {
+        while (_pending_count > 0) {
+            _state[pop_pending()] = SWAPCHAIN_BUFFER_FREE;
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    _state[id] = SWAPCHAIN_BUFFER_PENDING;
+    _pending[_pending_count++] = id;
+    _queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+int Swapchain::acquireNext()
+{
+    if (_pending_count == 0 || _acquired >= _max_acquired) {
+        return -1;
+    }
+
+    int id = pop_pending();
+    _state[id] = SWAPCHAIN_BUFFER_ACQUIRED;
+    _acquired++;
+    _presented.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+bool Swapchain::release(int id)
+{
+    if (id < 0 || id >= _count || _state[id] != SWAPCHAIN_BUFFER_ACQUIRED) {
+        LOG_ERROR("swapchain release of buffer %d not held by consumer", id);
+        return false;
+    }
+
+    _state[id] = SWAPCHAIN_BUFFER_FREE;
+    _acquired--;
+    _released.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Swapchain::releaseAcquired()
+{
+    for (int i = 0; i < _count; i++) {
+        if (_state[i] == SWAPCHAIN_BUFFER_ACQUIRED) {
+            _state[i] = SWAPCHAIN_BUFFER_FREE;
+        }
+    }
+    _acquired = 0;
+}
+
+struct swapchain_stats_t Swapchain::stats() const
+{
+    struct swapchain_stats_t stats;
+
+    stats.queued = _queued.load(std::memory_order_relaxed);
+    stats.presented = _presented.load(std::memory_order_relaxed);
+    stats.dropped = _dropped.load(std::memory_order_relaxed);
+    stats.released = _released.load(std::memory_order_relaxed);
+    stats.stalls = _stalls.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Swapchain::reset_stats()
+{
+    _queued.store(0, std::memory_order_relaxed);
+    _presented.store(0, std::memory_order_relaxed);
+    _dropped.store(0, std::memory_order_relaxed);
+    _released.store(0, std::memory_order_relaxed);
+    _stalls.store(0, std::memory_order_relaxed);
+}
+
+int Swapchain::pop_pending()
+{
+    int id = _pending[0];
+    _pending_count--;
+    memmove(&_pending[0], &_pending[1], _pending_count * sizeof(_pending[0]));
+    return id;
+}
@@ -0,0 +1,107 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef SWAPCHAIN_H
+#define SWAPCHAIN_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define SWAPCHAIN_MIN_BUFFERS 2
+#define SWAPCHAIN_MAX_BUFFERS 8
+
+enum swapchain_mode_t {
+    // Every queued frame is delivered in order. The producer stalls when
+    // the consumer holds on to all buffers.
+    SWAPCHAIN_MODE_FIFO = 0,
+    // Only the latest queued frame is delivered. A newer frame replaces a
+    // pending one that the consumer has not picked up yet, so the producer
+    // never waits for the consumer.
+    SWAPCHAIN_MODE_MAILBOX
+};
+
+enum swapchain_buffer_state_t {
+    SWAPCHAIN_BUFFER_FREE = 0,  // owned by producer, may be written
+    SWAPCHAIN_BUFFER_DEQUEUED,  // producer is writing into it
+    SWAPCHAIN_BUFFER_PENDING,   // complete, waiting to be handed to the consumer
+    SWAPCHAIN_BUFFER_ACQUIRED   // owned by consumer until it sends a release
+};
+
+struct swapchain_stats_t
+{
+    uint64_t queued;    // frames completed by the producer
+    uint64_t presented; // frames handed to the consumer
+    uint64_t dropped;   // pending frames replaced before the consumer saw them
+    uint64_t released;  // buffers returned by the consumer
+    uint64_t stalls;    // dequeue attempts with no buffer available
+};
+
+// Bookkeeping for a ring of shared buffers. It only tracks ownership; the
+// buffers themselves are owned by the caller and referred to by index.
+// Not thread safe, use from the render thread only; only stats() may be
+// read from any thread.
+class Swapchain {
+
+public:
+    Swapchain();
+
+    // max_acquired limits how many buffers the consumer may hold at once.
+    bool init(int buffer_count, enum swapchain_mode_t mode, int max_acquired = 1);
+    // Every buffer is the producer's again, e.g. after the caller replaced
+    // them all. Pending frames count as dropped; stats are kept.
+    void restart();
+
+    int bufferCount() const { return _count; }
+    enum swapchain_mode_t mode() const { return _mode; }
+    enum swapchain_buffer_state_t state(int id) const { return _state[id]; }
+
+    // Returns index of a buffer the producer may write, or -1.
+    int dequeue();
+    // Marks a dequeued buffer as holding a complete frame.
+    void queue(int id);
+    // Returns the next pending buffer that may be sent to the consumer and
+    // marks it acquired, or -1 if nothing can be sent right now.
+    int acquireNext();
+    // Consumer is done with the buffer.
+    bool release(int id);
+    // Returns every buffer held by the consumer, e.g. after it disconnected.
+    void releaseAcquired();
+
+    // Counters so far, each read on its own and so possibly a frame apart
+    struct swapchain_stats_t stats() const;
+
+private:
+    int pop_pending();
+    void reset_stats();
+
+    int _count;
+    int _max_acquired;
+    int _acquired;
+    enum swapchain_mode_t _mode;
+    enum swapchain_buffer_state_t _state[SWAPCHAIN_MAX_BUFFERS];
+
+    // pending buffers in queue order
+    int _pending[SWAPCHAIN_MAX_BUFFERS];
+    int _pending_count;
+
+    std::atomic<uint64_t> _queued;
+    std::atomic<uint64_t> _presented;
+    std::atomic<uint64_t> _dropped;
+    std::atomic<uint64_t> _released;
+    std::atomic<uint64_t> _stalls;
+};
+
+#endif // SWAPCHAIN_H
@@ -0,0 +1,239 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "logger.h"
+#include "sync_fence.h"
+
+#define LOG_TAG "EglSample"
+
+static bool has_extension(const char *extensions, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = extensions;
+
+    while (p && (p = strstr(p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+        p += len;
+    }
+    return false;
+}
+
+FenceExporter::FenceExporter()
+    : _display(EGL_NO_DISPLAY), _native(false),
+      _eglCreateSyncKHR(0), _eglDestroySyncKHR(0), _eglDupNativeFenceFDANDROID(0),
+      _pending_count(0)
+{
+}
+
+FenceExporter::~FenceExporter()
+{
+    reset();
+}
+
+void FenceExporter::init(EGLDisplay display)
+{
+    reset();
+    _display = display;
+    _native = false;
+
+    if (display == EGL_NO_DISPLAY) {
+        LOG_INFO("fences: no GL, using CPU eventfd fences");
+        return;
+    }
+
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (has_extension(extensions, "EGL_ANDROID_native_fence_sync")) {
+        _eglCreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        _eglDestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        _eglDupNativeFenceFDANDROID =
+                (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+        _native = _eglCreateSyncKHR && _eglDestroySyncKHR && _eglDupNativeFenceFDANDROID;
+    }
+    LOG_INFO("fences: using %s", _native ? "native fence sync" : "GL fence + eventfd");
+}
+
+void FenceExporter::reset()
+{
+    // Signal everything outstanding so no consumer waits forever
+    for (int i = 0; i < _pending_count; i++) {
+        uint64_t value = 1;
+        if (_pending[i].sync) {
+            glDeleteSync(_pending[i].sync);
+        }
+        write(_pending[i].eventfd, &value, sizeof(value));
+        close(_pending[i].eventfd);
+    }
+    _pending_count = 0;
+}
+
+int FenceExporter::createFence(enum dmabuf_fence_type_t *type)
+{
+    int fd = -1;
+
+    if (_native) {
+        fd = create_native_fence();
+        if (fd >= 0) {
+            *type = DMABUF_FENCE_NATIVE;
+            return fd;
+        }
+    }
+
+    fd = create_eventfd_fence();
+    *type = fd >= 0 ? DMABUF_FENCE_EVENTFD : DMABUF_FENCE_NONE;
+    return fd;
+}
+
+int FenceExporter::create_native_fence()
+{
+    EGLSyncKHR sync = _eglCreateSyncKHR(_display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+    if (sync == EGL_NO_SYNC_KHR) {
+        LOG_ERROR("eglCreateSyncKHR() returned error %x", eglGetError());
+        return -1;
+    }
+
+    // The sync_file only exists once the fence command has been submitted.
+    // This is a flush, not a wait.
+    glFlush();
+
+    int fd = _eglDupNativeFenceFDANDROID(_display, sync);
+    _eglDestroySyncKHR(_display, sync);
+    if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+        LOG_ERROR("eglDupNativeFenceFDANDROID() returned error %x", eglGetError());
+        return -1;
+    }
+    return fd;
+}
+
+int FenceExporter::create_eventfd_fence()
+{
+    if (_display != EGL_NO_DISPLAY && _pending_count == SYNC_FENCE_MAX_PENDING) {
+        signalCompleted();
+        if (_pending_count == SYNC_FENCE_MAX_PENDING) {
+            // Waiting for the oldest would stall on the GPU, the caller
+            // finishes this frame without a fence instead
+            return -1;
+        }
+    }
+
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd < 0) {
+        LOG_ERROR("eventfd failed %s", strerror(errno));
+        return -1;
+    }
+
+    int fd = dup(efd);
+    if (fd < 0) {
+        LOG_ERROR("dup failed %s", strerror(errno));
+        close(efd);
+        return -1;
+    }
+
+    if (_display == EGL_NO_DISPLAY) {
+        // CPU producer: the frame is complete by the time it is queued
+        uint64_t value = 1;
+        write(efd, &value, sizeof(value));
+        close(efd);
+        return fd;
+    }
+
+    _pending[_pending_count].sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _pending[_pending_count].eventfd = efd;
+    _pending_count++;
+    glFlush();
+    return fd;
+}
+
+void FenceExporter::signalCompleted()
+{
+    int done = 0;
+
+    // GL fences complete in submission order
+    while (done < _pending_count) {
+        GLenum status = glClientWaitSync(_pending[done].sync, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        uint64_t value = 1;
+        glDeleteSync(_pending[done].sync);
+        write(_pending[done].eventfd, &value, sizeof(value));
+        close(_pending[done].eventfd);
+        done++;
+    }
+
+    if (done > 0) {
+        _pending_count -= done;
+        memmove(&_pending[0], &_pending[done], _pending_count * sizeof(_pending[0]));
+    }
+}
+
+bool sync_fence_wait(int fence_fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = fence_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    for (;;) {
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret > 0) {
+            return (pfd.revents & POLLIN) != 0;
+        }
+        if (ret == 0) {
+            return false;
+        }
+        if (errno != EINTR) {
+            LOG_ERROR("fence poll failed %s", strerror(errno));
+            return false;
+        }
+    }
+}
+
+bool sync_fence_gpu_wait(EGLDisplay display, int fence_fd)
+{
+    PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR =
+            (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR =
+            (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    PFNEGLWAITSYNCKHRPROC eglWaitSyncKHR =
+            (PFNEGLWAITSYNCKHRPROC)eglGetProcAddress("eglWaitSyncKHR");
+    if (!eglCreateSyncKHR || !eglDestroySyncKHR || !eglWaitSyncKHR) {
+        return false;
+    }
+
+    const EGLint attribs[] = {
+        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fence_fd,
+        EGL_NONE
+    };
+    EGLSyncKHR sync = eglCreateSyncKHR(display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+    if (sync == EGL_NO_SYNC_KHR) {
+        LOG_ERROR("fence import returned error %x", eglGetError());
+        return false;
+    }
+
+    // EGL now owns fence_fd
+    EGLint waited = eglWaitSyncKHR(display, sync, 0);
+    eglDestroySyncKHR(display, sync);
+    return waited == EGL_TRUE;
+}
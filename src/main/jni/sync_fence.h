@@ -0,0 +1,84 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef SYNC_FENCE_H
+#define SYNC_FENCE_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+
+#include "dmabuf_protocol.h"
+
+#define SYNC_FENCE_MAX_PENDING 8
+
+// Produces a pollable fd per frame that signals once the GPU finished the
+// work submitted so far, so the consumer waits instead of the producer.
+//
+// With EGL_ANDROID_native_fence_sync the fd is a kernel sync_file the
+// consumer GPU can wait on directly. Otherwise an eventfd is handed out and
+// signalled from signalCompleted() once a GL fence has passed; without a GL
+// context (CPU producers) it is signalled immediately.
+class FenceExporter {
+
+public:
+    FenceExporter();
+    virtual ~FenceExporter();
+
+    // display may be EGL_NO_DISPLAY when nothing is rendered with GL.
+    void init(EGLDisplay display);
+    void reset();
+
+    // Returns a new fence fd owned by the caller, or -1, e.g. while
+    // SYNC_FENCE_MAX_PENDING eventfd fences wait for the GPU. Without a
+    // fence the caller must complete the frame itself, e.g. glFinish().
+    int createFence(enum dmabuf_fence_type_t *type);
+
+    // Signals eventfd fences whose GL work has completed. Never blocks.
+    void signalCompleted();
+
+    bool hasNativeFence() const { return _native; }
+    // eventfd fences still waiting for signalCompleted()
+    bool hasPending() const { return _pending_count > 0; }
+
+private:
+    int create_native_fence();
+    int create_eventfd_fence();
+
+    EGLDisplay _display;
+    bool _native;
+    PFNEGLCREATESYNCKHRPROC _eglCreateSyncKHR;
+    PFNEGLDESTROYSYNCKHRPROC _eglDestroySyncKHR;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC _eglDupNativeFenceFDANDROID;
+
+    struct pending_fence_t
+    {
+        GLsync sync;
+        int eventfd;
+    };
+    struct pending_fence_t _pending[SYNC_FENCE_MAX_PENDING];
+    int _pending_count;
+};
+
+// Consumer side: blocks until the fence signals or timeout_ms elapses
+// (-1 waits forever). Works for both fence types.
+bool sync_fence_wait(int fence_fd, int timeout_ms);
+
+// Consumer side: makes the current GL context wait for a native fence
+// without blocking the CPU. Takes ownership of fence_fd on success.
+bool sync_fence_gpu_wait(EGLDisplay display, int fence_fd);
+
+#endif // SYNC_FENCE_H
@@ -0,0 +1,300 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <EGL/egl.h>
+
+#include "logger.h"
+#include "texture_upload.h"
+
+#define LOG_TAG "EglSample"
+
+// How long begin() waits for a slot before giving up
+#define UPLOAD_WAIT_TIMEOUT_NS 100000000ULL
+
+static PFNGLBUFFERSTORAGEEXTPROC glBufferStorageEXT_ = NULL;
+
+static bool has_gl_extension(const char *name)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    return extensions && strstr(extensions, name) != NULL;
+}
+
+TextureUploader::TextureUploader()
+    : _width(0), _height(0), _size(0), _slot_count(0), _current(0),
+      _mapped(false), _persistent(false)
+{
+    memset(_buffers, 0, sizeof(_buffers));
+    memset(_fences, 0, sizeof(_fences));
+    memset(_pointers, 0, sizeof(_pointers));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+TextureUploader::~TextureUploader()
+{
+    // GL objects go with the context; reset() must be called while current
+}
+
+bool TextureUploader::init(uint32_t width, uint32_t height, int slots)
+{
+    reset();
+
+    if (slots < 1 || slots > UPLOAD_MAX_SLOTS) {
+        LOG_ERROR("upload: invalid slot count %d", slots);
+        return false;
+    }
+
+    _width = width;
+    _height = height;
+    _size = (size_t)width * height * 4;
+    _slot_count = slots;
+    _current = slots - 1;
+
+    if (has_gl_extension("GL_EXT_buffer_storage")) {
+        glBufferStorageEXT_ = (PFNGLBUFFERSTORAGEEXTPROC)eglGetProcAddress("glBufferStorageEXT");
+    }
+    _persistent = glBufferStorageEXT_ != NULL;
+
+    glGenBuffers(_slot_count, _buffers);
+    for (int i = 0; i < _slot_count; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[i]);
+        if (_persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+            glBufferStorageEXT_(GL_PIXEL_UNPACK_BUFFER, _size, NULL, flags);
+            _pointers[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _size, flags);
+            if (!_pointers[i]) {
+                LOG_ERROR("upload: persistent mapping failed %x", glGetError());
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                reset();
+                return false;
+            }
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, _size, NULL, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOG_ERROR("upload: creating buffers failed %x", err);
+        reset();
+        return false;
+    }
+
+    LOG_INFO("upload: %d slots of %ux%u, %s", _slot_count, width, height,
+             _persistent ? "persistently mapped" : "mapped per upload");
+    return true;
+}
+
+void TextureUploader::reset()
+{
+    for (int i = 0; i < _slot_count; i++) {
+        if (_fences[i]) {
+            glDeleteSync(_fences[i]);
+            _fences[i] = 0;
+        }
+        if (_pointers[i]) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[i]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            _pointers[i] = NULL;
+        }
+    }
+    if (_slot_count > 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(_slot_count, _buffers);
+        memset(_buffers, 0, sizeof(_buffers));
+    }
+    _slot_count = 0;
+    _mapped = false;
+}
+
+void *TextureUploader::begin()
+{
+    if (_slot_count == 0 || _mapped) {
+        return NULL;
+    }
+
+    int slot = (_current + 1) % _slot_count;
+    if (!wait_slot(slot)) {
+        return NULL;
+    }
+
+    void *pointer = _pointers[slot];
+    if (!pointer) {
+        // Unsynchronized: the fence already told us the GPU is done with it
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[slot]);
+        pointer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _size,
+                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                                   GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!pointer) {
+            LOG_ERROR("upload: glMapBufferRange failed %x", glGetError());
+            return NULL;
+        }
+    }
+
+    _current = slot;
+    _mapped = true;
+    return pointer;
+}
+
+bool TextureUploader::end(GLuint texture, const struct dmabuf_rect_t *rects, int count)
+{
+    if (!_mapped) {
+        return false;
+    }
+    _mapped = false;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[_current]);
+    if (!_persistent && !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        // contents were lost, skip this upload
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (rects) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, _width);
+        for (int i = 0; i < count; i++) {
+            size_t offset = ((size_t)rects[i].y * _width + rects[i].x) * 4;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rects[i].x, rects[i].y, rects[i].width, rects[i].height,
+                            GL_RGBA, GL_UNSIGNED_BYTE, (const void *)offset);
+            _stats.bytes += (size_t)rects[i].width * rects[i].height * 4;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        _stats.bytes += _size;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    _fences[_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _stats.uploads++;
+
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        LOG_ERROR("upload: glTexSubImage2D from buffer failed %x", err);
+        return false;
+    }
+    return true;
+}
+
+bool TextureUploader::upload(GLuint texture, const void *pixels,
+                             const struct dmabuf_rect_t *rects, int count)
+{
+    uint8_t *dst = (uint8_t *)begin();
+    if (!dst) {
+        return false;
+    }
+
+    if (!rects) {
+        memcpy(dst, pixels, _size);
+        return end(texture);
+    }
+
+    // Only the damaged rows travel, at the same place they have in pixels
+    size_t pitch = (size_t)_width * 4;
+    for (int i = 0; i < count; i++) {
+        size_t offset = (size_t)rects[i].y * pitch + (size_t)rects[i].x * 4;
+        for (int row = 0; row < rects[i].height; row++) {
+            memcpy(dst + offset, (const uint8_t *)pixels + offset, (size_t)rects[i].width * 4);
+            offset += pitch;
+        }
+    }
+    return end(texture, rects, count);
+}
+
+bool TextureUploader::wait_slot(int slot)
+{
+    if (!_fences[slot]) {
+        return true;
+    }
+
+    GLenum status = glClientWaitSync(_fences[slot], 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        _stats.stalls++;
+        status = glClientWaitSync(_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, UPLOAD_WAIT_TIMEOUT_NS);
+    }
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        LOG_ERROR("upload: slot %d still busy (%x)", slot, status);
+        return false;
+    }
+
+    glDeleteSync(_fences[slot]);
+    _fences[slot] = 0;
+    return true;
+}
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int texture_upload_benchmark(int iterations, struct upload_benchmark_result_t *results,
+                             int max_results)
+{
+    int count = 0;
+
+    for (uint32_t size = 256; size <= 4096 && count < max_results; size *= 2) {
+        size_t bytes = (size_t)size * size * 4;
+        uint8_t *pixels = (uint8_t *)malloc(bytes);
+        if (!pixels) {
+            break;
+        }
+        memset(pixels, 0x80, bytes);
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size, size);
+
+        double start = now_ms();
+        for (int i = 0; i < iterations; i++) {
+            pixels[i % bytes]++;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+        glFinish();
+        double direct = (now_ms() - start) / iterations;
+
+        TextureUploader uploader;
+        double pbo = -1;
+        if (uploader.init(size, size)) {
+            start = now_ms();
+            for (int i = 0; i < iterations; i++) {
+                pixels[i % bytes]++;
+                uploader.upload(texture, pixels);
+            }
+            glFinish();
+            pbo = (now_ms() - start) / iterations;
+            uploader.reset();
+        }
+
+        glDeleteTextures(1, &texture);
+        free(pixels);
+
+        LOG_INFO("upload %ux%u: direct %.3f ms, pbo %.3f ms", size, size, direct, pbo);
+        results[count].size = size;
+        results[count].direct_ms = direct;
+        results[count].pbo_ms = pbo;
+        count++;
+    }
+    return count;
+}
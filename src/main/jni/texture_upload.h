@@ -0,0 +1,104 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef TEXTURE_UPLOAD_H
+#define TEXTURE_UPLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "dmabuf_protocol.h"
+
+#define UPLOAD_MAX_SLOTS 4
+#define UPLOAD_DEFAULT_SLOTS 3
+
+struct upload_stats_t
+{
+    uint64_t uploads;
+    uint64_t bytes;     // copied into the texture
+    uint64_t stalls;    // begin() had to wait for the GPU to finish a slot
+};
+
+// Streams RGBA8 texture contents through a ring of pixel unpack buffers.
+//
+// The CPU writes the next image into a buffer the driver can read directly
+// and the copy into the texture runs on the GPU, overlapping with drawing,
+// instead of glTexSubImage2D copying client memory on the render thread.
+// Slots are reused only after the fence of their previous copy passed. With
+// GL_EXT_buffer_storage the ring is mapped once, persistently; otherwise
+// each slot is mapped per upload.
+//
+// Requires an OpenGL ES 3.0 context current on the calling thread.
+class TextureUploader {
+
+public:
+    TextureUploader();
+    virtual ~TextureUploader();
+
+    bool init(uint32_t width, uint32_t height, int slots = UPLOAD_DEFAULT_SLOTS);
+    void reset();
+
+    // Returns memory for the next width x height RGBA8 image, rows tightly
+    // packed, or NULL. Must be followed by end().
+    void *begin();
+    // Copies the image written since begin() into texture level 0. With
+    // rects only those parts are copied and only they need to be written.
+    bool end(GLuint texture, const struct dmabuf_rect_t *rects = NULL, int count = 0);
+
+    // begin() + memcpy of rects (the whole image without) + end()
+    bool upload(GLuint texture, const void *pixels,
+                const struct dmabuf_rect_t *rects = NULL, int count = 0);
+
+    bool isPersistent() const { return _persistent; }
+    // pixel buffers of the ring and the memory they take
+    int slots() const { return _slot_count; }
+    size_t bytes() const { return _size * _slot_count; }
+    const struct upload_stats_t &stats() const { return _stats; }
+
+private:
+    bool wait_slot(int slot);
+
+    uint32_t _width;
+    uint32_t _height;
+    size_t _size;
+    int _slot_count;
+    int _current;
+    bool _mapped;
+    bool _persistent;
+
+    GLuint _buffers[UPLOAD_MAX_SLOTS];
+    GLsync _fences[UPLOAD_MAX_SLOTS];
+    void *_pointers[UPLOAD_MAX_SLOTS]; // persistent mappings
+
+    struct upload_stats_t _stats;
+};
+
+struct upload_benchmark_result_t
+{
+    uint32_t size;          // texture edge in pixels
+    double direct_ms;       // glTexSubImage2D from client memory, per upload
+    double pbo_ms;          // TextureUploader, per upload
+};
+
+// Times both upload paths for square textures from 256 up to 4096 pixels
+// with the current context and logs the results. Returns the number of
+// results filled.
+int texture_upload_benchmark(int iterations, struct upload_benchmark_result_t *results,
+                             int max_results);
+
+#endif // TEXTURE_UPLOAD_H
@@ -0,0 +1,205 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACING
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __ANDROID__
+#include <dlfcn.h>
+#endif
+
+// Names longer than this are cut short
+#define TRACE_MAX_MESSAGE 256
+
+static const char *trace_marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker"
+};
+
+static int marker_fd = -1;
+static int trace_pid = 0;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+#ifdef __ANDROID__
+
+// ATrace is resolved at run time: sections need Android 6.0, async
+// sections and counters Android 10. Whatever is missing goes through
+// trace_marker instead.
+struct atrace_api_t
+{
+    bool (*is_enabled)();
+    void (*begin_section)(const char *name);
+    void (*end_section)();
+    void (*begin_async_section)(const char *name, int32_t cookie);
+    void (*end_async_section)(const char *name, int32_t cookie);
+    void (*set_counter)(const char *name, int64_t value);
+};
+
+static struct atrace_api_t atrace;
+
+#endif
+
+static void trace_init()
+{
+    trace_pid = getpid();
+
+#ifdef __ANDROID__
+    void *lib = dlopen("libandroid.so", RTLD_NOW);
+    if (lib) {
+        atrace.is_enabled = (bool (*)())dlsym(lib, "ATrace_isEnabled");
+        atrace.begin_section = (void (*)(const char *))dlsym(lib, "ATrace_beginSection");
+        atrace.end_section = (void (*)())dlsym(lib, "ATrace_endSection");
+        atrace.begin_async_section = (void (*)(const char *, int32_t))dlsym(lib, "ATrace_beginAsyncSection");
+        atrace.end_async_section = (void (*)(const char *, int32_t))dlsym(lib, "ATrace_endAsyncSection");
+        atrace.set_counter = (void (*)(const char *, int64_t))dlsym(lib, "ATrace_setCounter");
+    }
+#endif
+
+    for (size_t i = 0; i < sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]) && marker_fd < 0; i++) {
+        marker_fd = open(trace_marker_paths[i], O_WRONLY | O_CLOEXEC);
+    }
+}
+
+static inline void trace_init_once()
+{
+    pthread_once(&trace_once, trace_init);
+}
+
+static void write_marker(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void write_marker(const char *format, ...)
+{
+    char message[TRACE_MAX_MESSAGE];
+    va_list args;
+
+    if (marker_fd < 0) {
+        return;
+    }
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if (length >= (int)sizeof(message)) {
+        length = sizeof(message) - 1;
+    }
+    // one write() per event keeps events from threads whole
+    if (write(marker_fd, message, length) < 0) {
+        return;
+    }
+}
+
+bool trace_is_enabled()
+{
+    trace_init_once();
+#ifdef __ANDROID__
+    if (atrace.is_enabled) {
+        return atrace.is_enabled();
+    }
+#endif
+    return marker_fd >= 0;
+}
+
+void trace_begin(const char *name)
+{
+    if (!trace_is_enabled()) {
+        return;
+    }
+#ifdef __ANDROID__
+    if (atrace.begin_section) {
+        atrace.begin_section(name);
+        return;
+    }
+#endif
+    write_marker("B|%d|%s", trace_pid, name);
+}
+
+void trace_begin_frame(const char *name, uint64_t frame_id)
+{
+    char section[TRACE_MAX_MESSAGE];
+
+    if (!trace_is_enabled()) {
+        return;
+    }
+    snprintf(section, sizeof(section), "%s #%llu", name, (unsigned long long)frame_id);
+    trace_begin(section);
+}
+
+void trace_end()
+{
+    if (!trace_is_enabled()) {
+        return;
+    }
+#ifdef __ANDROID__
+    if (atrace.end_section) {
+        atrace.end_section();
+        return;
+    }
+#endif
+    write_marker("E|%d", trace_pid);
+}
+
+void trace_async_begin(const char *name, uint64_t cookie)
+{
+    if (!trace_is_enabled()) {
+        return;
+    }
+#ifdef __ANDROID__
+    if (atrace.begin_async_section) {
+        atrace.begin_async_section(name, (int32_t)cookie);
+        return;
+    }
+#endif
+    write_marker("S|%d|%s|%d", trace_pid, name, (int32_t)cookie);
+}
+
+void trace_async_end(const char *name, uint64_t cookie)
+{
+    if (!trace_is_enabled()) {
+        return;
+    }
+#ifdef __ANDROID__
+    if (atrace.end_async_section) {
+        atrace.end_async_section(name, (int32_t)cookie);
+        return;
+    }
+#endif
+    write_marker("F|%d|%s|%d", trace_pid, name, (int32_t)cookie);
+}
+
+void trace_counter(const char *name, int64_t value)
+{
+    if (!trace_is_enabled()) {
+        return;
+    }
+#ifdef __ANDROID__
+    if (atrace.set_counter) {
+        atrace.set_counter(name, value);
+        return;
+    }
+#endif
+    write_marker("C|%d|%s|%lld", trace_pid, name, (long long)value);
+}
+
+#endif // ENABLE_TRACING
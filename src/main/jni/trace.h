@@ -0,0 +1,79 @@
+//
+// Copyright 2011 Tero Saarni
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Trace sections for systrace / Perfetto.
+//
+// Built with ENABLE_TRACING the macros emit slices through ATrace on
+// Android and through the ftrace trace_marker on Linux, in the text format
+// both tools parse. Slices are only written while a trace is being
+// recorded. Without ENABLE_TRACING every macro compiles to nothing.
+//
+// Frames are correlated across processes by the frame id FRAME_READY and
+// BUFFER_RELEASE carry: per-frame slices on both sides have the id in
+// their name, and each side keeps an async slice "frame" with the id as
+// cookie open while the consumer holds the frame.
+//
+//     TRACE_SCOPE("gl_draw_scene");
+//     TRACE_FRAME_SCOPE("present", frame_id);
+//     TRACE_ASYNC_BEGIN("frame", frame_id);
+
+#ifdef ENABLE_TRACING
+
+void trace_begin(const char *name);
+void trace_begin_frame(const char *name, uint64_t frame_id);
+void trace_end();
+void trace_async_begin(const char *name, uint64_t cookie);
+void trace_async_end(const char *name, uint64_t cookie);
+void trace_counter(const char *name, int64_t value);
+bool trace_is_enabled();
+
+class TraceScope {
+
+public:
+    TraceScope(const char *name) { trace_begin(name); }
+    TraceScope(const char *name, uint64_t frame_id) { trace_begin_frame(name, frame_id); }
+    ~TraceScope() { trace_end(); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END() trace_end()
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_FRAME_SCOPE(name, frame_id) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, frame_id)
+#define TRACE_ASYNC_BEGIN(name, cookie) trace_async_begin(name, cookie)
+#define TRACE_ASYNC_END(name, cookie) trace_async_end(name, cookie)
+#define TRACE_COUNTER(name, value) trace_counter(name, value)
+
+#else
+
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END() do { } while (0)
+#define TRACE_SCOPE(name) do { } while (0)
+#define TRACE_FRAME_SCOPE(name, frame_id) do { } while (0)
+#define TRACE_ASYNC_BEGIN(name, cookie) do { } while (0)
+#define TRACE_ASYNC_END(name, cookie) do { } while (0)
+#define TRACE_COUNTER(name, value) do { } while (0)
+
+#endif
+
+#endif // TRACE_H